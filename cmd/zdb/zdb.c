@@ -546,16 +546,38 @@ dump_metaslab_stats(metaslab_t *msp)
 {
 	char maxbuf[32];
 	space_map_t *sm = &msp->ms_map;
-	avl_tree_t *t = sm->sm_pp_root;
+	btree_t *t = sm->sm_pp_root;
 	int free_pct = sm->sm_space * 100 / sm->sm_size;
 
 	zdb_nicenum(space_map_maxsize(sm), maxbuf);
 
 	(void) printf("\t %25s %10lu   %7s  %6s   %4s %4d%%\n",
-	    "segments", avl_numnodes(t), "maxsize", maxbuf,
+	    "segments", btree_numnodes(t), "maxsize", maxbuf,
 	    "freepct", free_pct);
 }
 
+static void
+dump_spacemap_histogram(space_map_obj_t *smo, space_map_histogram_t *smh,
+    uint8_t shift)
+{
+	char sizebuf[32];
+	int i;
+
+	if (!space_map_histogram_valid(smo, smh))
+		return;
+
+	(void) printf("\t%25s\n", "free segment histogram:");
+	for (i = 0; i < SPACE_MAP_HISTOGRAM_SIZE; i++) {
+		if (smh->smh_histogram[i] == 0)
+			continue;
+		zdb_nicenum(1ULL << (i + shift), sizebuf);
+		(void) printf("\t %25s %10llu\n", sizebuf,
+		    (u_longlong_t)smh->smh_histogram[i]);
+	}
+	zdb_nicenum(space_map_max_free(smo, smh, shift), sizebuf);
+	(void) printf("\t %25s %10s\n", "max free segment", sizebuf);
+}
+
 static void
 dump_metaslab(metaslab_t *msp)
 {
@@ -583,6 +605,9 @@ dump_metaslab(metaslab_t *msp)
 		mutex_exit(&msp->ms_lock);
 	}
 
+	if (dump_opt['m'] > 1)
+		dump_spacemap_histogram(smo, &msp->ms_smh, sm->sm_shift);
+
 	if (dump_opt['d'] > 5 || dump_opt['m'] > 2) {
 		ASSERT(sm->sm_size == (1ULL << vd->vdev_ms_shift));
 
@@ -2285,8 +2310,10 @@ dump_block_stats(spa_t *spa)
 
 	tzb = &zcb.zcb_type[ZB_TOTAL][ZDB_OT_TOTAL];
 
-	norm_alloc = metaslab_class_get_alloc(spa_normal_class(spa));
-	norm_space = metaslab_class_get_space(spa_normal_class(spa));
+	norm_alloc = metaslab_class_get_alloc(spa_normal_class(spa)) +
+	    metaslab_class_get_alloc(spa_special_class(spa));
+	norm_space = metaslab_class_get_space(spa_normal_class(spa)) +
+	    metaslab_class_get_space(spa_special_class(spa));
 
 	total_alloc = norm_alloc + metaslab_class_get_alloc(spa_log_class(spa));
 	total_found = tzb->zb_asize - zcb.zcb_dedup_asize;
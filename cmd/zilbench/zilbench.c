@@ -0,0 +1,260 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * zilbench measures contention in zil_itx_assign().  It creates a file
+ * backed pool with one dataset, then has a growing number of threads
+ * log small TX_CREATE records into that dataset's intent log, as a
+ * metadata heavy workload would, and reports the assignment rate.
+ *
+ * Each thread count is run twice: with every itx staged on one shared
+ * list (zil_itx_percpu = 0), which serializes assignment the way the
+ * single per-txg itxg lock did, and with itxs staged per CPU.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/dmu.h>
+#include <sys/dmu_objset.h>
+#include <sys/txg.h>
+#include <sys/zil.h>
+#include <sys/fs/zfs.h>
+
+const char cmdname[] = "zilbench";
+
+extern int zil_itx_percpu;
+extern char *spa_config_path;
+
+#define	ZB_POOL		"zilbench"
+#define	ZB_DATASET	ZB_POOL "/bench"
+#define	ZB_NAMELEN	16
+
+static char *zb_dir = "/tmp";
+static uint64_t zb_size = 256ULL << 20;
+static int zb_threads = 64;
+static uint64_t zb_count = 10000;
+static uint64_t zb_batch = 32;
+static uint64_t zb_commit;
+
+static objset_t *zb_os;
+static zilog_t *zb_zilog;
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr,
+	    "Usage: %s [-d dir] [-t threads] [-n count] [-b batch] "
+	    "[-c commit]\n"
+	    "\t-d  directory for the pool's backing file (default %s)\n"
+	    "\t-t  largest number of threads to run (default %d)\n"
+	    "\t-n  records each thread logs (default %llu)\n"
+	    "\t-b  records logged per transaction (default %llu)\n"
+	    "\t-c  commit the log every this many records per thread "
+	    "(default: never)\n",
+	    cmdname, zb_dir, zb_threads, (u_longlong_t)zb_count,
+	    (u_longlong_t)zb_batch);
+	exit(1);
+}
+
+/*
+ * Each thread creates files in its own directory, as independent
+ * metadata operations would.  zil_itx_create() makes the records
+ * synchronous, as zfs_log_create() leaves them, so every thread's
+ * records go to the sync list.
+ */
+static void *
+zb_thread(void *arg)
+{
+	uint64_t id = (uintptr_t)arg;
+	uint64_t i, j;
+	dmu_tx_t *tx;
+	itx_t *itx;
+	lr_create_t *lr;
+
+	for (i = 0; i < zb_count; i += zb_batch) {
+		tx = dmu_tx_create(zb_os);
+		VERIFY3U(0, ==, dmu_tx_assign(tx, TXG_WAIT));
+
+		for (j = i; j < MIN(i + zb_batch, zb_count); j++) {
+			itx = zil_itx_create(TX_CREATE,
+			    sizeof (lr_create_t) + ZB_NAMELEN);
+			lr = (lr_create_t *)&itx->itx_lr;
+			lr->lr_doid = id + 1;
+			lr->lr_foid = (id << 32) | j;
+			lr->lr_gen = dmu_tx_get_txg(tx);
+			(void) snprintf((char *)(lr + 1), ZB_NAMELEN,
+			    "f%llu", (u_longlong_t)j);
+			itx->itx_oid = lr->lr_foid;
+			zil_itx_assign(zb_zilog, itx, tx);
+		}
+
+		dmu_tx_commit(tx);
+
+		if (zb_commit != 0 && (j / zb_commit) != (i / zb_commit))
+			zil_commit(zb_zilog, 0);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Run nthreads loggers to completion and return the elapsed time.
+ */
+static hrtime_t
+zb_run(int nthreads)
+{
+	pthread_t *tids;
+	hrtime_t start;
+	int t;
+
+	tids = kmem_alloc(nthreads * sizeof (pthread_t), KM_SLEEP);
+
+	start = gethrtime();
+	for (t = 0; t < nthreads; t++) {
+		VERIFY3U(0, ==, pthread_create(&tids[t], NULL, zb_thread,
+		    (void *)(uintptr_t)t));
+	}
+	for (t = 0; t < nthreads; t++)
+		VERIFY3U(0, ==, pthread_join(tids[t], NULL));
+	start = gethrtime() - start;
+
+	kmem_free(tids, nthreads * sizeof (pthread_t));
+
+	/* don't let one run's txg syncs and frees land in the next */
+	txg_wait_synced(dmu_objset_pool(zb_os), 0);
+
+	return (start);
+}
+
+static nvlist_t *
+zb_make_vdev_root(const char *path)
+{
+	nvlist_t *file, *root;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1 || ftruncate(fd, zb_size) != 0) {
+		(void) fprintf(stderr, "%s: can't create %s\n", cmdname, path);
+		exit(1);
+	}
+	(void) close(fd);
+
+	VERIFY(nvlist_alloc(&file, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(file, ZPOOL_CONFIG_TYPE, VDEV_TYPE_FILE) == 0);
+	VERIFY(nvlist_add_string(file, ZPOOL_CONFIG_PATH, path) == 0);
+
+	VERIFY(nvlist_alloc(&root, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(root, ZPOOL_CONFIG_TYPE, VDEV_TYPE_ROOT) == 0);
+	VERIFY(nvlist_add_nvlist_array(root, ZPOOL_CONFIG_CHILDREN,
+	    &file, 1) == 0);
+	nvlist_free(file);
+
+	return (root);
+}
+
+int
+main(int argc, char **argv)
+{
+	char path[MAXPATHLEN], cache[MAXPATHLEN];
+	nvlist_t *nvroot;
+	hrtime_t single_ns, percpu_ns;
+	uint64_t ops;
+	int c, nthreads;
+
+	while ((c = getopt(argc, argv, "d:t:n:b:c:")) != -1) {
+		switch (c) {
+		case 'd':
+			zb_dir = optarg;
+			break;
+		case 't':
+			zb_threads = atoi(optarg);
+			break;
+		case 'n':
+			zb_count = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			zb_batch = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			zb_commit = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (zb_threads < 1 || zb_count == 0 || zb_batch == 0)
+		usage();
+
+	(void) snprintf(path, sizeof (path), "%s/%s.vdev", zb_dir, ZB_POOL);
+	(void) snprintf(cache, sizeof (cache), "%s/%s.cache", zb_dir, ZB_POOL);
+	spa_config_path = cache;
+
+	kernel_init(FREAD | FWRITE);
+
+	nvroot = zb_make_vdev_root(path);
+	VERIFY3U(0, ==, spa_create(ZB_POOL, nvroot, NULL, NULL, NULL));
+	nvlist_free(nvroot);
+
+	VERIFY3U(0, ==, dmu_objset_create(ZB_DATASET, DMU_OST_OTHER, 0,
+	    NULL, NULL));
+	VERIFY3U(0, ==, dmu_objset_own(ZB_DATASET, DMU_OST_OTHER, B_FALSE,
+	    FTAG, &zb_os));
+	zb_zilog = zil_open(zb_os, NULL);
+
+	(void) printf("%llu records per thread, %llu per tx, ",
+	    (u_longlong_t)zb_count, (u_longlong_t)zb_batch);
+	if (zb_commit != 0)
+		(void) printf("commit every %llu\n", (u_longlong_t)zb_commit);
+	else
+		(void) printf("no commits\n");
+	(void) printf("%-8s %18s %18s %8s\n",
+	    "threads", "single", "per-cpu", "speedup");
+
+	for (nthreads = 1; nthreads <= zb_threads; nthreads *= 2) {
+		ops = nthreads * zb_count;
+
+		zil_itx_percpu = 0;
+		single_ns = zb_run(nthreads);
+		zil_itx_percpu = 1;
+		percpu_ns = zb_run(nthreads);
+
+		(void) printf("%-8d %12.0f ops/s %12.0f ops/s %7.2fx\n",
+		    nthreads,
+		    (double)ops * NANOSEC / MAX(single_ns, 1),
+		    (double)ops * NANOSEC / MAX(percpu_ns, 1),
+		    (double)single_ns / MAX(percpu_ns, 1));
+	}
+
+	zil_close(zb_zilog);
+	dmu_objset_disown(zb_os, FTAG);
+	VERIFY3U(0, ==, spa_destroy(ZB_POOL));
+
+	kernel_fini();
+	(void) unlink(path);
+	(void) unlink(cache);
+
+	return (0);
+}
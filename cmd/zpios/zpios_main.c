@@ -43,7 +43,7 @@
 #include "zpios.h"
 
 static const char short_opt[] = "t:l:h:e:n:i:j:k:o:m:q:r:c:a:b:g:s:A:B:C:"
-                                "L:p:M:xP:R:G:I:N:T:VzOfHv?";
+                                "L:p:M:xP:R:G:I:N:T:VzOSYfF:Hv?";
 static const struct option long_opt[] = {
 	{"threadcount",         required_argument, 0, 't' },
 	{"threadcount_low",     required_argument, 0, 'l' },
@@ -78,7 +78,10 @@ static const struct option long_opt[] = {
 	{"verify",              no_argument,       0, 'V' },
 	{"zerocopy",            no_argument,       0, 'z' },
 	{"nowait",              no_argument,       0, 'O' },
+	{"sync",                no_argument,       0, 'S' },
+	{"synccopy",            no_argument,       0, 'Y' },
 	{"noprefetch",          no_argument,       0, 'f' },
+	{"fill",                required_argument, 0, 'F' },
 	{"human-readable",      no_argument,       0, 'H' },
 	{"verbose",             no_argument,       0, 'v' },
 	{"help",                no_argument,       0, '?' },
@@ -128,7 +131,10 @@ usage(void)
 	        "	--verify            -V\n"
 	        "	--zerocopy          -z\n"
 	        "	--nowait            -O\n"
+		"	--sync              -S\n"
+		"	--synccopy          -Y\n"
 		"	--noprefetch        -f\n"
+		"	--fill              -F    =zero|random\n"
 	        "	--human-readable    -H\n"
 	        "	--verbose           -v    =increase verbosity\n"
 	        "	--help              -?    =this help\n\n");
@@ -288,9 +294,26 @@ args_init(int argc, char **argv)
 		case 'O': /* --nowait */
 			args->flags |= DMU_WRITE_NOWAIT;
 			break;
+		case 'S': /* --sync */
+			args->flags |= DMU_WRITE_SYNC;
+			break;
+		case 'Y': /* --synccopy */
+			args->flags |= (DMU_WRITE_SYNC | DMU_WRITE_SYNC_COPY);
+			break;
 		case 'f': /* --noprefetch */
 			args->flags |= DMU_READ_NOPF;
 			break;
+		case 'F': /* --fill */
+			if (!strcmp(optarg, "zero")) {
+				args->flags |= DMU_FILL_ZERO;
+			} else if (!strcmp(optarg, "random")) {
+				args->flags |= DMU_FILL_RANDOM;
+			} else {
+				fprintf(stderr, "Error: Invalid fill '%s', "
+				        "must be zero or random\n", optarg);
+				rc = EINVAL;
+			}
+			break;
 		case 'H': /* --human-readable */
 			args->human_readable = 1;
 			break;
@@ -335,6 +358,15 @@ args_init(int argc, char **argv)
 		return NULL;
 	}
 
+	if ((args->flags & (DMU_FILL_ZERO | DMU_FILL_RANDOM)) &&
+	    (args->flags & DMU_VERIFY)) {
+                fprintf(stderr, "Error, --fill incompatible --verify, "
+                            "used for performance analysis only\n");
+		usage();
+		args_fini(args);
+		return NULL;
+	}
+
 	return args;
 }
 
@@ -124,7 +124,9 @@ print_flags(char *str, uint32_t flags)
 	str[4] = (flags & DMU_FPP)    ? 'p' : 's';
 	str[5] = (flags & (DMU_WRITE_ZC | DMU_READ_ZC)) ? 'z' : '-';
 	str[6] = (flags & DMU_WRITE_NOWAIT) ? 'O' : '-';
-	str[7] = '\0';
+	str[7] = (flags & DMU_WRITE_SYNC_COPY) ? 'Y' :
+	         (flags & DMU_WRITE_SYNC) ? 'S' : '-';
+	str[8] = '\0';
 
 	return str;
 }
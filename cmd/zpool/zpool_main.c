@@ -790,11 +790,14 @@ zpool_do_create(int argc, char **argv)
 	if (nvroot == NULL)
 		goto errout;
 
-	/* make_root_vdev() allows 0 toplevel children if there are spares */
+	/*
+	 * make_root_vdev() allows 0 toplevel children if there are spares,
+	 * or if they are all log or special devices.
+	 */
 	if (!zfs_allocatable_devs(nvroot)) {
 		(void) fprintf(stderr, gettext("invalid vdev "
-		    "specification: at least one toplevel vdev must be "
-		    "specified\n"));
+		    "specification: at least one toplevel vdev that is not "
+		    "a log or special device must be specified\n"));
 		goto errout;
 	}
 
@@ -1293,13 +1296,16 @@ print_status_config(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 
 	for (c = 0; c < children; c++) {
 		uint64_t islog = B_FALSE, ishole = B_FALSE;
+		uint64_t isspecial = B_FALSE;
 
-		/* Don't print logs or holes here */
+		/* Don't print logs, special vdevs or holes here */
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
 		    &islog);
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_SPECIAL,
+		    &isspecial);
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
-		if (islog || ishole)
+		if (islog || isspecial || ishole)
 			continue;
 		vname = zpool_vdev_name(g_zfs, zhp, child[c], B_TRUE);
 		print_status_config(zhp, vname, child[c],
@@ -1372,11 +1378,13 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth)
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
+		uint64_t is_log = B_FALSE, is_special = B_FALSE;
 
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
 		    &is_log);
-		if (is_log)
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_SPECIAL,
+		    &is_special);
+		if (is_log || is_special)
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, NULL, child[c], B_TRUE);
@@ -1406,15 +1414,17 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth)
 }
 
 /*
- * Print log vdevs.
- * Logs are recorded as top level vdevs in the main pool child array
- * but with "is_log" set to 1. We use either print_status_config() or
- * print_import_config() to print the top level logs then any log
- * children (eg mirrored slogs) are printed recursively - which
- * works because only the top level vdev is marked "is_log"
+ * Print log or special vdevs.
+ * Both are recorded as top level vdevs in the main pool child array
+ * but with "is_log" or "is_special" (passed in as 'class') set to 1.
+ * We use either print_status_config() or print_import_config() to
+ * print the top level vdevs then any children (eg mirrored slogs) are
+ * printed recursively - which works because only the top level vdev
+ * carries the flag.
  */
 static void
-print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose)
+print_class_vdevs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth,
+    boolean_t verbose, const char *class, const char *title)
 {
 	uint_t c, children;
 	nvlist_t **child;
@@ -1423,15 +1433,14 @@ print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose)
 	    &children) != 0)
 		return;
 
-	(void) printf(gettext("\tlogs\n"));
+	(void) printf("\t%s\n", title);
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
+		uint64_t is_class = B_FALSE;
 		char *name;
 
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (!is_log)
+		(void) nvlist_lookup_uint64(child[c], class, &is_class);
+		if (!is_class)
 			continue;
 		name = zpool_vdev_name(g_zfs, zhp, child[c], B_TRUE);
 		if (verbose)
@@ -1658,8 +1667,12 @@ show_import(nvlist_t *config)
 		namewidth = 10;
 
 	print_import_config(name, nvroot, namewidth, 0);
+	if (num_special(nvroot) > 0)
+		print_class_vdevs(NULL, nvroot, namewidth, B_FALSE,
+		    ZPOOL_CONFIG_IS_SPECIAL, gettext("special"));
 	if (num_logs(nvroot) > 0)
-		print_logs(NULL, nvroot, namewidth, B_FALSE);
+		print_class_vdevs(NULL, nvroot, namewidth, B_FALSE,
+		    ZPOOL_CONFIG_IS_LOG, gettext("logs"));
 
 	if (reason == ZPOOL_STATUS_BAD_GUID_SUM) {
 		(void) printf(gettext("\n\tAdditional devices are known to "
@@ -2282,6 +2295,7 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 
 	for (c = 0; c < children; c++) {
 		uint64_t ishole = B_FALSE, islog = B_FALSE;
+		uint64_t isspecial = B_FALSE;
 
 		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
@@ -2289,7 +2303,10 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_LOG,
 		    &islog);
 
-		if (ishole || islog)
+		(void) nvlist_lookup_uint64(newchild[c],
+		    ZPOOL_CONFIG_IS_SPECIAL, &isspecial);
+
+		if (ishole || islog || isspecial)
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, newchild[c], B_FALSE);
@@ -2298,6 +2315,30 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 		free(vname);
 	}
 
+	/*
+	 * Special (metadata class) device section
+	 */
+
+	if (num_special(newnv) > 0) {
+		(void) printf("%-*s      -      -      -      -      -      "
+		    "-\n", cb->cb_namewidth, "special");
+
+		for (c = 0; c < children; c++) {
+			uint64_t isspecial = B_FALSE;
+			(void) nvlist_lookup_uint64(newchild[c],
+			    ZPOOL_CONFIG_IS_SPECIAL, &isspecial);
+
+			if (isspecial) {
+				vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
+				    B_FALSE);
+				print_vdev_stats(zhp, vname, oldnv ?
+				    oldchild[c] : NULL, newchild[c],
+				    cb, depth + 2);
+				free(vname);
+			}
+		}
+	}
+
 	/*
 	 * Log device section
 	 */
@@ -4204,8 +4245,12 @@ status_callback(zpool_handle_t *zhp, void *data)
 		print_status_config(zhp, zpool_get_name(zhp), nvroot,
 		    namewidth, 0, B_FALSE);
 
+		if (num_special(nvroot) > 0)
+			print_class_vdevs(zhp, nvroot, namewidth, B_TRUE,
+			    ZPOOL_CONFIG_IS_SPECIAL, gettext("special"));
 		if (num_logs(nvroot) > 0)
-			print_logs(zhp, nvroot, namewidth, B_TRUE);
+			print_class_vdevs(zhp, nvroot, namewidth, B_TRUE,
+			    ZPOOL_CONFIG_IS_LOG, gettext("logs"));
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2cache, &nl2cache) == 0)
 			print_l2cache(zhp, l2cache, nl2cache, namewidth);
@@ -39,6 +39,7 @@ extern "C" {
 void *safe_malloc(size_t);
 void zpool_no_memory(void);
 uint_t num_logs(nvlist_t *nv);
+uint_t num_special(nvlist_t *nv);
 
 /*
  * Virtual device functions
@@ -1188,6 +1188,12 @@ is_grouping(const char *type, int *mindev, int *maxdev)
 		return (VDEV_TYPE_LOG);
 	}
 
+	if (strcmp(type, "special") == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_TYPE_SPECIAL);
+	}
+
 	if (strcmp(type, "cache") == 0) {
 		if (mindev != NULL)
 			*mindev = 1;
@@ -1207,10 +1213,10 @@ nvlist_t *
 construct_spec(nvlist_t *props, int argc, char **argv)
 {
 	nvlist_t *nvroot, *nv, **top, **spares, **l2cache;
-	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache;
+	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache, nspecial;
 	const char *type;
-	uint64_t is_log;
-	boolean_t seen_logs;
+	uint64_t is_log, is_special;
+	boolean_t seen_logs, seen_special;
 
 	top = NULL;
 	toplevels = 0;
@@ -1219,8 +1225,11 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 	nspares = 0;
 	nlogs = 0;
 	nl2cache = 0;
+	nspecial = 0;
 	is_log = B_FALSE;
+	is_special = B_FALSE;
 	seen_logs = B_FALSE;
+	seen_special = B_FALSE;
 
 	while (argc > 0) {
 		nv = NULL;
@@ -1242,6 +1251,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					return (NULL);
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
 			}
 
 			if (strcmp(type, VDEV_TYPE_LOG) == 0) {
@@ -1254,6 +1264,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				}
 				seen_logs = B_TRUE;
 				is_log = B_TRUE;
+				is_special = B_FALSE;
 				argc--;
 				argv++;
 				/*
@@ -1263,6 +1274,26 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				continue;
 			}
 
+			if (strcmp(type, VDEV_TYPE_SPECIAL) == 0) {
+				if (seen_special) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: 'special' can be "
+					    "specified only once\n"));
+					return (NULL);
+				}
+				seen_special = B_TRUE;
+				is_special = B_TRUE;
+				is_log = B_FALSE;
+				argc--;
+				argv++;
+				/*
+				 * Like 'log', this only marks the vdevs
+				 * that follow.
+				 */
+				continue;
+			}
+
 			if (strcmp(type, VDEV_TYPE_L2CACHE) == 0) {
 				if (l2cache != NULL) {
 					(void) fprintf(stderr,
@@ -1272,6 +1303,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					return (NULL);
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
 			}
 
 			if (is_log) {
@@ -1285,6 +1317,9 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				nlogs++;
 			}
 
+			if (is_special)
+				nspecial++;
+
 			for (c = 1; c < argc; c++) {
 				if (is_grouping(argv[c], NULL, NULL) != NULL)
 					break;
@@ -1331,6 +1366,10 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				    type) == 0);
 				verify(nvlist_add_uint64(nv,
 				    ZPOOL_CONFIG_IS_LOG, is_log) == 0);
+				if (is_special)
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_IS_SPECIAL,
+					    is_special) == 0);
 				if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
 					verify(nvlist_add_uint64(nv,
 					    ZPOOL_CONFIG_NPARITY,
@@ -1353,6 +1392,11 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				return (NULL);
 			if (is_log)
 				nlogs++;
+			if (is_special) {
+				verify(nvlist_add_uint64(nv,
+				    ZPOOL_CONFIG_IS_SPECIAL, is_special) == 0);
+				nspecial++;
+			}
 			argc--;
 			argv++;
 		}
@@ -1377,6 +1421,12 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		return (NULL);
 	}
 
+	if (seen_special && nspecial == 0) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "special requires at least 1 device\n"));
+		return (NULL);
+	}
+
 	/*
 	 * Finally, create nvroot and add all top-level vdevs to it.
 	 */
@@ -0,0 +1,481 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * zsmbench measures the in-core space map.  It builds a badly fragmented
+ * map, then times adding segments, allocating from it with the pool's
+ * block allocator and removing segments, and reports the memory used.
+ *
+ * The same workload is run against a copy of the space map as it was
+ * before it was backed by a B-tree: one AVL node per segment, linked
+ * into both an offset-sorted and a size-sorted AVL tree.  That version
+ * lives only here, as the baseline for comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/space_map.h>
+#include <sys/metaslab.h>
+#include <sys/btree.h>
+
+const char cmdname[] = "zsmbench";
+
+extern uint64_t metaslab_df_alloc_threshold;
+extern int metaslab_df_free_pct;
+
+#define	SMB_SHIFT	SPA_MINBLOCKSHIFT
+#define	SMB_STRIDE	4		/* map units per segment slot */
+
+static uint64_t smb_nsegs = 1000000;
+static uint64_t smb_seed;
+static boolean_t smb_verify;
+
+/*
+ * ==========================================================================
+ * AVL baseline
+ * ==========================================================================
+ */
+typedef struct avl_seg {
+	avl_node_t	as_node;
+	avl_node_t	as_pp_node;
+	uint64_t	as_start;
+	uint64_t	as_end;
+} avl_seg_t;
+
+typedef struct avl_sm {
+	avl_tree_t	asm_root;
+	avl_tree_t	asm_pp_root;
+	uint64_t	asm_space;
+	uint64_t	asm_size;
+	uint64_t	asm_cursor[64];
+} avl_sm_t;
+
+static int
+avl_seg_compare(const void *x1, const void *x2)
+{
+	const avl_seg_t *s1 = x1;
+	const avl_seg_t *s2 = x2;
+
+	if (s1->as_start < s2->as_start) {
+		if (s1->as_end > s2->as_start)
+			return (0);
+		return (-1);
+	}
+	if (s1->as_start > s2->as_start) {
+		if (s1->as_start < s2->as_end)
+			return (0);
+		return (1);
+	}
+	return (0);
+}
+
+static int
+avl_segsize_compare(const void *x1, const void *x2)
+{
+	const avl_seg_t *s1 = x1;
+	const avl_seg_t *s2 = x2;
+	uint64_t size1 = s1->as_end - s1->as_start;
+	uint64_t size2 = s2->as_end - s2->as_start;
+
+	if (size1 < size2)
+		return (-1);
+	if (size1 > size2)
+		return (1);
+	if (s1->as_start < s2->as_start)
+		return (-1);
+	if (s1->as_start > s2->as_start)
+		return (1);
+	return (0);
+}
+
+static void
+avl_sm_create(avl_sm_t *am, uint64_t size)
+{
+	bzero(am, sizeof (*am));
+	avl_create(&am->asm_root, avl_seg_compare, sizeof (avl_seg_t),
+	    offsetof(avl_seg_t, as_node));
+	avl_create(&am->asm_pp_root, avl_segsize_compare, sizeof (avl_seg_t),
+	    offsetof(avl_seg_t, as_pp_node));
+	am->asm_size = size;
+}
+
+static void
+avl_sm_destroy(avl_sm_t *am)
+{
+	void *cookie = NULL;
+	avl_seg_t *as;
+
+	while (avl_destroy_nodes(&am->asm_pp_root, &cookie) != NULL)
+		continue;
+	cookie = NULL;
+	while ((as = avl_destroy_nodes(&am->asm_root, &cookie)) != NULL)
+		kmem_free(as, sizeof (*as));
+	avl_destroy(&am->asm_pp_root);
+	avl_destroy(&am->asm_root);
+}
+
+static void
+avl_sm_add(avl_sm_t *am, uint64_t start, uint64_t size)
+{
+	avl_index_t where;
+	avl_seg_t search, *before, *after, *as;
+	uint64_t end = start + size;
+	int merge_before, merge_after;
+
+	search.as_start = start;
+	search.as_end = end;
+	VERIFY(avl_find(&am->asm_root, &search, &where) == NULL);
+
+	before = avl_nearest(&am->asm_root, where, AVL_BEFORE);
+	after = avl_nearest(&am->asm_root, where, AVL_AFTER);
+
+	merge_before = (before != NULL && before->as_end == start);
+	merge_after = (after != NULL && after->as_start == end);
+
+	if (merge_before && merge_after) {
+		avl_remove(&am->asm_root, before);
+		avl_remove(&am->asm_pp_root, before);
+		avl_remove(&am->asm_pp_root, after);
+		after->as_start = before->as_start;
+		kmem_free(before, sizeof (*before));
+		as = after;
+	} else if (merge_before) {
+		before->as_end = end;
+		avl_remove(&am->asm_pp_root, before);
+		as = before;
+	} else if (merge_after) {
+		after->as_start = start;
+		avl_remove(&am->asm_pp_root, after);
+		as = after;
+	} else {
+		as = kmem_alloc(sizeof (*as), KM_SLEEP);
+		as->as_start = start;
+		as->as_end = end;
+		avl_insert(&am->asm_root, as, where);
+	}
+
+	avl_add(&am->asm_pp_root, as);
+	am->asm_space += size;
+}
+
+static void
+avl_sm_remove(avl_sm_t *am, uint64_t start, uint64_t size)
+{
+	avl_seg_t search, *as, *newseg;
+	uint64_t end = start + size;
+	int left_over, right_over;
+
+	search.as_start = start;
+	search.as_end = end;
+	as = avl_find(&am->asm_root, &search, NULL);
+	VERIFY(as != NULL);
+	VERIFY3U(as->as_start, <=, start);
+	VERIFY3U(as->as_end, >=, end);
+
+	left_over = (as->as_start != start);
+	right_over = (as->as_end != end);
+
+	avl_remove(&am->asm_pp_root, as);
+
+	if (left_over && right_over) {
+		newseg = kmem_alloc(sizeof (*newseg), KM_SLEEP);
+		newseg->as_start = end;
+		newseg->as_end = as->as_end;
+		as->as_end = start;
+		avl_insert_here(&am->asm_root, newseg, as, AVL_AFTER);
+		avl_add(&am->asm_pp_root, newseg);
+	} else if (left_over) {
+		as->as_end = start;
+	} else if (right_over) {
+		as->as_start = end;
+	} else {
+		avl_remove(&am->asm_root, as);
+		kmem_free(as, sizeof (*as));
+		as = NULL;
+	}
+
+	if (as != NULL)
+		avl_add(&am->asm_pp_root, as);
+
+	am->asm_space -= size;
+}
+
+static uint64_t
+avl_sm_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size, uint64_t align)
+{
+	avl_seg_t *as, search;
+	avl_index_t where;
+
+	search.as_start = *cursor;
+	search.as_end = *cursor + size;
+
+	as = avl_find(t, &search, &where);
+	if (as == NULL)
+		as = avl_nearest(t, where, AVL_AFTER);
+
+	while (as != NULL) {
+		uint64_t offset = P2ROUNDUP(as->as_start, align);
+
+		if (offset + size <= as->as_end) {
+			*cursor = offset + size;
+			return (offset);
+		}
+		as = AVL_NEXT(t, as);
+	}
+
+	if (*cursor == 0)
+		return (-1ULL);
+
+	*cursor = 0;
+	return (avl_sm_picker(t, cursor, size, align));
+}
+
+/*
+ * The dynamic block allocator, as metaslab_df_alloc() did it.
+ */
+static uint64_t
+avl_sm_alloc(avl_sm_t *am, uint64_t size)
+{
+	avl_tree_t *t = &am->asm_root;
+	uint64_t align = size & -size;
+	uint64_t *cursor = &am->asm_cursor[highbit(align) - 1];
+	avl_seg_t *as = avl_last(&am->asm_pp_root);
+	uint64_t max_size = (as == NULL) ? 0 : as->as_end - as->as_start;
+	int free_pct = am->asm_space * 100 / am->asm_size;
+	uint64_t start;
+
+	if (max_size < size)
+		return (-1ULL);
+
+	if (max_size < metaslab_df_alloc_threshold ||
+	    free_pct < metaslab_df_free_pct) {
+		t = &am->asm_pp_root;
+		*cursor = 0;
+	}
+
+	start = avl_sm_picker(t, cursor, size, 1ULL);
+	if (start != -1ULL)
+		avl_sm_remove(am, start, size);
+	return (start);
+}
+
+/*
+ * ==========================================================================
+ * Benchmark driver
+ * ==========================================================================
+ */
+static void
+usage(void)
+{
+	(void) fprintf(stderr,
+	    "Usage: %s [-n segments] [-s seed] [-v]\n"
+	    "\t-n  number of free segments to build (default %llu)\n"
+	    "\t-s  random seed (default: time of day)\n"
+	    "\t-v  verify the B-tree's invariants after each phase\n",
+	    cmdname, (u_longlong_t)smb_nsegs);
+	exit(1);
+}
+
+/*
+ * Fill perm[] with a random permutation of [0, n).
+ */
+static void
+smb_permute(uint64_t *perm, uint64_t n)
+{
+	uint64_t i, j, tmp;
+
+	for (i = 0; i < n; i++)
+		perm[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		j = (((uint64_t)random() << 31) | random()) % (i + 1);
+		tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+}
+
+/*
+ * Slot i holds a free segment of one or two units at the start of its
+ * stride, so no two segments ever coalesce.
+ */
+static uint64_t
+smb_seg_start(uint64_t slot)
+{
+	return ((slot * SMB_STRIDE) << SMB_SHIFT);
+}
+
+static uint64_t
+smb_seg_size(uint64_t slot)
+{
+	return ((1 + (slot & 1)) << SMB_SHIFT);
+}
+
+static void
+smb_report(const char *what, uint64_t ops, hrtime_t avl_ns, hrtime_t bt_ns)
+{
+	(void) printf("%-10s %10llu ops %12.0f ops/s %12.0f ops/s %7.2fx\n",
+	    what, (u_longlong_t)ops,
+	    (double)ops * NANOSEC / MAX(avl_ns, 1),
+	    (double)ops * NANOSEC / MAX(bt_ns, 1),
+	    (double)avl_ns / MAX(bt_ns, 1));
+}
+
+int
+main(int argc, char **argv)
+{
+	space_map_t sm;
+	avl_sm_t am;
+	kmutex_t lock;
+	uint64_t *perm, *rm, size, i, nallocs, nremoves, avl_mem, bt_mem;
+	hrtime_t start, avl_ns, bt_ns;
+	int c;
+
+	smb_seed = gethrtime();
+	while ((c = getopt(argc, argv, "n:s:v")) != -1) {
+		switch (c) {
+		case 'n':
+			smb_nsegs = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			smb_seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			smb_verify = B_TRUE;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (smb_nsegs < 2)
+		usage();
+
+	srandom(smb_seed);
+	btree_init();
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+
+	size = (smb_nsegs * SMB_STRIDE) << SMB_SHIFT;
+	perm = kmem_alloc(smb_nsegs * sizeof (uint64_t), KM_SLEEP);
+	rm = kmem_alloc(smb_nsegs * sizeof (uint64_t), KM_SLEEP);
+	smb_permute(perm, smb_nsegs);
+
+	avl_sm_create(&am, size);
+	space_map_create(&sm, 0, size, SMB_SHIFT, &lock);
+	mutex_enter(&lock);
+	sm.sm_loaded = B_TRUE;
+	sm.sm_ops = zfs_metaslab_ops;
+	sm.sm_ops->smop_load(&sm);
+
+	(void) printf("seed %llu, %llu segments\n",
+	    (u_longlong_t)smb_seed, (u_longlong_t)smb_nsegs);
+	(void) printf("%-10s %14s %18s %18s %8s\n",
+	    "phase", "", "avl", "btree", "speedup");
+
+	/* Add every segment, in random order. */
+	start = gethrtime();
+	for (i = 0; i < smb_nsegs; i++)
+		avl_sm_add(&am, smb_seg_start(perm[i]), smb_seg_size(perm[i]));
+	avl_ns = gethrtime() - start;
+
+	start = gethrtime();
+	for (i = 0; i < smb_nsegs; i++) {
+		space_map_free(&sm, smb_seg_start(perm[i]),
+		    smb_seg_size(perm[i]));
+	}
+	bt_ns = gethrtime() - start;
+	smb_report("add", smb_nsegs, avl_ns, bt_ns);
+	if (smb_verify) {
+		btree_verify(&sm.sm_root);
+		btree_verify(sm.sm_pp_root);
+	}
+
+	avl_mem = avl_numnodes(&am.asm_root) * sizeof (avl_seg_t);
+	bt_mem = btree_memory(&sm.sm_root) + btree_memory(sm.sm_pp_root);
+
+	/* Allocate single units from a quarter of the segments. */
+	nallocs = smb_nsegs / 4;
+	start = gethrtime();
+	for (i = 0; i < nallocs; i++)
+		VERIFY(avl_sm_alloc(&am, 1ULL << SMB_SHIFT) != -1ULL);
+	avl_ns = gethrtime() - start;
+
+	start = gethrtime();
+	for (i = 0; i < nallocs; i++)
+		VERIFY(space_map_alloc(&sm, 1ULL << SMB_SHIFT) != -1ULL);
+	bt_ns = gethrtime() - start;
+	smb_report("alloc", nallocs, avl_ns, bt_ns);
+	VERIFY3U(am.asm_space, ==, sm.sm_space);
+	if (smb_verify) {
+		btree_verify(&sm.sm_root);
+		btree_verify(sm.sm_pp_root);
+	}
+
+	/*
+	 * Remove the last unit of every slot that still has two, in
+	 * random order.  Both maps made the same allocations, so they
+	 * agree on which slots those are.
+	 */
+	smb_permute(perm, smb_nsegs);
+	for (i = 0, nremoves = 0; i < smb_nsegs; i++) {
+		uint64_t off = smb_seg_start(perm[i]) + (1ULL << SMB_SHIFT);
+
+		if ((perm[i] & 1) &&
+		    space_map_contains(&sm, off, 1ULL << SMB_SHIFT))
+			rm[nremoves++] = off;
+	}
+
+	start = gethrtime();
+	for (i = 0; i < nremoves; i++)
+		avl_sm_remove(&am, rm[i], 1ULL << SMB_SHIFT);
+	avl_ns = gethrtime() - start;
+
+	start = gethrtime();
+	for (i = 0; i < nremoves; i++)
+		space_map_claim(&sm, rm[i], 1ULL << SMB_SHIFT);
+	bt_ns = gethrtime() - start;
+	smb_report("remove", nremoves, avl_ns, bt_ns);
+	VERIFY3U(am.asm_space, ==, sm.sm_space);
+	if (smb_verify) {
+		btree_verify(&sm.sm_root);
+		btree_verify(sm.sm_pp_root);
+	}
+
+	(void) printf("%-10s %14s %12llu bytes %12llu bytes %7.2fx\n",
+	    "memory", "", (u_longlong_t)avl_mem, (u_longlong_t)bt_mem,
+	    (double)avl_mem / MAX(bt_mem, 1));
+
+	sm.sm_ops->smop_unload(&sm);
+	sm.sm_ops = NULL;
+	sm.sm_loaded = B_FALSE;
+	space_map_vacate(&sm, NULL, NULL);
+	mutex_exit(&lock);
+	space_map_destroy(&sm);
+	avl_sm_destroy(&am);
+
+	kmem_free(rm, smb_nsegs * sizeof (uint64_t));
+	kmem_free(perm, smb_nsegs * sizeof (uint64_t));
+	mutex_destroy(&lock);
+	btree_fini();
+
+	return (0);
+}
@@ -142,6 +142,7 @@ typedef struct ztest_shared_opts {
 	char zo_dir[MAXNAMELEN];
 	char zo_alt_ztest[MAXNAMELEN];
 	char zo_alt_libpath[MAXNAMELEN];
+	char zo_allocator[MAXNAMELEN];
 	uint64_t zo_vdevs;
 	uint64_t zo_vdevtime;
 	size_t zo_vdev_size;
@@ -158,6 +159,7 @@ typedef struct ztest_shared_opts {
 	uint64_t zo_time;
 	uint64_t zo_maxloops;
 	uint64_t zo_metaslab_gang_bang;
+	int zo_foreign_endian;
 #ifdef __APPLE__
 	int zo_attach_gdb;
 #endif
@@ -168,6 +170,7 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_dir = { '/', 't', 'm', 'p', '\0' },
 	.zo_alt_ztest = { '\0' },
 	.zo_alt_libpath = { '\0' },
+	.zo_allocator = { '\0' },
 	.zo_vdevs = 5,
 	.zo_ashift = SPA_MINBLOCKSHIFT,
 	.zo_mirrors = 2,
@@ -182,7 +185,8 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_init = 1,
 	.zo_time = 300,			/* 5 minutes */
 	.zo_maxloops = 50,		/* max loops during spa_freeze() */
-	.zo_metaslab_gang_bang = 32 << 10
+	.zo_metaslab_gang_bang = 32 << 10,
+	.zo_foreign_endian = 0
 #ifdef __APPLE__
 	,
 	.zo_attach_gdb = 0
@@ -194,6 +198,7 @@ volatile int ztest_forever = 0;
 
 extern uint64_t metaslab_gang_bang;
 extern uint64_t metaslab_df_alloc_threshold;
+extern int zio_write_foreign_endian;
 
 static ztest_shared_opts_t *ztest_shared_opts;
 static ztest_shared_opts_t ztest_opts;
@@ -614,6 +619,9 @@ usage(boolean_t requested)
 	    "\t[-F freezeloops (default: %llu)] max loops in spa_freeze()\n"
 	    "\t[-P passtime (default: %llu sec)] time per pass\n"
 	    "\t[-B alt_ztest (default: <none>)] alternate ztest path\n"
+	    "\t[-e] write data blocks in foreign byte order\n"
+	    "\t[-A allocator (default: random)] block allocator, and report\n"
+	    "\t    free space fragmentation after each pass\n"
 #ifdef __APPLE__
 	    "\t[-D mask] wait in child process for GDB to attach.\n"
 	    "\t   mask is OR of 1 = wait in ztest before exec, 2 = wait in ztest\n"
@@ -655,7 +663,7 @@ process_options(int argc, char **argv)
 	bcopy(&ztest_opts_defaults, zo, sizeof (*zo));
 
 	while ((opt = getopt(argc, argv,
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:hF:B:"
+	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VEeA:T:P:hF:B:"
 #ifdef __APPLE__
 	    "D:"
 #endif
@@ -734,6 +742,13 @@ process_options(int argc, char **argv)
 		case 'E':
 			zo->zo_init = 0;
 			break;
+		case 'e':
+			zo->zo_foreign_endian = 1;
+			break;
+		case 'A':
+			(void) strlcpy(zo->zo_allocator, optarg,
+			    sizeof (zo->zo_allocator));
+			break;
 		case 'T':
 			zo->zo_time = value;
 			break;
@@ -1065,9 +1080,15 @@ ztest_random_dsl_prop(zfs_prop_t prop)
 {
 	uint64_t value;
 
+	/*
+	 * compression=auto doesn't fit dmu_object_set_compress()'s
+	 * uint8_t, and setting it on a dataset takes the compress_auto
+	 * feature, which only the ioctl path activates.
+	 */
 	do {
 		value = zfs_prop_random_value(prop, ztest_random(-1ULL));
-	} while (prop == ZFS_PROP_CHECKSUM && value == ZIO_CHECKSUM_OFF);
+	} while ((prop == ZFS_PROP_CHECKSUM && value == ZIO_CHECKSUM_OFF) ||
+	    (prop == ZFS_PROP_COMPRESSION && value == ZIO_COMPRESS_AUTO));
 
 	return (value);
 }
@@ -1431,6 +1452,8 @@ ztest_log_write(ztest_ds_t *zd, dmu_tx_t *tx, lr_write_t *lr)
 	itx->itx_wr_state = write_state;
 	itx->itx_sync = (ztest_random(8) == 0);
 	itx->itx_sod += (write_state == WR_NEED_COPY ? lr->lr_length : 0);
+	/* as zfs_log_write() does, so replay sees merged records */
+	itx->itx_coalesce = (write_state != WR_INDIRECT);
 
 	bcopy(&lr->lr_common + 1, &itx->itx_lr + 1,
 	    sizeof (*lr) - sizeof (lr_t));
@@ -1613,8 +1636,8 @@ ztest_replay_write(ztest_ds_t *zd, lr_write_t *lr, boolean_t byteswap)
 {
 	objset_t *os = zd->zd_os;
 	void *data = lr + 1;			/* data follows lr */
-	uint64_t offset, length;
-	ztest_block_tag_t *bt = data;
+	uint64_t offset, length, boff;
+	ztest_block_tag_t *bt;
 	ztest_block_tag_t *bbt;
 	uint64_t gen, txg, lrtxg, crtxg;
 	dmu_object_info_t doi;
@@ -1638,12 +1661,6 @@ ztest_replay_write(ztest_ds_t *zd, lr_write_t *lr, boolean_t byteswap)
 		}
 	}
 
-	if (bt->bt_magic == BSWAP_64(BT_MAGIC))
-		byteswap_uint64_array(bt, sizeof (*bt));
-
-	if (bt->bt_magic != BT_MAGIC)
-		bt = NULL;
-
 	ztest_object_lock(zd, lr->lr_foid, RL_READER);
 	rl = ztest_range_lock(zd, lr->lr_foid, offset, length, RL_WRITER);
 
@@ -1675,23 +1692,37 @@ ztest_replay_write(ztest_ds_t *zd, lr_write_t *lr, boolean_t byteswap)
 		return (ENOSPC);
 	}
 
-	if (bt != NULL) {
+	/*
+	 * Each block written starts with its block tag.  A record the
+	 * ZIL merged from adjacent writes covers several blocks, so
+	 * check every one of them.
+	 */
+	for (boff = 0; boff + sizeof (*bt) <= length;
+	    boff += doi.doi_data_block_size) {
+		bt = (ztest_block_tag_t *)((char *)data + boff);
+
+		if (bt->bt_magic == BSWAP_64(BT_MAGIC))
+			byteswap_uint64_array(bt, sizeof (*bt));
+
+		if (bt->bt_magic != BT_MAGIC)
+			continue;
+
 		/*
 		 * Usually, verify the old data before writing new data --
 		 * but not always, because we also want to verify correct
 		 * behavior when the data was not recently read into cache.
 		 */
-		ASSERT(offset % doi.doi_data_block_size == 0);
+		ASSERT((offset + boff) % doi.doi_data_block_size == 0);
 		if (ztest_random(4) != 0) {
 			int prefetch = ztest_random(2) ?
 			    DMU_READ_PREFETCH : DMU_READ_NO_PREFETCH;
 			ztest_block_tag_t rbt;
 
-			VERIFY(dmu_read(os, lr->lr_foid, offset,
+			VERIFY(dmu_read(os, lr->lr_foid, offset + boff,
 			    sizeof (rbt), &rbt, prefetch) == 0);
 			if (rbt.bt_magic == BT_MAGIC) {
 				ztest_bt_verify(&rbt, os, lr->lr_foid,
-				    offset, gen, txg, crtxg);
+				    offset + boff, gen, txg, crtxg);
 			}
 		}
 
@@ -1702,7 +1733,7 @@ ztest_replay_write(ztest_ds_t *zd, lr_write_t *lr, boolean_t byteswap)
 		 * as it was when the write was generated.
 		 */
 		if (zd->zd_zilog->zl_replay) {
-			ztest_bt_verify(bt, os, lr->lr_foid, offset,
+			ztest_bt_verify(bt, os, lr->lr_foid, offset + boff,
 			    MAX(gen, bt->bt_gen), MAX(txg, lrtxg),
 			    bt->bt_crtxg);
 		}
@@ -1711,7 +1742,8 @@ ztest_replay_write(ztest_ds_t *zd, lr_write_t *lr, boolean_t byteswap)
 		 * Set the bt's gen/txg to the bonus buffer's gen/txg
 		 * so that all of the usual ASSERTs will work.
 		 */
-		ztest_bt_generate(bt, os, lr->lr_foid, offset, gen, txg, crtxg);
+		ztest_bt_generate(bt, os, lr->lr_foid, offset + boff, gen,
+		    txg, crtxg);
 	}
 
 	if (abuf == NULL) {
@@ -4755,6 +4787,14 @@ ztest_spa_prop_get_set(ztest_ds_t *zd, uint64_t id)
 	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_DEDUPDITTO,
 	    ZIO_DEDUPDITTO_MIN + ztest_random(ZIO_DEDUPDITTO_MIN));
 
+	/*
+	 * Switch block allocators under load, unless we're comparing them.
+	 */
+	if (ztest_opts.zo_allocator[0] == '\0') {
+		(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_ALLOCATOR,
+		    ztest_random(ZPOOL_NUM_ALLOCATORS));
+	}
+
 	VERIFY3U(spa_prop_get(ztest_spa, &props), ==, 0);
 
 	if (ztest_opts.zo_verbose >= 6)
@@ -5649,6 +5689,69 @@ ztest_dataset_close(int d)
 	ztest_zd_fini(zd);
 }
 
+/*
+ * Report how fragmented the free space in the normal class is after the
+ * pass's churn, to compare block allocators over the same workload.
+ * Free segments are counted from the space map histograms, so metaslabs
+ * whose histogram is out of date are left out.
+ */
+static void
+ztest_report_fragmentation(spa_t *spa)
+{
+	metaslab_class_t *mc = spa_normal_class(spa);
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t segs = 0, space = 0, largest = 0, skipped = 0;
+	uint64_t frag, c, m;
+	int i;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		if (vd->vdev_mg == NULL || vd->vdev_mg->mg_class != mc)
+			continue;
+
+		for (m = 0; m < vd->vdev_ms_count; m++) {
+			metaslab_t *msp = vd->vdev_ms[m];
+			space_map_obj_t *smo = &msp->ms_smo;
+			space_map_histogram_t *smh = &msp->ms_smh;
+			uint8_t shift = msp->ms_map.sm_shift;
+
+			mutex_enter(&msp->ms_lock);
+			if (smo->smo_object == 0) {
+				segs++;
+				space += msp->ms_map.sm_size;
+				largest = MAX(largest, msp->ms_map.sm_size);
+			} else if (space_map_histogram_valid(smo, smh)) {
+				space += msp->ms_map.sm_size - smo->smo_alloc;
+				for (i = 0; i < SPACE_MAP_HISTOGRAM_SIZE; i++) {
+					if (smh->smh_histogram[i] == 0)
+						continue;
+					segs += smh->smh_histogram[i];
+					largest = MAX(largest,
+					    1ULL << (i + shift));
+				}
+			} else {
+				skipped++;
+			}
+			mutex_exit(&msp->ms_lock);
+		}
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	frag = metaslab_class_fragmentation(mc);
+
+	(void) printf("allocator %s: %llu free segments, avg %llu bytes, "
+	    "largest >= %llu bytes, fragmentation ", ztest_opts.zo_allocator,
+	    (u_longlong_t)segs, (u_longlong_t)(segs ? space / segs : 0),
+	    (u_longlong_t)largest);
+	if (frag == ZFS_FRAG_INVALID)
+		(void) printf("-");
+	else
+		(void) printf("%llu%%", (u_longlong_t)frag);
+	(void) printf(" (%llu metaslabs skipped)\n", (u_longlong_t)skipped);
+}
+
 /*
  * Kick off threads to run tests on all datasets in parallel.
  */
@@ -5700,6 +5803,17 @@ ztest_run(ztest_shared_t *zs)
 
 	spa->spa_dedup_ditto = 2 * ZIO_DEDUPDITTO_MIN;
 
+	if (ztest_opts.zo_allocator[0] != '\0') {
+		uint64_t allocator;
+
+		if (zpool_prop_string_to_index(ZPOOL_PROP_ALLOCATOR,
+		    ztest_opts.zo_allocator, &allocator) != 0)
+			fatal(0, "unknown allocator '%s'",
+			    ztest_opts.zo_allocator);
+		(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_ALLOCATOR,
+		    allocator);
+	}
+
 	/*
 	 * We don't expect the pool to suspend unless maxfaults == 0,
 	 * in which case ztest_fault_inject() temporarily takes away
@@ -5805,6 +5919,11 @@ ztest_run(ztest_shared_t *zs)
 	if (zc_cb_counter >= ZTEST_COMMIT_CB_MIN_REG)
 		VERIFY3U(zc_min_txg_delay, ==, 0);
 
+	if (ztest_opts.zo_allocator[0] != '\0') {
+		txg_wait_synced(spa_get_dsl(spa), 0);
+		ztest_report_fragmentation(spa);
+	}
+
 	spa_close(spa, FTAG);
 
 	/*
@@ -6250,6 +6369,7 @@ main(int argc, char **argv)
 
 	if (fd_data_str) {
 		metaslab_gang_bang = ztest_opts.zo_metaslab_gang_bang;
+		zio_write_foreign_endian = ztest_opts.zo_foreign_endian;
 		metaslab_df_alloc_threshold =
 		    zs->zs_metaslab_df_alloc_threshold;
 
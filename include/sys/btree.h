@@ -0,0 +1,124 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_BTREE_H
+#define	_SYS_BTREE_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A B-tree of fixed-size elements, kept in sorted order by a caller
+ * supplied comparison function.
+ *
+ * Unlike an AVL tree, the B-tree stores copies of the elements packed
+ * into arrays: leaves are BTREE_LEAF_SIZE bytes and hold as many
+ * elements as fit, core nodes hold BTREE_CORE_ELEMS elements and one
+ * more child pointer.  Most space maps hold only a few segments, so a
+ * root leaf starts at BTREE_SMALL_LEAF_SIZE bytes and doubles as it
+ * fills; only once it is BTREE_LEAF_SIZE does it split.  There is no
+ * per-element node overhead, and a search touches a handful of
+ * contiguous arrays rather than one cache line per level.  The price
+ * is that elements move: any pointer returned by the tree, and any
+ * btree_index_t, is invalidated by the next insertion or removal.
+ * Callers may modify an element in place as long as its position in
+ * the sort order doesn't change.
+ */
+#define	BTREE_CORE_ELEMS	126
+#define	BTREE_LEAF_SIZE		4096
+#define	BTREE_SMALL_LEAF_SIZE	128
+
+typedef struct btree_hdr {
+	struct btree_core	*bth_parent;	/* NULL for the root */
+	boolean_t		bth_core;	/* core or leaf node? */
+	uint32_t		bth_count;	/* elements in this node */
+} btree_hdr_t;
+
+typedef struct btree_core {
+	btree_hdr_t	btc_hdr;
+	btree_hdr_t	*btc_children[BTREE_CORE_ELEMS + 1];
+	uint8_t		btc_elems[];
+} btree_core_t;
+
+typedef struct btree_leaf {
+	btree_hdr_t	btl_hdr;
+	uint8_t		btl_elems[];
+} btree_leaf_t;
+
+/*
+ * A position in the tree.  If bti_before is set, the index refers to
+ * the gap before element bti_offset of a leaf, which is where
+ * btree_find() says a missing element would be inserted.
+ */
+typedef struct btree_index {
+	btree_hdr_t	*bti_node;
+	uint32_t	bti_offset;
+	boolean_t	bti_before;
+} btree_index_t;
+
+typedef struct btree {
+	btree_hdr_t	*bt_root;
+	int		(*bt_compar)(const void *, const void *);
+	size_t		bt_elem_size;
+	uint32_t	bt_leaf_cap;	/* elements per leaf */
+	size_t		bt_root_size;	/* bytes in the root, if a leaf */
+	uint32_t	bt_height;	/* 0 if the root is a leaf */
+	ulong_t		bt_num_elems;
+	ulong_t		bt_num_leaves;
+	ulong_t		bt_num_cores;
+} btree_t;
+
+extern void btree_init(void);
+extern void btree_fini(void);
+
+extern void btree_create(btree_t *tree,
+    int (*compar)(const void *, const void *), size_t size);
+extern void btree_destroy(btree_t *tree);
+extern void btree_clear(btree_t *tree);
+
+extern void *btree_find(btree_t *tree, const void *value,
+    btree_index_t *where);
+extern void btree_insert(btree_t *tree, const void *value,
+    const btree_index_t *where);
+extern void btree_add(btree_t *tree, const void *value);
+extern void btree_remove(btree_t *tree, const void *value);
+extern void btree_remove_idx(btree_t *tree, btree_index_t *where);
+
+extern void *btree_first(btree_t *tree, btree_index_t *where);
+extern void *btree_last(btree_t *tree, btree_index_t *where);
+extern void *btree_next(btree_t *tree, const btree_index_t *idx,
+    btree_index_t *out);
+extern void *btree_prev(btree_t *tree, const btree_index_t *idx,
+    btree_index_t *out);
+extern void *btree_get(btree_t *tree, const btree_index_t *idx);
+
+extern ulong_t btree_numnodes(btree_t *tree);
+extern size_t btree_memory(btree_t *tree);
+extern void btree_verify(btree_t *tree);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BTREE_H */
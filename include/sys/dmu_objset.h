@@ -91,6 +91,8 @@ struct objset {
 	uint8_t os_primary_cache;
 	uint8_t os_secondary_cache;
 	uint8_t os_sync;
+	uint8_t os_compress_is_auto;
+	uint64_t os_special_smallblk;
 
 	/* no lock needed: */
 	struct dmu_tx *os_synctx; /* XXX sketchy */
@@ -116,6 +118,10 @@ struct objset {
 
 	/* SA layout/attribute registration */
 	sa_os_t *os_sa;
+
+	/* compression=auto feedback, only while compression=auto */
+	struct zio_compress_auto *os_compress_auto;
+	uint64_t os_compress_auto_retire_txg; /* free after this txg syncs */
 };
 
 #define	DMU_META_OBJSET		0
@@ -128,6 +128,7 @@ typedef enum {
 	ZFS_PROP_REFRATIO,
 	ZFS_PROP_WRITTEN,
 	ZFS_PROP_CLONES,
+	ZFS_PROP_SPECIAL_SMALL_BLOCKS,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -171,6 +172,9 @@ typedef enum {
 	ZPOOL_PROP_COMMENT,
 	ZPOOL_PROP_EXPANDSZ,
 	ZPOOL_PROP_FREEING,
+	ZPOOL_PROP_FRAGMENTATION,
+	ZPOOL_PROP_ALLOCATOR,
+	ZPOOL_PROP_MAXFREE,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -328,6 +332,18 @@ typedef enum {
 	ZFS_XATTR_SA = 2
 } zfs_xattr_type_t;
 
+/*
+ * Block allocators for the pool "allocator" property.
+ */
+typedef enum {
+	ZPOOL_ALLOCATOR_DF = 0,		/* dynamic fit */
+	ZPOOL_ALLOCATOR_FF = 1,		/* first fit */
+	ZPOOL_ALLOCATOR_CDF = 2,	/* clumped dynamic fit */
+	ZPOOL_ALLOCATOR_NDF = 3,	/* new dynamic fit */
+	ZPOOL_ALLOCATOR_SF = 4,		/* segregated fit */
+	ZPOOL_NUM_ALLOCATORS
+} zpool_allocator_t;
+
 /*
  * On-disk version number.
  */
@@ -528,6 +544,7 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_CAN_RDONLY		"can_rdonly"	/* not stored on disk */
 #define	ZPOOL_CONFIG_FEATURES_FOR_READ	"features_for_read"
 #define	ZPOOL_CONFIG_FEATURE_STATS	"feature_stats"	/* not stored on disk */
+#define	ZPOOL_CONFIG_IS_SPECIAL		"is_special"
 /*
  * The persistent vdev state is stored as separate values rather than a single
  * 'vdev_state' entry.  This is because a device can be in multiple states, such
@@ -562,6 +579,7 @@ typedef struct zpool_rewind_policy {
 #define	VDEV_TYPE_HOLE			"hole"
 #define	VDEV_TYPE_SPARE			"spare"
 #define	VDEV_TYPE_LOG			"log"
+#define	VDEV_TYPE_SPECIAL		"special"
 #define	VDEV_TYPE_L2CACHE		"l2cache"
 
 /*
@@ -706,6 +724,10 @@ typedef struct vdev_stat {
 	uint64_t	vs_self_healed;		/* self-healed bytes	*/
 	uint64_t	vs_scan_removing;	/* removing?	*/
 	uint64_t	vs_scan_processed;	/* scan processed bytes	*/
+	uint64_t	vs_alloc_ops;		/* blocks allocated	*/
+	uint64_t	vs_alloc_bytes;		/* bytes allocated	*/
+	uint64_t	vs_alloc_queue_depth;	/* async writes pending	*/
+	uint64_t	vs_alloc_throttled;	/* throttled allocs	*/
 } vdev_stat_t;
 
 /*
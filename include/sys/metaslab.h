@@ -37,13 +37,16 @@ extern "C" {
 #endif
 
 extern space_map_ops_t *zfs_metaslab_ops;
+extern space_map_ops_t *metaslab_ops_table[ZPOOL_NUM_ALLOCATORS];
 
 extern metaslab_t *metaslab_init(metaslab_group_t *mg, space_map_obj_t *smo,
-    uint64_t start, uint64_t size, uint64_t txg);
+    space_map_histogram_t *smh, uint64_t start, uint64_t size, uint64_t txg);
 extern void metaslab_fini(metaslab_t *msp);
 extern void metaslab_sync(metaslab_t *msp, uint64_t txg);
 extern void metaslab_sync_done(metaslab_t *msp, uint64_t txg);
 extern void metaslab_sync_reassess(metaslab_group_t *mg);
+extern void metaslab_stat_init(void);
+extern void metaslab_stat_fini(void);
 
 #define	METASLAB_HINTBP_FAVOR	0x0
 #define	METASLAB_HINTBP_AVOID	0x1
@@ -51,6 +54,8 @@ extern void metaslab_sync_reassess(metaslab_group_t *mg);
 #define	METASLAB_GANG_CHILD	0x4
 #define	METASLAB_GANG_AVOID	0x8
 #define	METASLAB_FASTWRITE	0x10
+#define	METASLAB_ASYNC_ALLOC	0x20
+#define	METASLAB_GANG_RETRY	0x40
 
 extern int metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
     blkptr_t *bp, int ncopies, uint64_t txg, blkptr_t *hintbp, int flags);
@@ -59,10 +64,13 @@ extern void metaslab_free(spa_t *spa, const blkptr_t *bp, uint64_t txg,
 extern int metaslab_claim(spa_t *spa, const blkptr_t *bp, uint64_t txg);
 extern void metaslab_fastwrite_mark(spa_t *spa, const blkptr_t *bp);
 extern void metaslab_fastwrite_unmark(spa_t *spa, const blkptr_t *bp);
+extern void metaslab_alloc_queue_done(spa_t *spa, const blkptr_t *bp);
 
 extern metaslab_class_t *metaslab_class_create(spa_t *spa,
     space_map_ops_t *ops);
 extern void metaslab_class_destroy(metaslab_class_t *mc);
+extern void metaslab_class_set_ops(metaslab_class_t *mc,
+    space_map_ops_t *ops);
 extern int metaslab_class_validate(metaslab_class_t *mc);
 
 extern void metaslab_class_space_update(metaslab_class_t *mc,
@@ -72,6 +80,12 @@ extern uint64_t metaslab_class_get_alloc(metaslab_class_t *mc);
 extern uint64_t metaslab_class_get_space(metaslab_class_t *mc);
 extern uint64_t metaslab_class_get_dspace(metaslab_class_t *mc);
 extern uint64_t metaslab_class_get_deferred(metaslab_class_t *mc);
+extern uint64_t metaslab_class_fragmentation(metaslab_class_t *mc);
+extern uint64_t metaslab_class_max_free(metaslab_class_t *mc);
+extern uint64_t metaslab_class_groups(metaslab_class_t *mc);
+extern void metaslab_group_sync_write_done(metaslab_group_t *mg,
+    hrtime_t delta);
+extern uint64_t metaslab_class_sync_write_lat(metaslab_class_t *mc);
 
 extern metaslab_group_t *metaslab_group_create(metaslab_class_t *mc,
     vdev_t *vd);
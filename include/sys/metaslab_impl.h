@@ -37,6 +37,12 @@
 extern "C" {
 #endif
 
+/*
+ * Fragmentation of a metaslab, group or class whose space map histograms
+ * can't be trusted (e.g. last written by software that predates them).
+ */
+#define	ZFS_FRAG_INVALID	UINT64_MAX
+
 struct metaslab_class {
 	spa_t			*mc_spa;
 	metaslab_group_t	*mc_rotor;
@@ -46,6 +52,8 @@ struct metaslab_class {
 	uint64_t		mc_deferred;	/* total deferred frees */
 	uint64_t		mc_space;	/* total space (alloc + free) */
 	uint64_t		mc_dspace;	/* total deflated space */
+	uint64_t		mc_groups;	/* active groups on the rotor */
+	uint64_t		mc_sync_write_lat; /* moving average, ns */
 	kmutex_t		mc_fastwrite_lock;
 };
 
@@ -55,12 +63,17 @@ struct metaslab_group {
 	uint64_t		mg_aliquot;
 	uint64_t		mg_bonus_area;
 	uint64_t		mg_alloc_failures;
+	uint64_t		mg_gang_retry_txg; /* last gang retry pass */
+	uint64_t		mg_fragmentation;
+	uint64_t		mg_max_free;	/* largest ms_max_free */
+	uint64_t		mg_max_free_bound; /* no free seg is larger */
 	int64_t			mg_bias;
 	int64_t			mg_activation_count;
 	metaslab_class_t	*mg_class;
 	vdev_t			*mg_vd;
 	metaslab_group_t	*mg_prev;
 	metaslab_group_t	*mg_next;
+	taskq_t			*mg_taskq;	/* metaslab preloads */
 };
 
 /*
@@ -69,17 +82,29 @@ struct metaslab_group {
  * we append the allocs and frees from that txg to the space map object.
  * When the txg is done syncing, metaslab_sync_done() updates ms_smo
  * to ms_smo_syncing.  Everything in ms_smo is always safe to allocate.
+ * The free segment histograms ms_smh and ms_smh_syncing follow the same
+ * scheme.
+ *
+ * The freemaps and defermaps are allocated separately so that
+ * metaslab_sync_done() can age a txg's frees into the defer queue,
+ * and recycle the oldest defermap, by swapping pointers rather than
+ * copying segments from one map to the next.
  */
 struct metaslab {
 	kmutex_t	ms_lock;	/* metaslab lock		*/
 	space_map_obj_t	ms_smo;		/* synced space map object	*/
 	space_map_obj_t	ms_smo_syncing;	/* syncing space map object	*/
+	space_map_histogram_t ms_smh;	/* synced free segment histogram */
+	space_map_histogram_t ms_smh_syncing; /* syncing histogram	*/
 	space_map_t	ms_allocmap[TXG_SIZE];  /* allocated this txg	*/
-	space_map_t	ms_freemap[TXG_SIZE];	/* freed this txg	*/
-	space_map_t	ms_defermap[TXG_DEFER_SIZE]; /* deferred frees	*/
+	space_map_t	*ms_freemap[TXG_SIZE];	/* freed this txg	*/
+	space_map_t	*ms_defermap[TXG_DEFER_SIZE]; /* deferred frees */
 	space_map_t	ms_map;		/* in-core free space map	*/
 	int64_t		ms_deferspace;	/* sum of ms_defermap[] space	*/
 	uint64_t	ms_weight;	/* weight vs. others in group	*/
+	uint64_t	ms_fragmentation; /* % of free space fragmented */
+	uint64_t	ms_max_free;	/* est. largest free segment	*/
+	uint64_t	ms_access_txg;	/* keep map loaded until this txg */
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
 	txg_node_t	ms_txg_node;	/* per-txg dirty metaslab links	*/
@@ -338,6 +338,22 @@ typedef struct blkptr {
 
 #define	BP_SHOULD_BYTESWAP(bp)	(BP_GET_BYTEORDER(bp) != ZFS_HOST_BYTEORDER)
 
+/*
+ * Word byteswaps for the bulk foreign-endian paths (the byteswap checksums
+ * and the dmu_ot array byteswap functions).  The compiler builtins map onto
+ * a single bswap/rev instruction and leave the surrounding loops simple
+ * enough to be unrolled and vectorized, where the generic BSWAP_*() macros
+ * expand into a long chain of shifts and masks.
+ */
+#if defined(__clang__) || (defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3)))
+#define	ZFS_BSWAP_32(x)		__builtin_bswap32(x)
+#define	ZFS_BSWAP_64(x)		__builtin_bswap64(x)
+#else
+#define	ZFS_BSWAP_32(x)		BSWAP_32(x)
+#define	ZFS_BSWAP_64(x)		BSWAP_64(x)
+#endif
+
 #define	BP_SPRINTF_LEN	320
 
 /*
@@ -596,6 +612,9 @@ extern uint64_t spa_version(spa_t *spa);
 extern boolean_t spa_deflate(spa_t *spa);
 extern metaslab_class_t *spa_normal_class(spa_t *spa);
 extern metaslab_class_t *spa_log_class(spa_t *spa);
+extern metaslab_class_t *spa_special_class(spa_t *spa);
+extern metaslab_class_t *spa_preferred_class(spa_t *spa, uint64_t size,
+    dmu_object_type_t objtype, uint_t level, uint64_t special_smallblk);
 extern int spa_max_replication(spa_t *spa);
 extern int spa_prev_software_version(spa_t *spa);
 extern int spa_busy(void);
@@ -627,6 +646,7 @@ extern uint64_t dva_get_dsize_sync(spa_t *spa, const dva_t *dva);
 extern uint64_t bp_get_dsize_sync(spa_t *spa, const blkptr_t *bp);
 extern uint64_t bp_get_dsize(spa_t *spa, const blkptr_t *bp);
 extern boolean_t spa_has_slogs(spa_t *spa);
+extern boolean_t spa_has_special(spa_t *spa);
 extern boolean_t spa_is_root(spa_t *spa);
 extern boolean_t spa_writeable(spa_t *spa);
 
@@ -107,6 +107,22 @@ typedef enum spa_proc_state {
 	SPA_PROC_GONE		/* spa_thread() is exiting, spa_proc = &p0 */
 } spa_proc_state_t;
 
+/*
+ * Per-pool gang block statistics, exported as the "gangs-<pool>" kstat.
+ * Every gang header written costs an extra I/O on each later read of
+ * the block, so these show what ganging is costing the pool.
+ */
+typedef struct spa_gang_stats {
+	kstat_named_t	sgs_headers;		/* gang headers written */
+	kstat_named_t	sgs_members;		/* gang members written */
+	kstat_named_t	sgs_avoided;		/* gangs avoided by retry */
+	kstat_named_t	sgs_header_reads;	/* headers read for reads */
+} spa_gang_stats_t;
+
+#define	SPA_GANGSTAT_INCR(spa, stat, val) \
+	atomic_add_64(&(spa)->spa_gang_stats.stat.value.ui64, (val))
+#define	SPA_GANGSTAT_BUMP(spa, stat)	SPA_GANGSTAT_INCR(spa, stat, 1)
+
 struct spa {
 	/*
 	 * Fields protected by spa_namespace_lock.
@@ -126,10 +142,12 @@ struct spa {
 	spa_load_state_t spa_load_state;	/* current load operation */
 	uint64_t	spa_import_flags;	/* import specific flags */
 	taskq_t		*spa_zio_taskq[ZIO_TYPES][ZIO_TASKQ_TYPES];
+	taskq_t		*spa_zio_compress_taskq; /* write compression */
 	dsl_pool_t	*spa_dsl_pool;
 	boolean_t	spa_is_initializing;	/* true while opening pool */
 	metaslab_class_t *spa_normal_class;	/* normal data class */
 	metaslab_class_t *spa_log_class;	/* intent log data class */
+	metaslab_class_t *spa_special_class;	/* metadata/small block class */
 	uint64_t	spa_first_txg;		/* first txg after spa_open() */
 	uint64_t	spa_final_txg;		/* txg of export/destroy */
 	uint64_t	spa_freeze_txg;		/* freeze pool at this txg */
@@ -195,6 +213,7 @@ struct spa {
 	uint64_t	spa_pool_props_object;	/* object for properties */
 	uint64_t	spa_bootfs;		/* default boot filesystem */
 	uint64_t	spa_failmode;		/* failure mode for the pool */
+	uint64_t	spa_allocator;		/* block allocator */
 	uint64_t	spa_delegation;		/* delegation on/off */
 	list_t		spa_config_list;	/* previous cache file(s) */
 	zio_t		*spa_async_zio_root;	/* root of all async I/O */
@@ -227,6 +246,8 @@ struct spa {
 	uint64_t	spa_feat_for_write_obj;	/* required to write to pool */
 	uint64_t	spa_feat_for_read_obj;	/* required to read from pool */
 	uint64_t	spa_feat_desc_obj;	/* Feature descriptions */
+	spa_gang_stats_t spa_gang_stats;	/* gang block counters */
+	kstat_t		*spa_gang_ksp;		/* "gangs-<pool>" kstat */
 	/*
 	 * spa_refcnt & spa_config_lock must be the last elements
 	 * because refcount_t changes size based on compilation options.
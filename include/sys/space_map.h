@@ -28,6 +28,7 @@
 
 #include <sys/avl.h>
 #include <sys/dmu.h>
+#include <sys/btree.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -35,8 +36,10 @@ extern "C" {
 
 typedef struct space_map_ops space_map_ops_t;
 
+#define	SPACE_MAP_HISTOGRAM_SIZE	32
+
 typedef struct space_map {
-	avl_tree_t	sm_root;	/* AVL tree of map segments */
+	btree_t		sm_root;	/* B-tree of map segments */
 	uint64_t	sm_space;	/* sum of all segments in the map */
 	uint64_t	sm_start;	/* start of map */
 	uint64_t	sm_size;	/* size of map */
@@ -46,14 +49,17 @@ typedef struct space_map {
 	uint8_t		sm_loading;	/* map loading? */
 	kcondvar_t	sm_load_cv;	/* map load completion */
 	space_map_ops_t	*sm_ops;	/* space map block picker ops vector */
-	avl_tree_t	*sm_pp_root;	/* picker-private AVL tree */
+	btree_t		*sm_pp_root;	/* picker-private B-tree */
 	void		*sm_ppd;	/* picker-private data */
 	kmutex_t	*sm_lock;	/* pointer to lock that protects map */
+	uint64_t	sm_histogram[SPACE_MAP_HISTOGRAM_SIZE]; /* segs by size */
 } space_map_t;
 
+/*
+ * Segments are stored by value in the B-tree, so a pointer to one is only
+ * good until the next change to the tree it came from.
+ */
 typedef struct space_seg {
-	avl_node_t	ss_node;	/* AVL node */
-	avl_node_t	ss_pp_node;	/* AVL picker-private node */
 	uint64_t	ss_start;	/* starting offset of this segment */
 	uint64_t	ss_end;		/* ending offset (non-inclusive) */
 } space_seg_t;
@@ -70,6 +76,39 @@ typedef struct space_map_obj {
 	uint64_t	smo_alloc;	/* space allocated from the map */
 } space_map_obj_t;
 
+/*
+ * The free segment histogram counts free segments by power-of-two size,
+ * in units of the map's sm_shift: bucket i holds segments of size
+ * [2^i, 2^(i+1)) << sm_shift.  Metaslab space maps created while the
+ * spacemap_free_histogram feature is enabled have a bonus buffer of
+ * SPACE_MAP_SIZE_V1 that stores it after the space_map_obj_t; other
+ * space maps, including every DTL, keep the original SPACE_MAP_SIZE_V0
+ * bonus and the histogram lives only in core.  Older software may still
+ * write a map without maintaining its histogram, so the histogram is
+ * stamped with the smo_objsize and smo_alloc it describes and is only
+ * trusted while both still match.
+ *
+ * smh_max_free, the size in bytes of the largest free segment, is kept
+ * and stamped along with the histogram.  Frees written while the map
+ * isn't loaded may coalesce into larger segments than it records, so
+ * it's a lower bound until the next owner loads the map and rebuilds it.
+ *
+ * Every in-core map keeps the same histogram of its own segments in
+ * sm_histogram, updated as segments are added and removed, so an
+ * on-disk histogram can be built from in-core maps without walking them.
+ */
+
+typedef struct space_map_histogram {
+	uint64_t	smh_objsize;	/* smo_objsize the histogram matches */
+	uint64_t	smh_alloc;	/* smo_alloc the histogram matches */
+	uint64_t	smh_histogram[SPACE_MAP_HISTOGRAM_SIZE]; /* free segs */
+	uint64_t	smh_max_free;	/* largest free segment */
+} space_map_histogram_t;
+
+#define	SPACE_MAP_SIZE_V0	(sizeof (space_map_obj_t))
+#define	SPACE_MAP_SIZE_V1	\
+	(SPACE_MAP_SIZE_V0 + sizeof (space_map_histogram_t))
+
 struct space_map_ops {
 	void	(*smop_load)(space_map_t *sm);
 	void	(*smop_unload)(space_map_t *sm);
@@ -152,6 +191,7 @@ extern void space_map_load_wait(space_map_t *sm);
 extern int space_map_load(space_map_t *sm, space_map_ops_t *ops,
     uint8_t maptype, space_map_obj_t *smo, objset_t *os);
 extern void space_map_unload(space_map_t *sm);
+extern void space_map_set_ops(space_map_t *sm, space_map_ops_t *ops);
 
 extern uint64_t space_map_alloc(space_map_t *sm, uint64_t size);
 extern void space_map_claim(space_map_t *sm, uint64_t start, uint64_t size);
@@ -163,6 +203,16 @@ extern void space_map_sync(space_map_t *sm, uint8_t maptype,
 extern void space_map_truncate(space_map_obj_t *smo,
     objset_t *os, dmu_tx_t *tx);
 
+extern boolean_t space_map_histogram_valid(space_map_obj_t *smo,
+    space_map_histogram_t *smh);
+extern void space_map_histogram_clear(space_map_histogram_t *smh);
+extern void space_map_histogram_add(space_map_t *sm,
+    space_map_histogram_t *smh);
+extern void space_map_histogram_stamp(space_map_obj_t *smo,
+    space_map_histogram_t *smh);
+extern uint64_t space_map_max_free(space_map_obj_t *smo,
+    space_map_histogram_t *smh, uint8_t shift);
+
 extern void space_map_ref_create(avl_tree_t *t);
 extern void space_map_ref_destroy(avl_tree_t *t);
 extern void space_map_ref_add_seg(avl_tree_t *t,
@@ -548,7 +548,12 @@ extern void delay(clock_t ticks);
 #define	minclsyspri	60
 #define	maxclsyspri	99
 
-#define	CPU_SEQID	((int)pthread_self() & (max_ncpus - 1))
+/*
+ * A pthread_t is the address of the thread's page aligned descriptor,
+ * so its low bits are the same for every thread; skip them.
+ */
+#define	CPU_SEQID	((int)((uintptr_t)pthread_self() >> 12) & \
+			    (max_ncpus - 1))
 
 #define	kcred		NULL
 #define	CRED()		NULL
@@ -207,6 +207,7 @@ typedef struct znode {
 	uint64_t	z_mapcnt;	/* number of pages mapped to file */
 	uint64_t	z_gen;		/* generation (cached) */
 	uint64_t	z_size;		/* file size (cached) */
+	uint64_t	z_replay_eof;	/* new end of file - replay only */
 	uint64_t	z_atime[2];	/* atime (cached) */
 	uint64_t	z_mtime[2];	/* OSX only */
 	uint64_t	z_links;	/* file links (cached) */
@@ -367,8 +367,10 @@ typedef struct itx {
 	void		*itx_private;	/* type-specific opaque data */
 	itx_wr_state_t	itx_wr_state;	/* write state */
 	uint8_t		itx_sync;	/* synchronous transaction */
+	uint8_t		itx_coalesce;	/* may merge with adjacent write */
 	uint64_t	itx_sod;	/* record size on disk */
 	uint64_t	itx_oid;	/* object id */
+	hrtime_t	itx_time;	/* assignment time, for merging */
 	lr_t		itx_lr;		/* common part of log record */
 	/* followed by type-specific part of lr_xx_t and its immediate data */
 } itx_t;
@@ -389,6 +391,12 @@ typedef struct zil_stats {
 	 */
 	kstat_named_t zil_commit_writer_count;
 
+	/*
+	 * Number of commit batches that started building while an
+	 * earlier batch's log blocks were still in flight.
+	 */
+	kstat_named_t zil_commit_pipelined_count;
+
 	/*
 	 * Number of transactions (reads, writes, renames, etc.)
 	 * that have been commited.
@@ -407,6 +415,21 @@ typedef struct zil_stats {
 	kstat_named_t zil_itx_needcopy_count;
 	kstat_named_t zil_itx_needcopy_bytes;
 
+	/*
+	 * TX_WRITE itxs that were merged into the preceding write to the
+	 * same object rather than logged as records of their own, and
+	 * the data bytes they carried.
+	 */
+	kstat_named_t zil_itx_coalesced_count;
+	kstat_named_t zil_itx_coalesced_bytes;
+
+	/*
+	 * Sync itxs for other objects that a commit left on the sync list,
+	 * because nothing the commit was asked for depends on them.  An
+	 * itx is counted again by each commit that passes it over.
+	 */
+	kstat_named_t zil_itx_deferred_count;
+
 	/*
 	 * Transactions which have been allocated to the "normal"
 	 * (i.e. not slog) storage pool. Note that "bytes" accumulate
@@ -423,6 +446,15 @@ typedef struct zil_stats {
 	 */
 	kstat_named_t zil_itx_metaslab_slog_count;
 	kstat_named_t zil_itx_metaslab_slog_bytes;
+
+	/*
+	 * Size of the log blocks written, and how much of that held no
+	 * log records.  With slim ZIL blocks the unused tail is not
+	 * written, but it was allocated and so counts against the log
+	 * device's space and its pending fastwrite bytes.
+	 */
+	kstat_named_t zil_lwb_alloc_bytes;
+	kstat_named_t zil_lwb_wasted_bytes;
 } zil_stats_t;
 
 extern zil_stats_t zil_stats;
@@ -454,6 +486,7 @@ extern void	zil_close(zilog_t *zilog);
 extern void	zil_replay(objset_t *os, void *arg,
     zil_replay_func_t *replay_func[TX_MAX_TYPE]);
 extern boolean_t zil_replaying(zilog_t *zilog, dmu_tx_t *tx);
+extern boolean_t zil_prefer_indirect(zilog_t *zilog);
 extern void	zil_destroy(zilog_t *zilog, boolean_t keep_first);
 extern void	zil_destroy_sync(zilog_t *zilog, dmu_tx_t *tx);
 extern void	zil_rollback_destroy(zilog_t *zilog, dmu_tx_t *tx);
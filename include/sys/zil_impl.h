@@ -66,6 +66,23 @@ typedef struct itxg {
 	itxs_t		*itxg_itxs;	/* sync and async itxs */
 } itxg_t;
 
+/*
+ * Per-CPU staging of newly assigned itxs.  zil_itx_assign() appends to
+ * the list of the CPU it runs on, so concurrent loggers don't all take
+ * the same itxg lock; the lists are merged into the itxg, in assignment
+ * order, whenever the itxg is about to be read.  Each one is aligned to
+ * ITX_CPU_ALIGN, a cache line, so one CPU's ic_lock doesn't share a line
+ * with its neighbour's.
+ */
+#define	ITX_CPU_ALIGN	64
+
+typedef struct itx_cpu {
+	kmutex_t	ic_lock;		/* protects this structure */
+	uint64_t	ic_txg[TXG_SIZE];	/* txg of staged itxs */
+	uint64_t	ic_sod[TXG_SIZE];	/* size of staged sync itxs */
+	list_t		ic_list[TXG_SIZE];	/* itxs in assignment order */
+} __attribute__((aligned(ITX_CPU_ALIGN))) itx_cpu_t;
+
 /* for async nodes we build up an AVL tree of lists of async itxs per file */
 typedef struct itx_async_node {
 	uint64_t	ia_foid;	/* file object id */
@@ -79,11 +96,53 @@ typedef struct itx_async_node {
  */
 typedef struct zil_vdev_node {
 	uint64_t	zv_vdev;	/* vdev to be flushed */
+	uint64_t	zv_batch;	/* last commit batch to write it */
 	avl_node_t	zv_node;	/* AVL tree linkage */
 } zil_vdev_node_t;
 
 #define	ZIL_PREV_BLKS 16
 
+/*
+ * The objects a commit batch was asked to make stable.  A batch asked
+ * for every object (foid 0), or for more than ZIL_SCOPE_FOIDS of them,
+ * commits the whole sync list.
+ */
+#define	ZIL_SCOPE_FOIDS	8
+
+typedef struct zil_scope {
+	boolean_t	zs_all;		/* commit everything */
+	uint_t		zs_nfoids;	/* entries used in zs_foids[] */
+	uint64_t	zs_foids[ZIL_SCOPE_FOIDS]; /* objects asked for */
+} zil_scope_t;
+
+/*
+ * Per-dataset commit statistics, exported as the "zil-<pool>-<objset>"
+ * kstat.  Each zil_commit() adds one sample to the histogram for every
+ * phase it went through.  Bucket i counts samples of less than 2^i
+ * microseconds; the last bucket also takes everything longer.  ZCS_HIST()
+ * in zil.c names the buckets and must be kept in step.
+ */
+#define	ZIL_HIST_BUCKETS	24
+
+typedef enum zil_commit_phase {
+	ZIL_PHASE_WAIT,		/* for the writer, or another's batch */
+	ZIL_PHASE_BUILD,	/* writer packing itxs into lwbs */
+	ZIL_PHASE_WRITE,	/* lwbs of this and earlier batches */
+	ZIL_PHASE_FLUSH,	/* vdev write cache flush */
+	ZIL_PHASE_TOTAL,	/* the whole zil_commit() */
+	ZIL_NUM_PHASES
+} zil_commit_phase_t;
+
+typedef struct zil_commit_stats {
+	kstat_named_t	zcs_commits;	/* zil_commit() calls */
+	kstat_named_t	zcs_batches;	/* batches that wrote records */
+	kstat_named_t	zcs_itxs;	/* itxs written by those batches */
+	kstat_named_t	zcs_bytes;	/* log record bytes, incl. data */
+	kstat_named_t	zcs_lwbs;	/* log blocks written */
+	kstat_named_t	zcs_lwbs_inflight_max; /* most lwbs in flight */
+	kstat_named_t	zcs_hist[ZIL_NUM_PHASES][ZIL_HIST_BUCKETS];
+} zil_commit_stats_t;
+
 /*
  * Stable storage intent log management structure.  One per dataset.
  */
@@ -101,11 +160,12 @@ struct zilog {
 	uint64_t	zl_replayed_seq[TXG_SIZE]; /* last replayed rec seq */
 	uint64_t	zl_replaying_seq; /* current replay seq number */
 	uint32_t	zl_suspend;	/* log suspend count */
-	kcondvar_t	zl_cv_writer;	/* log writer thread completion */
+	kcondvar_t	zl_cv_writer;	/* commit batch completion */
 	kcondvar_t	zl_cv_suspend;	/* log suspend completion */
 	uint8_t		zl_suspending;	/* log is currently suspending */
 	uint8_t		zl_keep_first;	/* keep first log block in destroy */
 	uint8_t		zl_replay;	/* replaying records while set */
+	uint8_t		zl_replay_parallel; /* records replaying on taskqs */
 	uint8_t		zl_stop_sync;	/* for debugging */
 	uint8_t		zl_writer;	/* boolean: write setup in progress */
 	uint8_t		zl_logbias;	/* latency or throughput */
@@ -117,8 +177,15 @@ struct zilog {
 	uint64_t	zl_parse_lr_count; /* number of log records parsed */
 	uint64_t	zl_next_batch;	/* next batch number */
 	uint64_t	zl_com_batch;	/* committed batch number */
+	uint64_t	zl_fail_batch;	/* last batch built on a bad lwb */
 	kcondvar_t	zl_cv_batch[2];	/* batch condition variables */
+	zil_scope_t	zl_batch_scope[2]; /* objects each batch commits */
 	itxg_t		zl_itxg[TXG_SIZE]; /* intent log txg chains */
+	itx_cpu_t	*zl_itx_cpu;	/* per-CPU itxs not yet in zl_itxg */
+	void		*zl_itx_cpu_buf; /* allocation zl_itx_cpu is aligned in */
+	kmutex_t	zl_itx_staged_lock; /* protects zl_itx_staged */
+	uint64_t	*zl_itx_staged;	/* CPUs with itxs staged, per txg */
+	int		zl_itx_staged_words; /* words per txg in zl_itx_staged */
 	list_t		zl_itx_commit_list; /* itx list to be committed */
 	uint64_t	zl_itx_list_sz;	/* total size of records on list */
 	uint64_t	zl_cur_used;	/* current commit log size used */
@@ -132,7 +199,13 @@ struct zilog {
 	zil_header_t	zl_old_header;	/* debugging aid */
 	uint_t		zl_prev_blks[ZIL_PREV_BLKS]; /* size - sector rounded */
 	uint_t		zl_prev_rotor;	/* rotor for zl_prev[] */
+	uint64_t	zl_commit_sizes[ZIL_PREV_BLKS]; /* recent batches */
+	uint_t		zl_commit_rotor; /* rotor for zl_commit_sizes[] */
 	txg_node_t	zl_dirty_link;	/* protected by dp_dirty_zilogs list */
+	zil_commit_stats_t *zl_commit_stats; /* stats while open, or NULL */
+	kstat_t		*zl_commit_ksp;	/* "zil-<pool>-<objset>" kstat */
+	uint64_t	zl_lwb_inflight; /* lwb writes issued, not done */
+	uint64_t	zl_indirect_probe; /* zil_prefer_indirect() calls */
 };
 
 typedef struct zil_bp_node {
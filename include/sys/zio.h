@@ -114,6 +114,14 @@ enum zio_compress {
 #define	ZIO_COMPRESS_ON_VALUE	ZIO_COMPRESS_LZJB
 #define	ZIO_COMPRESS_DEFAULT	ZIO_COMPRESS_OFF
 
+/*
+ * compression=auto is a property value, like "on", not an algorithm.
+ * zio_write_bp_init() picks a real algorithm for each block, so it never
+ * reaches a block pointer or a dnode, and its value is kept out of the
+ * range those can hold so that new algorithms don't collide with it.
+ */
+#define	ZIO_COMPRESS_AUTO	0x100
+
 #define	BOOTFS_COMPRESS_VALID(compress)			\
 	((compress) == ZIO_COMPRESS_LZJB ||		\
 	((compress) == ZIO_COMPRESS_ON &&		\
@@ -170,6 +178,7 @@ enum zio_flag {
 	ZIO_FLAG_DONT_CACHE	= 1 << 10,
 	ZIO_FLAG_NODATA		= 1 << 11,
 	ZIO_FLAG_INDUCE_DAMAGE	= 1 << 12,
+	ZIO_FLAG_SYNC_LATENCY	= 1 << 13,	/* log or dmu_sync() write */
 
 #define	ZIO_FLAG_DDT_INHERIT	(ZIO_FLAG_IO_RETRY - 1)
 #define	ZIO_FLAG_GANG_INHERIT	(ZIO_FLAG_IO_RETRY - 1)
@@ -177,25 +186,26 @@ enum zio_flag {
 	/*
 	 * Flags inherited by vdev children.
 	 */
-	ZIO_FLAG_IO_RETRY	= 1 << 13,	/* must be first for INHERIT */
-	ZIO_FLAG_PROBE		= 1 << 14,
-	ZIO_FLAG_TRYHARD	= 1 << 15,
-	ZIO_FLAG_OPTIONAL	= 1 << 16,
+	ZIO_FLAG_IO_RETRY	= 1 << 14,	/* must be first for INHERIT */
+	ZIO_FLAG_PROBE		= 1 << 15,
+	ZIO_FLAG_TRYHARD	= 1 << 16,
+	ZIO_FLAG_OPTIONAL	= 1 << 17,
 
 #define	ZIO_FLAG_VDEV_INHERIT	(ZIO_FLAG_DONT_QUEUE - 1)
 
 	/*
 	 * Flags not inherited by any children.
 	 */
-	ZIO_FLAG_DONT_QUEUE	= 1 << 17,	/* must be first for INHERIT */
-	ZIO_FLAG_DONT_PROPAGATE	= 1 << 18,
-	ZIO_FLAG_IO_BYPASS	= 1 << 19,
-	ZIO_FLAG_IO_REWRITE	= 1 << 20,
-	ZIO_FLAG_RAW		= 1 << 21,
-	ZIO_FLAG_GANG_CHILD	= 1 << 22,
-	ZIO_FLAG_DDT_CHILD	= 1 << 23,
-	ZIO_FLAG_GODFATHER	= 1 << 24,
-	ZIO_FLAG_FASTWRITE      = 1 << 25
+	ZIO_FLAG_DONT_QUEUE	= 1 << 18,	/* must be first for INHERIT */
+	ZIO_FLAG_DONT_PROPAGATE	= 1 << 19,
+	ZIO_FLAG_IO_BYPASS	= 1 << 20,
+	ZIO_FLAG_IO_REWRITE	= 1 << 21,
+	ZIO_FLAG_RAW		= 1 << 22,
+	ZIO_FLAG_GANG_CHILD	= 1 << 23,
+	ZIO_FLAG_DDT_CHILD	= 1 << 24,
+	ZIO_FLAG_GODFATHER	= 1 << 25,
+	ZIO_FLAG_FASTWRITE      = 1 << 26,
+	ZIO_FLAG_ALLOC_QUEUED	= 1 << 27
 };
 
 #define	ZIO_FLAG_MUSTSUCCEED		0
@@ -288,14 +298,18 @@ typedef struct zbookmark {
 	(zb)->zb_level == ZB_ROOT_LEVEL &&	\
 	(zb)->zb_blkid == ZB_ROOT_BLKID)
 
+struct zio_compress_auto;
+
 typedef struct zio_prop {
 	enum zio_checksum	zp_checksum;
 	enum zio_compress	zp_compress;
+	struct zio_compress_auto *zp_compress_auto; /* set if auto */
 	dmu_object_type_t	zp_type;
 	uint8_t			zp_level;
 	uint8_t			zp_copies;
 	uint8_t			zp_dedup;
 	uint8_t			zp_dedup_verify;
+	uint64_t		zp_special_smallblk; /* special_small_blocks */
 } zio_prop_t;
 
 typedef struct zio_cksum_report zio_cksum_report_t;
@@ -422,6 +436,7 @@ struct zio {
 	enum zio_stage	io_orig_stage;
 	enum zio_stage	io_orig_pipeline;
 	uint64_t	io_delay;
+	hrtime_t	io_timestamp;	/* leaf vdev I/O issued */
 	int		io_error;
 	int		io_child_error[ZIO_CHILD_TYPES];
 	uint64_t	io_children[ZIO_CHILD_TYPES][ZIO_WAIT_TYPES];
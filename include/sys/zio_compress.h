@@ -74,8 +74,23 @@ extern int zle_decompress(void *src, void *dst, size_t s_len, size_t d_len,
  */
 extern size_t zio_compress_data(enum zio_compress c, void *src, void *dst,
     size_t s_len);
+extern size_t zio_compress_auto_data(enum zio_compress c, void *src,
+    void *dst, size_t s_len);
 extern int zio_decompress_data(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len);
+extern void zio_compress_init(void);
+extern void zio_compress_fini(void);
+
+/*
+ * Per-objset algorithm selection for compression=auto.
+ */
+typedef struct zio_compress_auto zio_compress_auto_t;
+
+extern zio_compress_auto_t *zio_compress_auto_create(char *name);
+extern void zio_compress_auto_destroy(zio_compress_auto_t *za);
+extern enum zio_compress zio_compress_auto_select(zio_compress_auto_t *za);
+extern void zio_compress_auto_done(zio_compress_auto_t *za,
+    enum zio_compress c, size_t lsize, size_t psize);
 
 #ifdef	__cplusplus
 }
@@ -52,6 +52,8 @@ typedef int (zfeature_func_t)(zfeature_info_t *fi, void *arg);
 typedef enum spa_feature {
 	SPA_FEATURE_ASYNC_DESTROY,
 	SPA_FEATURE_EMPTY_BPOBJ,
+	SPA_FEATURE_SPACEMAP_FREE_HISTOGRAM,
+	SPA_FEATURE_COMPRESS_AUTO,
 	SPA_FEATURES
 } spa_feature_t;
 
@@ -57,6 +57,10 @@
 #define DMU_READ_ZC			0x0040 /* Incompatible w/DMU_VERIFY */
 #define DMU_WRITE_NOWAIT		0x0080
 #define DMU_READ_NOPF			0x0100
+#define DMU_FILL_ZERO			0x0200 /* Incompatible w/DMU_VERIFY */
+#define DMU_FILL_RANDOM			0x0400 /* Incompatible w/DMU_VERIFY */
+#define DMU_WRITE_SYNC			0x0800 /* Log and commit each write */
+#define DMU_WRITE_SYNC_COPY		0x1000 /* Copy logged data to the itx */
 
 #define ZPIOS_NAME_SIZE			16
 #define ZPIOS_PATH_SIZE			128
@@ -85,6 +85,7 @@ typedef struct run_args {
 
 	/* Control data */
 	objset_t *os;
+	zilog_t *zilog;		/* DMU_WRITE_SYNC only */
         wait_queue_head_t waitq;
 	volatile uint64_t threads_done;
         kmutex_t lock_work;
@@ -130,6 +130,7 @@
 #include <sys/byteorder.h>
 #include <sys/zio.h>
 #include <sys/spa.h>
+#include <zfs_fletcher.h>
 
 void
 fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
@@ -156,8 +157,8 @@ fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	uint64_t a0, b0, a1, b1;
 
 	for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) {
-		a0 += BSWAP_64(ip[0]);
-		a1 += BSWAP_64(ip[1]);
+		a0 += ZFS_BSWAP_64(ip[0]);
+		a1 += ZFS_BSWAP_64(ip[1]);
 		b0 += a0;
 		b1 += a1;
 	}
@@ -165,21 +166,54 @@ fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
+/*
+ * The fletcher-4 accumulators form one long dependency chain, so the plain
+ * loop retires a single word per iteration no matter how wide the CPU is.
+ * Instead, run two independent streams over the even and odd words and
+ * fold them together at the end.  With a0..d0 accumulated over the even
+ * words and a1..d1 over the odd words, the serial result is:
+ *
+ *	a = a0 + a1
+ *	b = 2b0 + 2b1 - a1
+ *	c = 4c0 - b0 + 4c1 - 3b1
+ *	d = 8d0 - 4c0 + 8d1 - 8c1 + b1
+ *
+ * all modulo 2^64, exactly like the serial accumulators.  A trailing odd
+ * word is folded in serially.
+ */
+static inline void
+fletcher_4_fold(uint64_t a0, uint64_t b0, uint64_t c0, uint64_t d0,
+    uint64_t a1, uint64_t b1, uint64_t c1, uint64_t d1, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, a0 + a1,
+	    2 * b0 + 2 * b1 - a1,
+	    4 * c0 - b0 + 4 * c1 - 3 * b1,
+	    8 * d0 - 4 * c0 + 8 * d1 - 8 * c1 + b1);
+}
+
 void
 fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	uint64_t a0, b0, c0, d0, a1, b1, c1, d1;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
-		a += ip[0];
-		b += a;
-		c += b;
-		d += c;
+	a0 = b0 = c0 = d0 = a1 = b1 = c1 = d1 = 0;
+	for (; ip + 1 < ipend; ip += 2) {
+		a0 += ip[0];
+		a1 += ip[1];
+		b0 += a0;
+		b1 += a1;
+		c0 += b0;
+		c1 += b1;
+		d0 += c0;
+		d1 += c1;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	fletcher_4_fold(a0, b0, c0, d0, a1, b1, c1, d1, zcp);
+
+	if (ip < ipend)
+		fletcher_4_incremental_native(ip, sizeof (uint32_t), zcp);
 }
 
 void
@@ -187,16 +221,24 @@ fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	uint64_t a0, b0, c0, d0, a1, b1, c1, d1;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
-		a += BSWAP_32(ip[0]);
-		b += a;
-		c += b;
-		d += c;
+	a0 = b0 = c0 = d0 = a1 = b1 = c1 = d1 = 0;
+	for (; ip + 1 < ipend; ip += 2) {
+		a0 += ZFS_BSWAP_32(ip[0]);
+		a1 += ZFS_BSWAP_32(ip[1]);
+		b0 += a0;
+		b1 += a1;
+		c0 += b0;
+		c1 += b1;
+		d0 += c0;
+		d1 += c1;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	fletcher_4_fold(a0, b0, c0, d0, a1, b1, c1, d1, zcp);
+
+	if (ip < ipend)
+		fletcher_4_incremental_byteswap(ip, sizeof (uint32_t), zcp);
 }
 
 void
@@ -236,7 +278,7 @@ fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
 	d = zcp->zc_word[3];
 
 	for (; ip < ipend; ip++) {
-		a += BSWAP_32(ip[0]);
+		a += ZFS_BSWAP_32(ip[0]);
 		b += a;
 		c += b;
 		d += c;
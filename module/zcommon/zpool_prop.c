@@ -64,6 +64,15 @@ zpool_prop_init(void)
 		{ NULL }
 	};
 
+	static zprop_index_t allocator_table[] = {
+		{ "df",		ZPOOL_ALLOCATOR_DF },
+		{ "ff",		ZPOOL_ALLOCATOR_FF },
+		{ "cdf",	ZPOOL_ALLOCATOR_CDF },
+		{ "ndf",	ZPOOL_ALLOCATOR_NDF },
+		{ "sf",		ZPOOL_ALLOCATOR_SF },
+		{ NULL }
+	};
+
 	/* string properties */
 	zprop_register_string(ZPOOL_PROP_ALTROOT, "altroot", NULL, PROP_DEFAULT,
 	    ZFS_TYPE_POOL, "<path>", "ALTROOT");
@@ -85,6 +94,10 @@ zpool_prop_init(void)
 	    PROP_READONLY, ZFS_TYPE_POOL, "<size>", "ALLOC");
 	zprop_register_number(ZPOOL_PROP_EXPANDSZ, "expandsize", 0,
 	    PROP_READONLY, ZFS_TYPE_POOL, "<size>", "EXPANDSZ");
+	zprop_register_number(ZPOOL_PROP_FRAGMENTATION, "fragmentation", 0,
+	    PROP_READONLY, ZFS_TYPE_POOL, "<percent>", "FRAG");
+	zprop_register_number(ZPOOL_PROP_MAXFREE, "maxfree", 0, PROP_READONLY,
+	    ZFS_TYPE_POOL, "<size>", "MAXFREE");
 	zprop_register_number(ZPOOL_PROP_CAPACITY, "capacity", 0, PROP_READONLY,
 	    ZFS_TYPE_POOL, "<size>", "CAP");
 	zprop_register_number(ZPOOL_PROP_GUID, "guid", 0, PROP_READONLY,
@@ -123,6 +136,9 @@ zpool_prop_init(void)
 	zprop_register_index(ZPOOL_PROP_FAILUREMODE, "failmode",
 	    ZIO_FAILURE_MODE_WAIT, PROP_DEFAULT, ZFS_TYPE_POOL,
 	    "wait | continue | panic", "FAILMODE", failuremode_table);
+	zprop_register_index(ZPOOL_PROP_ALLOCATOR, "allocator",
+	    ZPOOL_ALLOCATOR_DF, PROP_DEFAULT, ZFS_TYPE_POOL,
+	    "df | ff | cdf | ndf | sf", "ALLOCATOR", allocator_table);
 
 	/* hidden properties */
 	zprop_register_hidden(ZPOOL_PROP_NAME, "name", PROP_TYPE_STRING,
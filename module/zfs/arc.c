@@ -304,6 +304,12 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_free_on_write;
 	kstat_named_t arcstat_l2_abort_lowmem;
 	kstat_named_t arcstat_l2_cksum_bad;
+	kstat_named_t arcstat_l2_cksum_verified;
+	kstat_named_t arcstat_l2_cksum_verify_bytes;
+	kstat_named_t arcstat_l2_cksum_verify_ns;
+	kstat_named_t arcstat_l2_cksum_skipped;
+	kstat_named_t arcstat_l2_cksum_skipped_bytes;
+	kstat_named_t arcstat_l2_cksum_saved_ns;
 	kstat_named_t arcstat_l2_io_error;
 	kstat_named_t arcstat_l2_size;
 	kstat_named_t arcstat_l2_hdr_size;
@@ -384,6 +390,12 @@ static arc_stats_t arc_stats = {
 	{ "l2_free_on_write",		KSTAT_DATA_UINT64 },
 	{ "l2_abort_lowmem",		KSTAT_DATA_UINT64 },
 	{ "l2_cksum_bad",		KSTAT_DATA_UINT64 },
+	{ "l2_cksum_verified",		KSTAT_DATA_UINT64 },
+	{ "l2_cksum_verify_bytes",	KSTAT_DATA_UINT64 },
+	{ "l2_cksum_verify_ns",		KSTAT_DATA_UINT64 },
+	{ "l2_cksum_skipped",		KSTAT_DATA_UINT64 },
+	{ "l2_cksum_skipped_bytes",	KSTAT_DATA_UINT64 },
+	{ "l2_cksum_saved_ns",		KSTAT_DATA_UINT64 },
 	{ "l2_io_error",		KSTAT_DATA_UINT64 },
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
@@ -635,6 +647,16 @@ int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_TRUE;			/* no reads during writes */
 
+/*
+ * Verify the checksum of only one in every l2arc_cksum_sample L2ARC
+ * reads.  Only meant for cache devices with their own end-to-end data
+ * protection; the first L2ARC read error or checksum failure turns
+ * sampling off again until the module is reloaded.
+ */
+int l2arc_cksum_sample = 1;
+static boolean_t l2arc_cksum_sample_off = B_FALSE;
+static uint64_t l2arc_cksum_sample_count = 0;
+
 /*
  * L2ARC Internals
  */
@@ -985,8 +1007,9 @@ arc_cksum_equal(arc_buf_t *buf)
 	zio_cksum_t zc;
 	int equal;
 
-	mutex_enter(&buf->b_hdr->b_freeze_lock);
+	/* b_freeze_lock only protects b_freeze_cksum, not the data */
 	fletcher_2_native(buf->b_data, buf->b_hdr->b_size, &zc);
+	mutex_enter(&buf->b_hdr->b_freeze_lock);
 	equal = ZIO_CHECKSUM_EQUAL(*buf->b_hdr->b_freeze_cksum, zc);
 	mutex_exit(&buf->b_hdr->b_freeze_lock);
 
@@ -4253,6 +4276,42 @@ l2arc_write_done(zio_t *zio)
 	kmem_free(cb, sizeof (l2arc_write_callback_t));
 }
 
+/*
+ * Check that a buffer read from an L2ARC device matches the checksum
+ * taken when it was written, or skip the check if sampling allows it.
+ * The cost of skipped checks is estimated from the measured cost of
+ * the ones performed.
+ */
+static int
+l2arc_cksum_check(arc_buf_t *buf)
+{
+	uint64_t size = buf->b_hdr->b_size;
+	uint64_t kbytes, ns;
+	hrtime_t start;
+	int equal;
+
+	if (l2arc_cksum_sample > 1 && !l2arc_cksum_sample_off &&
+	    atomic_inc_64_nv(&l2arc_cksum_sample_count) %
+	    l2arc_cksum_sample != 0) {
+		kbytes = ARCSTAT(arcstat_l2_cksum_verify_bytes) >> 10;
+		ns = ARCSTAT(arcstat_l2_cksum_verify_ns);
+		ARCSTAT_BUMP(arcstat_l2_cksum_skipped);
+		ARCSTAT_INCR(arcstat_l2_cksum_skipped_bytes, size);
+		if (kbytes != 0)
+			ARCSTAT_INCR(arcstat_l2_cksum_saved_ns,
+			    (size * (ns / kbytes)) >> 10);
+		return (1);
+	}
+
+	start = gethrtime();
+	equal = arc_cksum_equal(buf);
+	ARCSTAT_BUMP(arcstat_l2_cksum_verified);
+	ARCSTAT_INCR(arcstat_l2_cksum_verify_bytes, size);
+	ARCSTAT_INCR(arcstat_l2_cksum_verify_ns, gethrtime() - start);
+
+	return (equal);
+}
+
 /*
  * A read to a cache device completed.  Validate buffer contents before
  * handing over to the regular ARC routines.
@@ -4264,6 +4323,7 @@ l2arc_read_done(zio_t *zio)
 	arc_buf_hdr_t *hdr;
 	arc_buf_t *buf;
 	kmutex_t *hash_lock;
+	boolean_t evicted;
 	int equal;
 
 	ASSERT(zio->io_vd != NULL);
@@ -4284,8 +4344,9 @@ l2arc_read_done(zio_t *zio)
 	/*
 	 * Check this survived the L2ARC journey.
 	 */
-	equal = arc_cksum_equal(buf);
-	if (equal && zio->io_error == 0 && !HDR_L2_EVICTED(hdr)) {
+	equal = l2arc_cksum_check(buf);
+	evicted = HDR_L2_EVICTED(hdr);
+	if (equal && zio->io_error == 0 && !evicted) {
 		mutex_exit(hash_lock);
 		zio->io_private = buf;
 		zio->io_bp_copy = cb->l2rcb_bp;	/* XXX fix in L2ARC 2.0	*/
@@ -4305,6 +4366,10 @@ l2arc_read_done(zio_t *zio)
 		if (!equal)
 			ARCSTAT_BUMP(arcstat_l2_cksum_bad);
 
+		/* Evicted buffers say nothing about the device */
+		if (!evicted)
+			l2arc_cksum_sample_off = B_TRUE;
+
 		/*
 		 * If there's no waiter, issue an async i/o to the primary
 		 * storage now.  If there *is* a waiter, the caller must
@@ -4993,4 +5058,7 @@ MODULE_PARM_DESC(l2arc_feed_again, "Turbo L2ARC warmup");
 module_param(l2arc_norw, int, 0444);
 MODULE_PARM_DESC(l2arc_norw, "No reads during writes");
 
+module_param(l2arc_cksum_sample, int, 0644);
+MODULE_PARM_DESC(l2arc_cksum_sample, "Verify 1 of every N L2ARC reads");
+
 #endif
@@ -0,0 +1,878 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/btree.h>
+
+/*
+ * B-tree implementation.
+ *
+ * Every element lives in exactly one node, core or leaf, so an element
+ * can be modified in place.  New elements always go into a leaf; a full
+ * node is split around its median, which moves up into the parent.
+ * Removing an element from a core node replaces it with its in-order
+ * predecessor, which always lives in a leaf.  A node left less than
+ * half full borrows an element from a sibling through the parent, or
+ * if both siblings are at the minimum, merges with one of them.
+ *
+ * While the root is a leaf it is sized to fit: it starts small, doubles
+ * when full until it reaches BTREE_LEAF_SIZE, and halves again when it
+ * drops to a quarter full.  Every other leaf is BTREE_LEAF_SIZE bytes.
+ *
+ * NOTE: caller is responsible for all locking.
+ */
+
+static kmem_cache_t *btree_leaf_cache;
+
+#define	BTREE_CORE_SIZE(size)	\
+	(offsetof(btree_core_t, btc_elems) + BTREE_CORE_ELEMS * (size))
+#define	BTREE_CORE_MIN		((BTREE_CORE_ELEMS - 1) / 2)
+#define	BTREE_LEAF_MIN(tree)	(((tree)->bt_leaf_cap - 1) / 2)
+#define	BTREE_LEAF_CAP(tree, bytes)	\
+	(((bytes) - offsetof(btree_leaf_t, btl_elems)) / (tree)->bt_elem_size)
+
+#define	BTREE_ELEM(tree, hdr, i)	\
+	(btree_elems(hdr) + (size_t)(i) * (tree)->bt_elem_size)
+#define	BTREE_CHILDREN(hdr)	(((btree_core_t *)(hdr))->btc_children)
+
+static uint8_t *
+btree_elems(btree_hdr_t *hdr)
+{
+	if (hdr->bth_core)
+		return (((btree_core_t *)hdr)->btc_elems);
+	return (((btree_leaf_t *)hdr)->btl_elems);
+}
+
+void
+btree_init(void)
+{
+	btree_leaf_cache = kmem_cache_create("btree_leaf_cache",
+	    BTREE_LEAF_SIZE, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+btree_fini(void)
+{
+	kmem_cache_destroy(btree_leaf_cache);
+}
+
+/*
+ * Size in bytes of a leaf.  Only the root may be smaller than
+ * BTREE_LEAF_SIZE.
+ */
+static size_t
+btree_leaf_bytes(btree_t *tree, btree_hdr_t *hdr)
+{
+	ASSERT(!hdr->bth_core);
+	return (hdr == tree->bt_root ? tree->bt_root_size : BTREE_LEAF_SIZE);
+}
+
+static uint32_t
+btree_leaf_cap(btree_t *tree, btree_hdr_t *hdr)
+{
+	return (BTREE_LEAF_CAP(tree, btree_leaf_bytes(tree, hdr)));
+}
+
+/*
+ * The smallest root leaf for the tree's elements.  It must hold at least
+ * two, so that it has something to split when it gets to full size.
+ */
+static size_t
+btree_root_min(btree_t *tree)
+{
+	size_t bytes = BTREE_SMALL_LEAF_SIZE;
+
+	while (BTREE_LEAF_CAP(tree, bytes) < 2)
+		bytes *= 2;
+
+	return (bytes);
+}
+
+static void *
+btree_leaf_alloc(size_t bytes)
+{
+	if (bytes == BTREE_LEAF_SIZE)
+		return (kmem_cache_alloc(btree_leaf_cache, KM_PUSHPAGE));
+	return (kmem_alloc(bytes, KM_PUSHPAGE));
+}
+
+static void
+btree_leaf_free(void *leaf, size_t bytes)
+{
+	if (bytes == BTREE_LEAF_SIZE)
+		kmem_cache_free(btree_leaf_cache, leaf);
+	else
+		kmem_free(leaf, bytes);
+}
+
+/*
+ * Allocate a node.  A leaf allocated for an empty tree is its root and
+ * is bt_root_size bytes; any other is BTREE_LEAF_SIZE.
+ */
+static btree_hdr_t *
+btree_node_alloc(btree_t *tree, boolean_t core)
+{
+	btree_hdr_t *hdr;
+
+	if (core) {
+		hdr = kmem_alloc(BTREE_CORE_SIZE(tree->bt_elem_size),
+		    KM_PUSHPAGE);
+		tree->bt_num_cores++;
+	} else {
+		hdr = btree_leaf_alloc(tree->bt_root == NULL ?
+		    tree->bt_root_size : BTREE_LEAF_SIZE);
+		tree->bt_num_leaves++;
+	}
+
+	hdr->bth_parent = NULL;
+	hdr->bth_core = core;
+	hdr->bth_count = 0;
+
+	return (hdr);
+}
+
+static void
+btree_node_free(btree_t *tree, btree_hdr_t *hdr)
+{
+	if (hdr->bth_core) {
+		kmem_free(hdr, BTREE_CORE_SIZE(tree->bt_elem_size));
+		tree->bt_num_cores--;
+	} else {
+		btree_leaf_free(hdr, btree_leaf_bytes(tree, hdr));
+		tree->bt_num_leaves--;
+	}
+}
+
+/*
+ * Move the root leaf into a new leaf of the given size, and return it.
+ */
+static btree_hdr_t *
+btree_root_resize(btree_t *tree, size_t bytes)
+{
+	btree_hdr_t *old = tree->bt_root;
+	btree_hdr_t *hdr = btree_leaf_alloc(bytes);
+
+	ASSERT(!old->bth_core);
+	ASSERT3U(old->bth_count, <=, BTREE_LEAF_CAP(tree, bytes));
+
+	bcopy(old, hdr, offsetof(btree_leaf_t, btl_elems) +
+	    old->bth_count * tree->bt_elem_size);
+	btree_leaf_free(old, tree->bt_root_size);
+	tree->bt_root = hdr;
+	tree->bt_root_size = bytes;
+
+	return (hdr);
+}
+
+void
+btree_create(btree_t *tree, int (*compar)(const void *, const void *),
+    size_t size)
+{
+	ASSERT(compar != NULL);
+	VERIFY3U(size, <=, BTREE_LEAF_SIZE / 8);
+
+	bzero(tree, sizeof (*tree));
+	tree->bt_compar = compar;
+	tree->bt_elem_size = size;
+	tree->bt_leaf_cap = BTREE_LEAF_CAP(tree, BTREE_LEAF_SIZE);
+	tree->bt_root_size = btree_root_min(tree);
+}
+
+void
+btree_destroy(btree_t *tree)
+{
+	ASSERT(tree->bt_root == NULL);
+	ASSERT3U(tree->bt_num_elems, ==, 0);
+	tree->bt_compar = NULL;
+}
+
+static void
+btree_clear_node(btree_t *tree, btree_hdr_t *hdr)
+{
+	uint32_t i;
+
+	if (hdr->bth_core) {
+		for (i = 0; i <= hdr->bth_count; i++)
+			btree_clear_node(tree, BTREE_CHILDREN(hdr)[i]);
+	}
+	btree_node_free(tree, hdr);
+}
+
+/*
+ * Remove all elements from the tree.
+ */
+void
+btree_clear(btree_t *tree)
+{
+	if (tree->bt_root != NULL)
+		btree_clear_node(tree, tree->bt_root);
+
+	ASSERT3U(tree->bt_num_leaves, ==, 0);
+	ASSERT3U(tree->bt_num_cores, ==, 0);
+	tree->bt_root = NULL;
+	tree->bt_root_size = btree_root_min(tree);
+	tree->bt_height = 0;
+	tree->bt_num_elems = 0;
+}
+
+/*
+ * Binary search within a node.  Returns the offset of a matching element,
+ * or if there is none, the offset of the first element greater than value.
+ */
+static uint32_t
+btree_search(btree_t *tree, btree_hdr_t *hdr, const void *value,
+    boolean_t *found)
+{
+	uint8_t *elems = btree_elems(hdr);
+	size_t size = tree->bt_elem_size;
+	uint32_t lo = 0;
+	uint32_t hi = hdr->bth_count;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		int cmp = tree->bt_compar(elems + mid * size, value);
+
+		if (cmp == 0) {
+			*found = B_TRUE;
+			return (mid);
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = B_FALSE;
+	return (lo);
+}
+
+/*
+ * Find an element matching value.  If there is none, return NULL and set
+ * *where to the position at which it would be inserted.
+ */
+void *
+btree_find(btree_t *tree, const void *value, btree_index_t *where)
+{
+	btree_hdr_t *hdr = tree->bt_root;
+	btree_index_t idx;
+	boolean_t found;
+	void *elem = NULL;
+
+	idx.bti_node = NULL;
+	idx.bti_offset = 0;
+	idx.bti_before = B_TRUE;
+
+	while (hdr != NULL) {
+		uint32_t off = btree_search(tree, hdr, value, &found);
+
+		idx.bti_node = hdr;
+		idx.bti_offset = off;
+		if (found) {
+			idx.bti_before = B_FALSE;
+			elem = BTREE_ELEM(tree, hdr, off);
+			break;
+		}
+		if (!hdr->bth_core)
+			break;
+		hdr = BTREE_CHILDREN(hdr)[off];
+	}
+
+	if (where != NULL)
+		*where = idx;
+
+	return (elem);
+}
+
+static uint32_t
+btree_child_index(btree_core_t *parent, btree_hdr_t *child)
+{
+	uint32_t i;
+
+	for (i = 0; parent->btc_children[i] != child; i++)
+		ASSERT3U(i, <, parent->btc_hdr.bth_count);
+
+	return (i);
+}
+
+static void btree_insert_core(btree_t *tree, btree_core_t *core,
+    uint32_t off, const void *elem, btree_hdr_t *rchild);
+
+/*
+ * Insert elem into the parent of left, with right as its new right-hand
+ * child, growing a new root if left was the root.
+ */
+static void
+btree_insert_parent(btree_t *tree, btree_hdr_t *left, const void *elem,
+    btree_hdr_t *right)
+{
+	btree_core_t *parent = left->bth_parent;
+
+	if (parent == NULL) {
+		ASSERT3P(left, ==, tree->bt_root);
+		parent = (btree_core_t *)btree_node_alloc(tree, B_TRUE);
+		bcopy(elem, parent->btc_elems, tree->bt_elem_size);
+		parent->btc_children[0] = left;
+		parent->btc_children[1] = right;
+		parent->btc_hdr.bth_count = 1;
+		left->bth_parent = parent;
+		right->bth_parent = parent;
+		tree->bt_root = &parent->btc_hdr;
+		tree->bt_height++;
+		return;
+	}
+
+	btree_insert_core(tree, parent, btree_child_index(parent, left),
+	    elem, right);
+}
+
+/*
+ * Split a full node around its median element, moving the upper half into
+ * a new right sibling and the median into the parent.  Returns the new
+ * right sibling.
+ */
+static btree_hdr_t *
+btree_split(btree_t *tree, btree_hdr_t *hdr, uint32_t mid)
+{
+	btree_hdr_t *right = btree_node_alloc(tree, hdr->bth_core);
+	uint32_t rcount = hdr->bth_count - mid - 1;
+	uint32_t i;
+
+	bcopy(BTREE_ELEM(tree, hdr, mid + 1), BTREE_ELEM(tree, right, 0),
+	    rcount * tree->bt_elem_size);
+	if (hdr->bth_core) {
+		bcopy(&BTREE_CHILDREN(hdr)[mid + 1], BTREE_CHILDREN(right),
+		    (rcount + 1) * sizeof (btree_hdr_t *));
+		for (i = 0; i <= rcount; i++)
+			BTREE_CHILDREN(right)[i]->bth_parent =
+			    (btree_core_t *)right;
+	}
+	right->bth_count = rcount;
+	hdr->bth_count = mid;
+
+	/*
+	 * The median is still intact just past the end of hdr, and nothing
+	 * below writes to hdr before the parent has copied it.
+	 */
+	btree_insert_parent(tree, hdr, BTREE_ELEM(tree, hdr, mid), right);
+
+	return (right);
+}
+
+static void
+btree_insert_core(btree_t *tree, btree_core_t *core, uint32_t off,
+    const void *elem, btree_hdr_t *rchild)
+{
+	btree_hdr_t *hdr = &core->btc_hdr;
+	size_t size = tree->bt_elem_size;
+
+	if (hdr->bth_count == BTREE_CORE_ELEMS) {
+		uint32_t mid = BTREE_CORE_ELEMS / 2;
+		btree_hdr_t *right = btree_split(tree, hdr, mid);
+
+		if (off > mid) {
+			hdr = right;
+			off -= mid + 1;
+		}
+	}
+
+	memmove(BTREE_ELEM(tree, hdr, off + 1), BTREE_ELEM(tree, hdr, off),
+	    (hdr->bth_count - off) * size);
+	memmove(&BTREE_CHILDREN(hdr)[off + 2], &BTREE_CHILDREN(hdr)[off + 1],
+	    (hdr->bth_count - off) * sizeof (btree_hdr_t *));
+	bcopy(elem, BTREE_ELEM(tree, hdr, off), size);
+	BTREE_CHILDREN(hdr)[off + 1] = rchild;
+	rchild->bth_parent = (btree_core_t *)hdr;
+	hdr->bth_count++;
+}
+
+/*
+ * Insert value at the position returned by a failed btree_find().
+ * value must not point into the tree itself.
+ */
+void
+btree_insert(btree_t *tree, const void *value, const btree_index_t *where)
+{
+	btree_hdr_t *hdr = where->bti_node;
+	uint32_t off = where->bti_offset;
+	size_t size = tree->bt_elem_size;
+
+	if (hdr == NULL) {
+		ASSERT(tree->bt_root == NULL);
+		hdr = btree_node_alloc(tree, B_FALSE);
+		tree->bt_root = hdr;
+		tree->bt_height = 0;
+		off = 0;
+	}
+
+	ASSERT(where->bti_before);
+	ASSERT(!hdr->bth_core);
+	ASSERT3U(off, <=, hdr->bth_count);
+
+	if (hdr->bth_count == btree_leaf_cap(tree, hdr)) {
+		if (hdr == tree->bt_root &&
+		    tree->bt_root_size < BTREE_LEAF_SIZE) {
+			hdr = btree_root_resize(tree, tree->bt_root_size * 2);
+		} else {
+			uint32_t mid = tree->bt_leaf_cap / 2;
+			btree_hdr_t *right = btree_split(tree, hdr, mid);
+
+			if (off > mid) {
+				hdr = right;
+				off -= mid + 1;
+			}
+		}
+	}
+
+	memmove(BTREE_ELEM(tree, hdr, off + 1), BTREE_ELEM(tree, hdr, off),
+	    (hdr->bth_count - off) * size);
+	bcopy(value, BTREE_ELEM(tree, hdr, off), size);
+	hdr->bth_count++;
+	tree->bt_num_elems++;
+}
+
+void
+btree_add(btree_t *tree, const void *value)
+{
+	btree_index_t where;
+
+	VERIFY(btree_find(tree, value, &where) == NULL);
+	btree_insert(tree, value, &where);
+}
+
+static void btree_rebalance(btree_t *tree, btree_hdr_t *hdr);
+
+/*
+ * Merge child k + 1 of parent, and the separator between them, into
+ * child k.
+ */
+static void
+btree_merge(btree_t *tree, btree_core_t *parent, uint32_t k)
+{
+	btree_hdr_t *phdr = &parent->btc_hdr;
+	btree_hdr_t *left = parent->btc_children[k];
+	btree_hdr_t *right = parent->btc_children[k + 1];
+	uint32_t lcount = left->bth_count;
+	uint32_t rcount = right->bth_count;
+	size_t size = tree->bt_elem_size;
+	uint32_t i;
+
+	bcopy(BTREE_ELEM(tree, phdr, k), BTREE_ELEM(tree, left, lcount), size);
+	bcopy(BTREE_ELEM(tree, right, 0), BTREE_ELEM(tree, left, lcount + 1),
+	    rcount * size);
+	if (left->bth_core) {
+		bcopy(BTREE_CHILDREN(right), &BTREE_CHILDREN(left)[lcount + 1],
+		    (rcount + 1) * sizeof (btree_hdr_t *));
+		for (i = 0; i <= rcount; i++)
+			BTREE_CHILDREN(right)[i]->bth_parent =
+			    (btree_core_t *)left;
+	}
+	left->bth_count = lcount + 1 + rcount;
+	btree_node_free(tree, right);
+
+	memmove(BTREE_ELEM(tree, phdr, k), BTREE_ELEM(tree, phdr, k + 1),
+	    (phdr->bth_count - k - 1) * size);
+	memmove(&parent->btc_children[k + 1], &parent->btc_children[k + 2],
+	    (phdr->bth_count - k - 1) * sizeof (btree_hdr_t *));
+	phdr->bth_count--;
+
+	btree_rebalance(tree, phdr);
+}
+
+/*
+ * Restore the minimum fill of a node that just lost an element.
+ */
+static void
+btree_rebalance(btree_t *tree, btree_hdr_t *hdr)
+{
+	btree_core_t *parent = hdr->bth_parent;
+	btree_hdr_t *left, *right;
+	size_t size = tree->bt_elem_size;
+	uint32_t min, count, i;
+
+	if (parent == NULL) {
+		if (hdr->bth_core && hdr->bth_count == 0) {
+			/* The root only grew a parent at full size. */
+			ASSERT3U(tree->bt_root_size, ==, BTREE_LEAF_SIZE);
+			tree->bt_root = BTREE_CHILDREN(hdr)[0];
+			tree->bt_root->bth_parent = NULL;
+			tree->bt_height--;
+			btree_node_free(tree, hdr);
+		} else if (hdr->bth_count == 0) {
+			btree_node_free(tree, hdr);
+			tree->bt_root = NULL;
+			tree->bt_root_size = btree_root_min(tree);
+		} else if (!hdr->bth_core &&
+		    tree->bt_root_size > btree_root_min(tree) &&
+		    hdr->bth_count <=
+		    BTREE_LEAF_CAP(tree, tree->bt_root_size / 4)) {
+			(void) btree_root_resize(tree, tree->bt_root_size / 2);
+		}
+		return;
+	}
+
+	min = hdr->bth_core ? BTREE_CORE_MIN : BTREE_LEAF_MIN(tree);
+	count = hdr->bth_count;
+	if (count >= min)
+		return;
+
+	i = btree_child_index(parent, hdr);
+	left = (i > 0) ? parent->btc_children[i - 1] : NULL;
+	right = (i < parent->btc_hdr.bth_count) ?
+	    parent->btc_children[i + 1] : NULL;
+
+	if (left != NULL && left->bth_count > min) {
+		/*
+		 * Rotate right: the separator comes down into the front of
+		 * hdr and the left sibling's last element replaces it.
+		 */
+		uint32_t lcount = left->bth_count;
+
+		memmove(BTREE_ELEM(tree, hdr, 1), BTREE_ELEM(tree, hdr, 0),
+		    count * size);
+		bcopy(BTREE_ELEM(tree, &parent->btc_hdr, i - 1),
+		    BTREE_ELEM(tree, hdr, 0), size);
+		bcopy(BTREE_ELEM(tree, left, lcount - 1),
+		    BTREE_ELEM(tree, &parent->btc_hdr, i - 1), size);
+		if (hdr->bth_core) {
+			memmove(&BTREE_CHILDREN(hdr)[1],
+			    &BTREE_CHILDREN(hdr)[0],
+			    (count + 1) * sizeof (btree_hdr_t *));
+			BTREE_CHILDREN(hdr)[0] = BTREE_CHILDREN(left)[lcount];
+			BTREE_CHILDREN(hdr)[0]->bth_parent =
+			    (btree_core_t *)hdr;
+		}
+		left->bth_count--;
+		hdr->bth_count++;
+		return;
+	}
+
+	if (right != NULL && right->bth_count > min) {
+		/*
+		 * Rotate left: the separator comes down onto the end of hdr
+		 * and the right sibling's first element replaces it.
+		 */
+		uint32_t rcount = right->bth_count;
+
+		bcopy(BTREE_ELEM(tree, &parent->btc_hdr, i),
+		    BTREE_ELEM(tree, hdr, count), size);
+		bcopy(BTREE_ELEM(tree, right, 0),
+		    BTREE_ELEM(tree, &parent->btc_hdr, i), size);
+		memmove(BTREE_ELEM(tree, right, 0), BTREE_ELEM(tree, right, 1),
+		    (rcount - 1) * size);
+		if (hdr->bth_core) {
+			BTREE_CHILDREN(hdr)[count + 1] =
+			    BTREE_CHILDREN(right)[0];
+			BTREE_CHILDREN(hdr)[count + 1]->bth_parent =
+			    (btree_core_t *)hdr;
+			memmove(&BTREE_CHILDREN(right)[0],
+			    &BTREE_CHILDREN(right)[1],
+			    rcount * sizeof (btree_hdr_t *));
+		}
+		right->bth_count--;
+		hdr->bth_count++;
+		return;
+	}
+
+	btree_merge(tree, parent, (left != NULL) ? i - 1 : i);
+}
+
+/*
+ * Remove the element at where, which must refer to an element rather
+ * than a gap.
+ */
+void
+btree_remove_idx(btree_t *tree, btree_index_t *where)
+{
+	btree_hdr_t *hdr = where->bti_node;
+	uint32_t off = where->bti_offset;
+	size_t size = tree->bt_elem_size;
+
+	ASSERT(!where->bti_before);
+	ASSERT3U(off, <, hdr->bth_count);
+
+	if (hdr->bth_core) {
+		/*
+		 * Overwrite the element with its in-order predecessor, the
+		 * last element of the rightmost leaf of the left subtree,
+		 * and remove that from its leaf instead.
+		 */
+		btree_hdr_t *leaf = BTREE_CHILDREN(hdr)[off];
+
+		while (leaf->bth_core)
+			leaf = BTREE_CHILDREN(leaf)[leaf->bth_count];
+		bcopy(BTREE_ELEM(tree, leaf, leaf->bth_count - 1),
+		    BTREE_ELEM(tree, hdr, off), size);
+		hdr = leaf;
+		off = leaf->bth_count - 1;
+	}
+
+	memmove(BTREE_ELEM(tree, hdr, off), BTREE_ELEM(tree, hdr, off + 1),
+	    (hdr->bth_count - off - 1) * size);
+	hdr->bth_count--;
+	tree->bt_num_elems--;
+
+	btree_rebalance(tree, hdr);
+}
+
+void
+btree_remove(btree_t *tree, const void *value)
+{
+	btree_index_t where;
+
+	VERIFY(btree_find(tree, value, &where) != NULL);
+	btree_remove_idx(tree, &where);
+}
+
+static void *
+btree_first_under(btree_t *tree, btree_hdr_t *hdr, btree_index_t *out)
+{
+	while (hdr->bth_core)
+		hdr = BTREE_CHILDREN(hdr)[0];
+
+	out->bti_node = hdr;
+	out->bti_offset = 0;
+	out->bti_before = B_FALSE;
+
+	return (BTREE_ELEM(tree, hdr, 0));
+}
+
+static void *
+btree_last_under(btree_t *tree, btree_hdr_t *hdr, btree_index_t *out)
+{
+	while (hdr->bth_core)
+		hdr = BTREE_CHILDREN(hdr)[hdr->bth_count];
+
+	out->bti_node = hdr;
+	out->bti_offset = hdr->bth_count - 1;
+	out->bti_before = B_FALSE;
+
+	return (BTREE_ELEM(tree, hdr, hdr->bth_count - 1));
+}
+
+void *
+btree_first(btree_t *tree, btree_index_t *where)
+{
+	btree_index_t idx;
+
+	if (tree->bt_root == NULL)
+		return (NULL);
+
+	return (btree_first_under(tree, tree->bt_root,
+	    where != NULL ? where : &idx));
+}
+
+void *
+btree_last(btree_t *tree, btree_index_t *where)
+{
+	btree_index_t idx;
+
+	if (tree->bt_root == NULL)
+		return (NULL);
+
+	return (btree_last_under(tree, tree->bt_root,
+	    where != NULL ? where : &idx));
+}
+
+/*
+ * Return the element following idx, which may be a gap, and set *out to
+ * its position.  out may be the same as idx.
+ */
+void *
+btree_next(btree_t *tree, const btree_index_t *idx, btree_index_t *out)
+{
+	btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		ASSERT(!idx->bti_before);
+		return (btree_first_under(tree, BTREE_CHILDREN(hdr)[off + 1],
+		    out));
+	}
+
+	if (!idx->bti_before)
+		off++;
+	if (off < hdr->bth_count) {
+		out->bti_node = hdr;
+		out->bti_offset = off;
+		out->bti_before = B_FALSE;
+		return (BTREE_ELEM(tree, hdr, off));
+	}
+
+	/*
+	 * We've run off the end of a leaf.  The next element is the
+	 * separator after the first ancestor we're not the last child of.
+	 */
+	for (;;) {
+		btree_core_t *parent = hdr->bth_parent;
+		uint32_t i;
+
+		if (parent == NULL)
+			return (NULL);
+		i = btree_child_index(parent, hdr);
+		if (i < parent->btc_hdr.bth_count) {
+			out->bti_node = &parent->btc_hdr;
+			out->bti_offset = i;
+			out->bti_before = B_FALSE;
+			return (BTREE_ELEM(tree, &parent->btc_hdr, i));
+		}
+		hdr = &parent->btc_hdr;
+	}
+}
+
+/*
+ * Return the element preceding idx, which may be a gap, and set *out to
+ * its position.  out may be the same as idx.
+ */
+void *
+btree_prev(btree_t *tree, const btree_index_t *idx, btree_index_t *out)
+{
+	btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		ASSERT(!idx->bti_before);
+		return (btree_last_under(tree, BTREE_CHILDREN(hdr)[off], out));
+	}
+
+	if (off > 0) {
+		out->bti_node = hdr;
+		out->bti_offset = off - 1;
+		out->bti_before = B_FALSE;
+		return (BTREE_ELEM(tree, hdr, off - 1));
+	}
+
+	for (;;) {
+		btree_core_t *parent = hdr->bth_parent;
+		uint32_t i;
+
+		if (parent == NULL)
+			return (NULL);
+		i = btree_child_index(parent, hdr);
+		if (i > 0) {
+			out->bti_node = &parent->btc_hdr;
+			out->bti_offset = i - 1;
+			out->bti_before = B_FALSE;
+			return (BTREE_ELEM(tree, &parent->btc_hdr, i - 1));
+		}
+		hdr = &parent->btc_hdr;
+	}
+}
+
+void *
+btree_get(btree_t *tree, const btree_index_t *idx)
+{
+	ASSERT(!idx->bti_before);
+	ASSERT3U(idx->bti_offset, <, idx->bti_node->bth_count);
+	return (BTREE_ELEM(tree, idx->bti_node, idx->bti_offset));
+}
+
+ulong_t
+btree_numnodes(btree_t *tree)
+{
+	return (tree->bt_num_elems);
+}
+
+/*
+ * Return the number of bytes of memory used by the tree's nodes.
+ */
+size_t
+btree_memory(btree_t *tree)
+{
+	if (tree->bt_root != NULL && !tree->bt_root->bth_core)
+		return (tree->bt_root_size);
+
+	return (tree->bt_num_leaves * BTREE_LEAF_SIZE +
+	    tree->bt_num_cores * BTREE_CORE_SIZE(tree->bt_elem_size));
+}
+
+/*
+ * Check the tree's structural invariants, returning the number of
+ * elements below hdr.  lo and hi bound the elements from either side,
+ * or are NULL if there is no bound.
+ */
+static ulong_t
+btree_verify_node(btree_t *tree, btree_hdr_t *hdr, uint32_t depth,
+    const void *lo, const void *hi)
+{
+	ulong_t count = hdr->bth_count;
+	uint32_t i;
+
+	if (hdr != tree->bt_root) {
+		VERIFY3U(hdr->bth_count, >=, hdr->bth_core ?
+		    BTREE_CORE_MIN : BTREE_LEAF_MIN(tree));
+	}
+	VERIFY3U(hdr->bth_count, >, 0);
+	VERIFY3U(hdr->bth_count, <=, hdr->bth_core ?
+	    BTREE_CORE_ELEMS : btree_leaf_cap(tree, hdr));
+
+	for (i = 0; i < hdr->bth_count; i++) {
+		void *elem = BTREE_ELEM(tree, hdr, i);
+
+		if (i == 0 && lo != NULL)
+			VERIFY(tree->bt_compar(lo, elem) < 0);
+		if (i > 0) {
+			VERIFY(tree->bt_compar(BTREE_ELEM(tree, hdr, i - 1),
+			    elem) < 0);
+		}
+		if (i == hdr->bth_count - 1 && hi != NULL)
+			VERIFY(tree->bt_compar(elem, hi) < 0);
+	}
+
+	if (!hdr->bth_core) {
+		VERIFY3U(depth, ==, tree->bt_height);
+		return (count);
+	}
+
+	for (i = 0; i <= hdr->bth_count; i++) {
+		btree_hdr_t *child = BTREE_CHILDREN(hdr)[i];
+
+		VERIFY3P(child->bth_parent, ==, hdr);
+		count += btree_verify_node(tree, child, depth + 1,
+		    i == 0 ? lo : BTREE_ELEM(tree, hdr, i - 1),
+		    i == hdr->bth_count ? hi : BTREE_ELEM(tree, hdr, i));
+	}
+
+	return (count);
+}
+
+void
+btree_verify(btree_t *tree)
+{
+	if (tree->bt_root == NULL) {
+		VERIFY3U(tree->bt_num_elems, ==, 0);
+		return;
+	}
+
+	VERIFY3P(tree->bt_root->bth_parent, ==, NULL);
+	VERIFY(ISP2(tree->bt_root_size));
+	VERIFY3U(tree->bt_root_size, >=, btree_root_min(tree));
+	VERIFY3U(tree->bt_root_size, <=, BTREE_LEAF_SIZE);
+	if (tree->bt_root->bth_core)
+		VERIFY3U(tree->bt_root_size, ==, BTREE_LEAF_SIZE);
+	VERIFY3U(btree_verify_node(tree, tree->bt_root, 0, NULL, NULL), ==,
+	    tree->bt_num_elems);
+}
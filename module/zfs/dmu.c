@@ -1631,7 +1631,8 @@ dmu_sync_late_arrival(zio_t *pio, objset_t *os, dmu_sync_cb_t *done, zgd_t *zgd,
 	zio_nowait(zio_write(pio, os->os_spa, dmu_tx_get_txg(tx), zgd->zgd_bp,
 	    zgd->zgd_db->db_data, zgd->zgd_db->db_size, zp,
 	    dmu_sync_late_arrival_ready, dmu_sync_late_arrival_done, dsa,
-	    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL | ZIO_FLAG_FASTWRITE, zb));
+	    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL | ZIO_FLAG_FASTWRITE |
+	    ZIO_FLAG_SYNC_LATENCY, zb));
 
 	return (0);
 }
@@ -1755,7 +1756,8 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 	zio_nowait(arc_write(pio, os->os_spa, txg,
 	    bp, dr->dt.dl.dr_data, DBUF_IS_L2CACHEABLE(db), &zp,
 	    dmu_sync_ready, dmu_sync_done, dsa,
-	    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL | ZIO_FLAG_FASTWRITE, &zb));
+	    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL | ZIO_FLAG_FASTWRITE |
+	    ZIO_FLAG_SYNC_LATENCY, &zb));
 
 	return (0);
 }
@@ -1813,6 +1815,7 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	    (wp & WP_SPILL));
 	enum zio_checksum checksum = os->os_checksum;
 	enum zio_compress compress = os->os_compress;
+	struct zio_compress_auto *compress_auto = NULL;
 	enum zio_checksum dedup_checksum = os->os_dedup_checksum;
 	boolean_t dedup;
 	boolean_t dedup_verify = os->os_dedup_verify;
@@ -1848,6 +1851,9 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 		    ZIO_COMPRESS_LZJB;
 	} else {
 		compress = zio_compress_select(dn->dn_compress, compress);
+		if (dn->dn_compress == ZIO_COMPRESS_INHERIT &&
+		    os->os_compress_is_auto)
+			compress_auto = os->os_compress_auto;
 	}
 
 	/*
@@ -1870,16 +1876,19 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 		ASSERT(!ismd && level == 0);
 		checksum = ZIO_CHECKSUM_OFF;
 		compress = ZIO_COMPRESS_OFF;
+		compress_auto = NULL;
 		dedup = B_FALSE;
 	}
 
 	zp->zp_checksum = checksum;
 	zp->zp_compress = compress;
+	zp->zp_compress_auto = compress_auto;
 	zp->zp_type = (wp & WP_SPILL) ? dn->dn_bonustype : type;
 	zp->zp_level = level;
 	zp->zp_copies = MIN(copies + ismd, spa_max_replication(os->os_spa));
 	zp->zp_dedup = dedup;
 	zp->zp_dedup_verify = dedup && dedup_verify;
+	zp->zp_special_smallblk = ismd ? 0 : os->os_special_smallblk;
 }
 
 int
@@ -2004,12 +2013,12 @@ byteswap_uint64_array(void *vbuf, size_t size)
 {
 	uint64_t *buf = vbuf;
 	size_t count = size >> 3;
-	int i;
+	size_t i;
 
 	ASSERT((size & 7) == 0);
 
 	for (i = 0; i < count; i++)
-		buf[i] = BSWAP_64(buf[i]);
+		buf[i] = ZFS_BSWAP_64(buf[i]);
 }
 
 void
@@ -2017,12 +2026,12 @@ byteswap_uint32_array(void *vbuf, size_t size)
 {
 	uint32_t *buf = vbuf;
 	size_t count = size >> 2;
-	int i;
+	size_t i;
 
 	ASSERT((size & 3) == 0);
 
 	for (i = 0; i < count; i++)
-		buf[i] = BSWAP_32(buf[i]);
+		buf[i] = ZFS_BSWAP_32(buf[i]);
 }
 
 void
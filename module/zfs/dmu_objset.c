@@ -43,6 +43,7 @@
 #include <sys/zfs_ioctl.h>
 #include <sys/sa.h>
 #include <sys/zfs_onexit.h>
+#include <sys/zio_compress.h>
 
 /*
  * Needed to close a window in dnode_move() that allows the objset to be freed
@@ -146,7 +147,39 @@ compression_changed_cb(void *arg, uint64_t newval)
 	 */
 	ASSERT(newval != ZIO_COMPRESS_INHERIT);
 
-	os->os_compress = zio_compress_select(newval, ZIO_COMPRESS_ON_VALUE);
+	/*
+	 * With compression=auto, os_compress is only the fallback for
+	 * writes that don't go through zio_compress_auto_select().
+	 */
+	if (newval == ZIO_COMPRESS_AUTO) {
+		if (os->os_compress_auto == NULL) {
+			char name[KSTAT_STRLEN];
+
+			(void) snprintf(name, KSTAT_STRLEN, "compress-%s-%llu",
+			    spa_name(os->os_spa),
+			    (u_longlong_t)os->os_dsl_dataset->ds_object);
+			os->os_compress_auto = zio_compress_auto_create(name);
+			membar_producer();
+		}
+		os->os_compress_auto_retire_txg = 0;
+		os->os_compress = ZIO_COMPRESS_ON_VALUE;
+		os->os_compress_is_auto = B_TRUE;
+	} else {
+		os->os_compress = zio_compress_select(newval,
+		    ZIO_COMPRESS_ON_VALUE);
+		os->os_compress_is_auto = B_FALSE;
+
+		/*
+		 * Writes already handed the compression=auto state may
+		 * belong to any txg up to the open one, so it's freed by
+		 * dmu_objset_sync() once that txg has synced.
+		 */
+		if (os->os_compress_auto != NULL &&
+		    os->os_compress_auto_retire_txg == 0)
+			os->os_compress_auto_retire_txg =
+			    spa_last_synced_txg(os->os_spa) +
+			    TXG_CONCURRENT_STATES;
+	}
 }
 
 static void
@@ -181,6 +214,14 @@ dedup_changed_cb(void *arg, uint64_t newval)
 	os->os_dedup_verify = !!(checksum & ZIO_CHECKSUM_VERIFY);
 }
 
+static void
+special_small_blocks_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_special_smallblk = newval;
+}
+
 static void
 primary_cache_changed_cb(void *arg, uint64_t newval)
 {
@@ -348,8 +389,14 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 			if (err == 0)
 				err = dsl_prop_register(ds, "sync",
 				    sync_changed_cb, os);
+			if (err == 0)
+				err = dsl_prop_register(ds,
+				    "special_small_blocks",
+				    special_small_blocks_changed_cb, os);
 		}
 		if (err) {
+			if (os->os_compress_auto != NULL)
+				zio_compress_auto_destroy(os->os_compress_auto);
 			VERIFY(arc_buf_remove_ref(os->os_phys_buf,
 			    &os->os_phys_buf) == 1);
 			kmem_free(os, sizeof (objset_t));
@@ -364,6 +411,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		os->os_dedup_verify = 0;
 		os->os_logbias = 0;
 		os->os_sync = 0;
+		os->os_special_smallblk = 0;
 		os->os_primary_cache = ZFS_CACHE_ALL;
 		os->os_secondary_cache = ZFS_CACHE_ALL;
 	}
@@ -547,6 +595,9 @@ dmu_objset_evict(objset_t *os)
 			    logbias_changed_cb, os));
 			VERIFY(0 == dsl_prop_unregister(ds, "sync",
 			    sync_changed_cb, os));
+			VERIFY(0 == dsl_prop_unregister(ds,
+			    "special_small_blocks",
+			    special_small_blocks_changed_cb, os));
 		}
 		VERIFY(0 == dsl_prop_unregister(ds, "primarycache",
 		    primary_cache_changed_cb, os));
@@ -570,6 +621,9 @@ dmu_objset_evict(objset_t *os)
 	}
 	zil_free(os->os_zil);
 
+	if (os->os_compress_auto != NULL)
+		zio_compress_auto_destroy(os->os_compress_auto);
+
 	ASSERT3P(list_head(&os->os_dnodes), ==, NULL);
 
 	VERIFY(arc_buf_remove_ref(os->os_phys_buf, &os->os_phys_buf) == 1);
@@ -1113,6 +1167,13 @@ dmu_objset_sync(objset_t *os, zio_t *pio, dmu_tx_t *tx)
 		os->os_copies = spa_max_replication(os->os_spa);
 	}
 
+	if (os->os_compress_auto_retire_txg != 0 &&
+	    tx->tx_txg > os->os_compress_auto_retire_txg) {
+		zio_compress_auto_destroy(os->os_compress_auto);
+		os->os_compress_auto = NULL;
+		os->os_compress_auto_retire_txg = 0;
+	}
+
 	/*
 	 * Create the root block IO
 	 */
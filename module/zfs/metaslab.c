@@ -30,8 +30,7 @@
 #include <sys/metaslab_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
-
-#define WITH_DF_BLOCK_ALLOCATOR
+#include <sys/zfeature.h>
 
 /*
  * Allow allocations to switch to gang blocks quickly. We do this to
@@ -87,11 +86,140 @@ uint64_t metaslab_min_alloc_size = DMU_MAX_ACCESS;
  */
 int metaslab_prefetch_limit = SPA_DVAS_PER_BP;
 
+/*
+ * When enabled, the best few metaslabs of each group (up to
+ * metaslab_preload_limit) are loaded in the background on the group's
+ * taskq after every txg, instead of the space map being read
+ * synchronously by the first allocation that selects them.  When
+ * disabled, their space maps are merely prefetched.
+ */
+int metaslab_preload_enabled = B_TRUE;
+int metaslab_preload_limit = SPA_DVAS_PER_BP;
+
+/*
+ * Percentage of CPUs to run a metaslab group's preload taskq on.
+ */
+int metaslab_load_pct = 50;
+
+/*
+ * Number of txgs a loaded metaslab stays in core after it was last
+ * allocated from or preloaded, so that a metaslab which briefly falls
+ * out of use doesn't have to be read back in a moment later.
+ */
+int metaslab_unload_delay = TXG_SIZE * 2;
+
+/*
+ * Space maps are append-only logs, so a busy metaslab's map keeps
+ * growing even though the free space it describes doesn't.  Once a
+ * loaded metaslab's on-disk map is metaslab_condense_pct percent of the
+ * size needed to describe its in-core state, and at least
+ * metaslab_condense_block_threshold space map blocks long, it is
+ * rewritten from the in-core state.  The threshold keeps small maps,
+ * which load quickly anyway, from being rewritten every few txgs.
+ */
+int metaslab_condense_pct = 200;
+int metaslab_condense_block_threshold = 4;
+
+/*
+ * Allocation throttle.  An async write counts against its top-level
+ * vdev's allocation queue depth from the time its block is allocated
+ * until the write completes.  The rotor passes over vdevs with
+ * metaslab_alloc_max_queue_depth or more such writes outstanding, so a
+ * vdev that can't keep up stops collecting a backlog which holds up the
+ * whole txg sync.  When every vdev is over the limit it is ignored.
+ */
+int metaslab_alloc_throttle_enabled = B_TRUE;
+int metaslab_alloc_max_queue_depth = 100;
+
+typedef struct metaslab_stats {
+	kstat_named_t ms_loads;
+	kstat_named_t ms_load_time_ns;
+	kstat_named_t ms_preloads;
+	kstat_named_t ms_unloads;
+	kstat_named_t ms_alloc_load_waits;
+	kstat_named_t ms_alloc_load_wait_ns;
+	kstat_named_t ms_condenses;
+	kstat_named_t ms_condense_bytes_saved;
+	kstat_named_t ms_alloc_throttled;
+	kstat_named_t ms_syncs;
+	kstat_named_t ms_sync_time_ns;
+	kstat_named_t ms_sm_write_time_ns;
+	kstat_named_t ms_defer_time_ns;
+	kstat_named_t ms_max_free_skips;
+	kstat_named_t ms_group_max_free_skips;
+} metaslab_stats_t;
+
+static metaslab_stats_t metaslab_stats = {
+	{ "loads",			KSTAT_DATA_UINT64 },
+	{ "load_time_ns",		KSTAT_DATA_UINT64 },
+	{ "preloads",			KSTAT_DATA_UINT64 },
+	{ "unloads",			KSTAT_DATA_UINT64 },
+	{ "alloc_load_waits",		KSTAT_DATA_UINT64 },
+	{ "alloc_load_wait_ns",		KSTAT_DATA_UINT64 },
+	{ "condenses",			KSTAT_DATA_UINT64 },
+	{ "condense_bytes_saved",	KSTAT_DATA_UINT64 },
+	{ "alloc_throttled",		KSTAT_DATA_UINT64 },
+	{ "syncs",			KSTAT_DATA_UINT64 },
+	{ "sync_time_ns",		KSTAT_DATA_UINT64 },
+	{ "sm_write_time_ns",		KSTAT_DATA_UINT64 },
+	{ "defer_time_ns",		KSTAT_DATA_UINT64 },
+	{ "max_free_skips",		KSTAT_DATA_UINT64 },
+	{ "group_max_free_skips",	KSTAT_DATA_UINT64 },
+};
+
+#define	MSSTAT_INCR(stat, val) \
+	atomic_add_64(&metaslab_stats.stat.value.ui64, (val))
+#define	MSSTAT_BUMP(stat)	MSSTAT_INCR(stat, 1)
+
+static kstat_t *metaslab_ksp;
+
 /*
  * Percentage bonus multiplier for metaslabs that are in the bonus area.
  */
 int metaslab_smo_bonus_pct = 150;
 
+/*
+ * Scale each metaslab's weight down by its fragmentation, so that of two
+ * metaslabs with the same free space the one whose free space is in
+ * larger segments is preferred.
+ */
+int metaslab_fragmentation_factor_enabled = B_TRUE;
+
+/*
+ * Skip metaslabs, and whole groups, whose largest free segment is known
+ * to be smaller than the allocation, rather than loading their space
+ * maps only to find that out.
+ */
+int metaslab_max_free_enabled = B_TRUE;
+
+/*
+ * Fragmentation metric for each space map histogram bucket, starting
+ * with 512-byte segments.  A metaslab's fragmentation is the average of
+ * these values over its free space, so it is 0% when all free space is
+ * in segments of 16M or more and 100% when it is all in 512-1K slivers.
+ * The metric is never stored on disk and may be retuned freely.
+ */
+#define	FRAGMENTATION_TABLE_SIZE	16
+
+int zfs_frag_table[FRAGMENTATION_TABLE_SIZE] = {
+	100,	/* 512B	*/
+	100,	/* 1K	*/
+	98,	/* 2K	*/
+	95,	/* 4K	*/
+	90,	/* 8K	*/
+	80,	/* 16K	*/
+	70,	/* 32K	*/
+	60,	/* 64K	*/
+	50,	/* 128K	*/
+	40,	/* 256K	*/
+	30,	/* 512K	*/
+	20,	/* 1M	*/
+	15,	/* 2M	*/
+	10,	/* 4M	*/
+	5,	/* 8M	*/
+	0	/* 16M	*/
+};
+
 /*
  * ==========================================================================
  * Metaslab classes
@@ -112,6 +240,16 @@ metaslab_class_create(spa_t *spa, space_map_ops_t *ops)
 	return (mc);
 }
 
+/*
+ * Switch the class to a different block allocator.  Loaded metaslabs
+ * are converted the next time they're activated.
+ */
+void
+metaslab_class_set_ops(metaslab_class_t *mc, space_map_ops_t *ops)
+{
+	mc->mc_ops = ops;
+}
+
 void
 metaslab_class_destroy(metaslab_class_t *mc)
 {
@@ -185,6 +323,110 @@ metaslab_class_get_dspace(metaslab_class_t *mc)
 	return (spa_deflate(mc->mc_spa) ? mc->mc_dspace : mc->mc_space);
 }
 
+/*
+ * Return the largest free segment in any of the class's top-level vdevs.
+ */
+uint64_t
+metaslab_class_max_free(metaslab_class_t *mc)
+{
+	metaslab_group_t *mg;
+	uint64_t max_free = 0;
+
+	spa_config_enter(mc->mc_spa, SCL_ALLOC, FTAG, RW_READER);
+
+	if ((mg = mc->mc_rotor) != NULL) {
+		do {
+			max_free = MAX(max_free, mg->mg_max_free);
+		} while ((mg = mg->mg_next) != mc->mc_rotor);
+	}
+
+	spa_config_exit(mc->mc_spa, SCL_ALLOC, FTAG);
+
+	return (max_free);
+}
+
+/*
+ * Return the number of top-level vdevs the class is allocating from.
+ */
+uint64_t
+metaslab_class_groups(metaslab_class_t *mc)
+{
+	return (mc->mc_groups);
+}
+
+/*
+ * Track the latency of synchronous writes to each class's vdevs as a
+ * moving average over roughly the last 2^METASLAB_LAT_SHIFT writes.
+ * Updates may race with each other, which only costs the average a
+ * sample now and then.
+ */
+#define	METASLAB_LAT_SHIFT	3
+
+void
+metaslab_group_sync_write_done(metaslab_group_t *mg, hrtime_t delta)
+{
+	metaslab_class_t *mc = mg->mg_class;
+	uint64_t lat = mc->mc_sync_write_lat;
+
+	if (lat == 0)
+		lat = delta;
+	else
+		lat = lat - (lat >> METASLAB_LAT_SHIFT) +
+		    (delta >> METASLAB_LAT_SHIFT);
+	mc->mc_sync_write_lat = MAX(lat, 1);
+}
+
+/*
+ * Return the class's average synchronous write latency in nanoseconds,
+ * or zero if it hasn't done any.
+ */
+uint64_t
+metaslab_class_sync_write_lat(metaslab_class_t *mc)
+{
+	return (mc->mc_sync_write_lat);
+}
+
+/*
+ * Return the class's fragmentation: the average of its top-level vdevs'
+ * fragmentation, weighted by their size.
+ */
+uint64_t
+metaslab_class_fragmentation(metaslab_class_t *mc)
+{
+	metaslab_group_t *mg;
+	uint64_t fragmentation = 0;
+	uint64_t space = 0;
+
+	spa_config_enter(mc->mc_spa, SCL_ALLOC, FTAG, RW_READER);
+
+	if ((mg = mc->mc_rotor) != NULL) {
+		do {
+			vdev_t *vd = mg->mg_vd;
+			uint64_t mg_space = vd->vdev_ms_count <<
+			    vd->vdev_ms_shift;
+
+			if (mg->mg_fragmentation == ZFS_FRAG_INVALID) {
+				fragmentation = ZFS_FRAG_INVALID;
+				break;
+			}
+
+			fragmentation += mg->mg_fragmentation * mg_space;
+			space += mg_space;
+		} while ((mg = mg->mg_next) != mc->mc_rotor);
+	}
+
+	spa_config_exit(mc->mc_spa, SCL_ALLOC, FTAG);
+
+	if (fragmentation == ZFS_FRAG_INVALID)
+		return (ZFS_FRAG_INVALID);
+
+	if (space > 0)
+		fragmentation /= space;
+	ASSERT3U(fragmentation, <=, 100);
+
+	return (fragmentation);
+}
+
 /*
  * ==========================================================================
  * Metaslab groups
@@ -227,6 +469,9 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 	mg->mg_class = mc;
 	mg->mg_activation_count = 0;
 
+	mg->mg_taskq = taskq_create("metaslab_group_taskq", metaslab_load_pct,
+	    minclsyspri, 10, INT_MAX, TASKQ_THREADS_CPU_PCT | TASKQ_DYNAMIC);
+
 	return (mg);
 }
 
@@ -242,6 +487,7 @@ metaslab_group_destroy(metaslab_group_t *mg)
 	 */
 	ASSERT(mg->mg_activation_count <= 0);
 
+	taskq_destroy(mg->mg_taskq);
 	avl_destroy(&mg->mg_metaslab_tree);
 	mutex_destroy(&mg->mg_lock);
 	kmem_free(mg, sizeof (metaslab_group_t));
@@ -276,6 +522,7 @@ metaslab_group_activate(metaslab_group_t *mg)
 		mgnext->mg_prev = mg;
 	}
 	mc->mc_rotor = mg;
+	mc->mc_groups++;
 }
 
 void
@@ -286,6 +533,13 @@ metaslab_group_passivate(metaslab_group_t *mg)
 
 	ASSERT(spa_config_held(mc->mc_spa, SCL_ALLOC, RW_WRITER));
 
+	/*
+	 * Let any preloads finish before the group's metaslabs can be
+	 * torn down.  This is safe with SCL_ZIO held: a preload doesn't
+	 * read its space map while a config writer holds SCL_STATE.
+	 */
+	taskq_wait(mg->mg_taskq);
+
 	if (--mg->mg_activation_count != 0) {
 		ASSERT(mc->mc_rotor != mg);
 		ASSERT(mg->mg_prev == NULL);
@@ -307,6 +561,7 @@ metaslab_group_passivate(metaslab_group_t *mg)
 
 	mg->mg_prev = NULL;
 	mg->mg_next = NULL;
+	mc->mc_groups--;
 }
 
 static void
@@ -374,27 +629,24 @@ metaslab_segsize_compare(const void *x1, const void *x2)
 	return (0);
 }
 
-#if defined(WITH_FF_BLOCK_ALLOCATOR) || \
-    defined(WITH_DF_BLOCK_ALLOCATOR) || \
-    defined(WITH_CDF_BLOCK_ALLOCATOR)
 /*
  * This is a helper function that can be used by the allocator to find
- * a suitable block to allocate. This will search the specified AVL
- * tree looking for a block that matches the specified criteria.
+ * a suitable block to allocate. This will search the specified B-tree
+ * looking for a block that matches the specified criteria.
  */
 static uint64_t
-metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
+metaslab_block_picker(btree_t *t, uint64_t *cursor, uint64_t size,
     uint64_t align)
 {
 	space_seg_t *ss, ssearch;
-	avl_index_t where;
+	btree_index_t where;
 
 	ssearch.ss_start = *cursor;
 	ssearch.ss_end = *cursor + size;
 
-	ss = avl_find(t, &ssearch, &where);
+	ss = btree_find(t, &ssearch, &where);
 	if (ss == NULL)
-		ss = avl_nearest(t, where, AVL_AFTER);
+		ss = btree_next(t, &where, &where);
 
 	while (ss != NULL) {
 		uint64_t offset = P2ROUNDUP(ss->ss_start, align);
@@ -403,7 +655,7 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 			*cursor = offset + size;
 			return (offset);
 		}
-		ss = AVL_NEXT(t, ss);
+		ss = btree_next(t, &where, &where);
 	}
 
 	/*
@@ -416,38 +668,75 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 	*cursor = 0;
 	return (metaslab_block_picker(t, cursor, size, align));
 }
-#endif /* WITH_FF/DF/CDF_BLOCK_ALLOCATOR */
+
+/*
+ * Like metaslab_block_picker(), but only considers space between lo and
+ * hi, wrapping around to lo once if nothing is found past the cursor.
+ */
+static uint64_t
+metaslab_block_picker_range(btree_t *t, uint64_t *cursor, uint64_t size,
+    uint64_t align, uint64_t lo, uint64_t hi)
+{
+	space_seg_t *ss, ssearch;
+	btree_index_t where;
+	uint64_t first;
+
+	if (*cursor < lo || *cursor >= hi)
+		*cursor = lo;
+	first = *cursor;
+
+	ssearch.ss_start = *cursor;
+	ssearch.ss_end = *cursor + size;
+
+	ss = btree_find(t, &ssearch, &where);
+	if (ss == NULL)
+		ss = btree_next(t, &where, &where);
+
+	while (ss != NULL && ss->ss_start < hi) {
+		uint64_t offset = P2ROUNDUP(MAX(ss->ss_start, lo), align);
+
+		if (offset + size <= MIN(ss->ss_end, hi)) {
+			*cursor = offset + size;
+			return (offset);
+		}
+		ss = btree_next(t, &where, &where);
+	}
+
+	if (first == lo)
+		return (-1ULL);
+
+	*cursor = lo;
+	return (metaslab_block_picker_range(t, cursor, size, align, lo, hi));
+}
 
 static void
 metaslab_pp_load(space_map_t *sm)
 {
+	btree_t *t = &sm->sm_root;
+	btree_index_t where;
 	space_seg_t *ss;
 
 	ASSERT(sm->sm_ppd == NULL);
 	sm->sm_ppd = kmem_zalloc(64 * sizeof (uint64_t), KM_PUSHPAGE);
 
-	sm->sm_pp_root = kmem_alloc(sizeof (avl_tree_t), KM_PUSHPAGE);
-	avl_create(sm->sm_pp_root, metaslab_segsize_compare,
-	    sizeof (space_seg_t), offsetof(struct space_seg, ss_pp_node));
+	sm->sm_pp_root = kmem_alloc(sizeof (btree_t), KM_PUSHPAGE);
+	btree_create(sm->sm_pp_root, metaslab_segsize_compare,
+	    sizeof (space_seg_t));
 
-	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
-		avl_add(sm->sm_pp_root, ss);
+	for (ss = btree_first(t, &where); ss != NULL;
+	    ss = btree_next(t, &where, &where))
+		btree_add(sm->sm_pp_root, ss);
 }
 
 static void
 metaslab_pp_unload(space_map_t *sm)
 {
-	void *cookie = NULL;
-
 	kmem_free(sm->sm_ppd, 64 * sizeof (uint64_t));
 	sm->sm_ppd = NULL;
 
-	while (avl_destroy_nodes(sm->sm_pp_root, &cookie) != NULL) {
-		/* tear down the tree */
-	}
-
-	avl_destroy(sm->sm_pp_root);
-	kmem_free(sm->sm_pp_root, sizeof (avl_tree_t));
+	btree_clear(sm->sm_pp_root);
+	btree_destroy(sm->sm_pp_root);
+	kmem_free(sm->sm_pp_root, sizeof (btree_t));
 	sm->sm_pp_root = NULL;
 }
 
@@ -471,16 +760,15 @@ metaslab_pp_free(space_map_t *sm, uint64_t start, uint64_t size)
 uint64_t
 metaslab_pp_maxsize(space_map_t *sm)
 {
-	avl_tree_t *t = sm->sm_pp_root;
+	btree_t *t = sm->sm_pp_root;
 	space_seg_t *ss;
 
-	if (t == NULL || (ss = avl_last(t)) == NULL)
+	if (t == NULL || (ss = btree_last(t, NULL)) == NULL)
 		return (0ULL);
 
 	return (ss->ss_end - ss->ss_start);
 }
 
-#if defined(WITH_FF_BLOCK_ALLOCATOR)
 /*
  * ==========================================================================
  * The first-fit block allocator
@@ -489,7 +777,7 @@ metaslab_pp_maxsize(space_map_t *sm)
 static uint64_t
 metaslab_ff_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
+	btree_t *t = &sm->sm_root;
 	uint64_t align = size & -size;
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
 
@@ -497,7 +785,7 @@ metaslab_ff_alloc(space_map_t *sm, uint64_t size)
 }
 
 /* ARGSUSED */
-boolean_t
+static boolean_t
 metaslab_ff_fragmented(space_map_t *sm)
 {
 	return (B_TRUE);
@@ -513,10 +801,6 @@ static space_map_ops_t metaslab_ff_ops = {
 	metaslab_ff_fragmented
 };
 
-space_map_ops_t *zfs_metaslab_ops = &metaslab_ff_ops;
-#endif /* WITH_FF_BLOCK_ALLOCATOR */
-
-#if defined(WITH_DF_BLOCK_ALLOCATOR)
 /*
  * ==========================================================================
  * Dynamic block allocator -
@@ -528,21 +812,22 @@ space_map_ops_t *zfs_metaslab_ops = &metaslab_ff_ops;
 static uint64_t
 metaslab_df_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
+	btree_t *t = &sm->sm_root;
 	uint64_t align = size & -size;
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
 	uint64_t max_size = metaslab_pp_maxsize(sm);
 	int free_pct = sm->sm_space * 100 / sm->sm_size;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
-	ASSERT3U(avl_numnodes(&sm->sm_root), ==, avl_numnodes(sm->sm_pp_root));
+	ASSERT3U(btree_numnodes(&sm->sm_root), ==,
+	    btree_numnodes(sm->sm_pp_root));
 
 	if (max_size < size)
 		return (-1ULL);
 
 	/*
 	 * If we're running low on space switch to using the size
-	 * sorted AVL tree (best-fit).
+	 * sorted B-tree (best-fit).
 	 */
 	if (max_size < metaslab_df_alloc_threshold ||
 	    free_pct < metaslab_df_free_pct) {
@@ -576,19 +861,15 @@ static space_map_ops_t metaslab_df_ops = {
 	metaslab_df_fragmented
 };
 
-space_map_ops_t *zfs_metaslab_ops = &metaslab_df_ops;
-#endif /* WITH_DF_BLOCK_ALLOCATOR */
-
 /*
  * ==========================================================================
  * Other experimental allocators
  * ==========================================================================
  */
-#if defined(WITH_CDF_BLOCK_ALLOCATOR)
 static uint64_t
 metaslab_cdf_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
+	btree_t *t = &sm->sm_root;
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd;
 	uint64_t *extent_end = (uint64_t *)sm->sm_ppd + 1;
 	uint64_t max_size = metaslab_pp_maxsize(sm);
@@ -596,7 +877,8 @@ metaslab_cdf_alloc(space_map_t *sm, uint64_t size)
 	uint64_t offset = 0;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
-	ASSERT3U(avl_numnodes(&sm->sm_root), ==, avl_numnodes(sm->sm_pp_root));
+	ASSERT3U(btree_numnodes(&sm->sm_root), ==,
+	    btree_numnodes(sm->sm_pp_root));
 
 	if (max_size < size)
 		return (-1ULL);
@@ -605,7 +887,7 @@ metaslab_cdf_alloc(space_map_t *sm, uint64_t size)
 
 	/*
 	 * If we're running low on space switch to using the size
-	 * sorted AVL tree (best-fit).
+	 * sorted B-tree (best-fit).
 	 */
 	if ((*cursor + size) > *extent_end) {
 
@@ -644,24 +926,21 @@ static space_map_ops_t metaslab_cdf_ops = {
 	metaslab_cdf_fragmented
 };
 
-space_map_ops_t *zfs_metaslab_ops = &metaslab_cdf_ops;
-#endif /* WITH_CDF_BLOCK_ALLOCATOR */
-
-#if defined(WITH_NDF_BLOCK_ALLOCATOR)
 uint64_t metaslab_ndf_clump_shift = 4;
 
 static uint64_t
 metaslab_ndf_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
-	avl_index_t where;
+	btree_t *t = &sm->sm_root;
+	btree_index_t where;
 	space_seg_t *ss, ssearch;
 	uint64_t hbit = highbit(size);
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd + hbit - 1;
 	uint64_t max_size = metaslab_pp_maxsize(sm);
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
-	ASSERT3U(avl_numnodes(&sm->sm_root), ==, avl_numnodes(sm->sm_pp_root));
+	ASSERT3U(btree_numnodes(&sm->sm_root), ==,
+	    btree_numnodes(sm->sm_pp_root));
 
 	if (max_size < size)
 		return (-1ULL);
@@ -669,16 +948,16 @@ metaslab_ndf_alloc(space_map_t *sm, uint64_t size)
 	ssearch.ss_start = *cursor;
 	ssearch.ss_end = *cursor + size;
 
-	ss = avl_find(t, &ssearch, &where);
+	ss = btree_find(t, &ssearch, &where);
 	if (ss == NULL || (ss->ss_start + size > ss->ss_end)) {
 		t = sm->sm_pp_root;
 
 		ssearch.ss_start = 0;
 		ssearch.ss_end = MIN(max_size,
 		    1ULL << (hbit + metaslab_ndf_clump_shift));
-		ss = avl_find(t, &ssearch, &where);
+		ss = btree_find(t, &ssearch, &where);
 		if (ss == NULL)
-			ss = avl_nearest(t, where, AVL_AFTER);
+			ss = btree_next(t, &where, &where);
 		ASSERT(ss != NULL);
 	}
 
@@ -701,7 +980,6 @@ metaslab_ndf_fragmented(space_map_t *sm)
 	return (B_TRUE);
 }
 
-
 static space_map_ops_t metaslab_ndf_ops = {
 	metaslab_pp_load,
 	metaslab_pp_unload,
@@ -712,8 +990,93 @@ static space_map_ops_t metaslab_ndf_ops = {
 	metaslab_ndf_fragmented
 };
 
-space_map_ops_t *zfs_metaslab_ops = &metaslab_ndf_ops;
-#endif /* WITH_NDF_BLOCK_ALLOCATOR */
+/*
+ * ==========================================================================
+ * Segregated-fit block allocator -
+ * Keeps small blocks, which are mostly metadata, apart from large ones so
+ * that their churn doesn't chop up the free space large blocks need.  The
+ * last 1/2^metaslab_sf_region_shift of each metaslab is set aside for
+ * blocks of metaslab_sf_small_size or less, which are allocated first-fit
+ * within it, and larger blocks are allocated first-fit below it.  Once a
+ * block's own region is full it goes into the smallest free segment
+ * that will hold it, wherever that is.
+ * ==========================================================================
+ */
+uint64_t metaslab_sf_small_size = SPA_MINBLOCKSIZE << 5;
+int metaslab_sf_region_shift = 3;
+
+static uint64_t
+metaslab_sf_alloc(space_map_t *sm, uint64_t size)
+{
+	btree_t *t = &sm->sm_root;
+	btree_index_t where;
+	space_seg_t *ss, ssearch;
+	uint64_t align = size & -size;
+	uint64_t end = sm->sm_start + sm->sm_size;
+	uint64_t split = end - (sm->sm_size >> metaslab_sf_region_shift);
+	uint64_t max_size = metaslab_pp_maxsize(sm);
+	uint64_t *cursor;
+	uint64_t offset;
+
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+	ASSERT3U(btree_numnodes(&sm->sm_root), ==,
+	    btree_numnodes(sm->sm_pp_root));
+
+	if (max_size < size)
+		return (-1ULL);
+
+	/*
+	 * Allocation sizes are multiples of SPA_MINBLOCKSIZE, so cursor
+	 * slot 0 is never used for an alignment and is free for the
+	 * small block region.
+	 */
+	if (size <= metaslab_sf_small_size) {
+		cursor = (uint64_t *)sm->sm_ppd;
+		offset = metaslab_block_picker_range(t, cursor, size, align,
+		    split, end);
+	} else {
+		cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
+		offset = metaslab_block_picker_range(t, cursor, size, align,
+		    sm->sm_start, split);
+	}
+	if (offset != -1ULL)
+		return (offset);
+
+	ssearch.ss_start = 0;
+	ssearch.ss_end = size;
+
+	t = sm->sm_pp_root;
+	ss = btree_find(t, &ssearch, &where);
+	if (ss == NULL)
+		ss = btree_next(t, &where, &where);
+	ASSERT(ss != NULL);
+
+	return (ss->ss_start);
+}
+
+static space_map_ops_t metaslab_sf_ops = {
+	metaslab_pp_load,
+	metaslab_pp_unload,
+	metaslab_sf_alloc,
+	metaslab_pp_claim,
+	metaslab_pp_free,
+	metaslab_pp_maxsize,
+	metaslab_df_fragmented
+};
+
+/*
+ * Block allocators, indexed by the value of the pool's "allocator"
+ * property.  zfs_metaslab_ops is used where there is no pool to ask.
+ */
+space_map_ops_t *metaslab_ops_table[ZPOOL_NUM_ALLOCATORS] = {
+	&metaslab_df_ops,	/* ZPOOL_ALLOCATOR_DF */
+	&metaslab_ff_ops,	/* ZPOOL_ALLOCATOR_FF */
+	&metaslab_cdf_ops,	/* ZPOOL_ALLOCATOR_CDF */
+	&metaslab_ndf_ops,	/* ZPOOL_ALLOCATOR_NDF */
+	&metaslab_sf_ops	/* ZPOOL_ALLOCATOR_SF */
+};
+
+space_map_ops_t *zfs_metaslab_ops = &metaslab_df_ops;
 
 /*
  * ==========================================================================
@@ -722,15 +1085,24 @@ space_map_ops_t *zfs_metaslab_ops = &metaslab_ndf_ops;
  */
 metaslab_t *
 metaslab_init(metaslab_group_t *mg, space_map_obj_t *smo,
-	uint64_t start, uint64_t size, uint64_t txg)
+	space_map_histogram_t *smh, uint64_t start, uint64_t size, uint64_t txg)
 {
 	vdev_t *vd = mg->mg_vd;
 	metaslab_t *msp;
+	int t;
 
 	msp = kmem_zalloc(sizeof (metaslab_t), KM_PUSHPAGE);
 	mutex_init(&msp->ms_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	msp->ms_smo_syncing = *smo;
+	msp->ms_smh_syncing = *smh;
+
+	for (t = 0; t < TXG_SIZE; t++)
+		msp->ms_freemap[t] = kmem_zalloc(sizeof (space_map_t),
+		    KM_PUSHPAGE);
+	for (t = 0; t < TXG_DEFER_SIZE; t++)
+		msp->ms_defermap[t] = kmem_zalloc(sizeof (space_map_t),
+		    KM_PUSHPAGE);
 
 	/*
 	 * We create the main space map here, but we don't create the
@@ -786,11 +1158,14 @@ metaslab_fini(metaslab_t *msp)
 
 	for (t = 0; t < TXG_SIZE; t++) {
 		space_map_destroy(&msp->ms_allocmap[t]);
-		space_map_destroy(&msp->ms_freemap[t]);
+		space_map_destroy(msp->ms_freemap[t]);
+		kmem_free(msp->ms_freemap[t], sizeof (space_map_t));
 	}
 
-	for (t = 0; t < TXG_DEFER_SIZE; t++)
-		space_map_destroy(&msp->ms_defermap[t]);
+	for (t = 0; t < TXG_DEFER_SIZE; t++) {
+		space_map_destroy(msp->ms_defermap[t]);
+		kmem_free(msp->ms_defermap[t], sizeof (space_map_t));
+	}
 
 	ASSERT3S(msp->ms_deferspace, ==, 0);
 
@@ -805,6 +1180,79 @@ metaslab_fini(metaslab_t *msp)
 #define	METASLAB_ACTIVE_MASK		\
 	(METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY)
 
+/*
+ * Compute the metaslab's fragmentation from its synced space map
+ * histogram by weighting each bucket's zfs_frag_table[] value by the
+ * free space in that bucket.
+ */
+static uint64_t
+metaslab_fragmentation(metaslab_t *msp)
+{
+	space_map_obj_t *smo = &msp->ms_smo;
+	space_map_histogram_t *smh = &msp->ms_smh;
+	uint8_t shift = msp->ms_map.sm_shift;
+	uint64_t fragmentation = 0;
+	uint64_t total = 0;
+	int i;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	/*
+	 * A metaslab that has never been written to is a single free
+	 * segment, and one that is completely full has no free space
+	 * to be fragmented.
+	 */
+	if (smo->smo_object == 0 || smo->smo_alloc == msp->ms_map.sm_size)
+		return (0);
+
+	if (!space_map_histogram_valid(smo, smh))
+		return (ZFS_FRAG_INVALID);
+
+	for (i = 0; i < SPACE_MAP_HISTOGRAM_SIZE; i++) {
+		uint64_t space;
+		int idx;
+
+		if (smh->smh_histogram[i] == 0)
+			continue;
+
+		space = smh->smh_histogram[i] << (i + shift);
+		idx = MIN(shift - SPA_MINBLOCKSHIFT + i,
+		    FRAGMENTATION_TABLE_SIZE - 1);
+		fragmentation += space * zfs_frag_table[idx];
+		total += space;
+	}
+
+	if (total > 0)
+		fragmentation /= total;
+	ASSERT3U(fragmentation, <=, 100);
+
+	return (fragmentation);
+}
+
+/*
+ * Estimate the largest free segment in the metaslab.  It's exact while
+ * the map is loaded; otherwise it comes from the synced space map.  If
+ * that has no trustworthy histogram we know nothing, and assume all the
+ * free space is in one piece so that the metaslab isn't passed over.
+ */
+static uint64_t
+metaslab_max_free(metaslab_t *msp)
+{
+	space_map_t *sm = &msp->ms_map;
+	space_map_obj_t *smo = &msp->ms_smo;
+	space_map_histogram_t *smh = &msp->ms_smh;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (sm->sm_loaded)
+		return (space_map_maxsize(sm));
+
+	if (smo->smo_object == 0 || !space_map_histogram_valid(smo, smh))
+		return (sm->sm_size - smo->smo_alloc);
+
+	return (space_map_max_free(smo, smh, sm->sm_shift));
+}
+
 static uint64_t
 metaslab_weight(metaslab_t *msp)
 {
@@ -844,6 +1292,22 @@ metaslab_weight(metaslab_t *msp)
 	ASSERT(weight >= space &&
 	    weight <= 2 * (metaslab_smo_bonus_pct / 100) * space);
 
+	/*
+	 * Scale by fragmentation so that unloaded metaslabs whose free
+	 * space is mostly small segments don't win over ones we can
+	 * actually allocate large blocks from.  An unfragmented metaslab
+	 * gets a small boost, and the result never drops below the
+	 * smallest possible allocation while there is space left.
+	 */
+	msp->ms_fragmentation = metaslab_fragmentation(msp);
+	msp->ms_max_free = metaslab_max_free(msp);
+	if (metaslab_fragmentation_factor_enabled &&
+	    msp->ms_fragmentation != ZFS_FRAG_INVALID) {
+		weight = (weight * (101 - msp->ms_fragmentation)) / 100;
+		if (weight > 0 && weight < SPA_MINBLOCKSIZE)
+			weight = SPA_MINBLOCKSIZE;
+	}
+
 	if (sm->sm_loaded && !sm->sm_ops->smop_fragmented(sm)) {
 		/*
 		 * If this metaslab is one we're actively using, adjust its
@@ -886,30 +1350,66 @@ metaslab_prefetch(metaslab_group_t *mg)
 	mutex_exit(&mg->mg_lock);
 }
 
+/*
+ * Load the metaslab's space map, waiting for any load already in
+ * progress, and remove the deferred frees from it.
+ */
+static int
+metaslab_load(metaslab_t *msp)
+{
+	space_map_t *sm = &msp->ms_map;
+	space_map_ops_t *sm_ops = msp->ms_group->mg_class->mc_ops;
+	hrtime_t start;
+	int error, t;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	space_map_load_wait(sm);
+	if (sm->sm_loaded)
+		return (0);
+
+	start = gethrtime();
+	error = space_map_load(sm, sm_ops, SM_FREE, &msp->ms_smo,
+	    spa_meta_objset(msp->ms_group->mg_vd->vdev_spa));
+	if (error != 0)
+		return (error);
+
+	for (t = 0; t < TXG_DEFER_SIZE; t++)
+		space_map_walk(msp->ms_defermap[t], space_map_claim, sm);
+
+	msp->ms_max_free = space_map_maxsize(sm);
+
+	MSSTAT_BUMP(ms_loads);
+	MSSTAT_INCR(ms_load_time_ns, gethrtime() - start);
+
+	return (0);
+}
+
 static int
 metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
 {
 	metaslab_group_t *mg = msp->ms_group;
 	space_map_t *sm = &msp->ms_map;
-	space_map_ops_t *sm_ops = msp->ms_group->mg_class->mc_ops;
-	int t;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
 	if ((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
-		space_map_load_wait(sm);
 		if (!sm->sm_loaded) {
-			int error = space_map_load(sm, sm_ops, SM_FREE,
-			    &msp->ms_smo,
-			    spa_meta_objset(msp->ms_group->mg_vd->vdev_spa));
+			hrtime_t start = gethrtime();
+			int error = metaslab_load(msp);
+
+			/*
+			 * Whether we read the map ourselves or waited for
+			 * a preload that hadn't finished yet, this
+			 * allocation stalled on space map I/O.
+			 */
+			MSSTAT_BUMP(ms_alloc_load_waits);
+			MSSTAT_INCR(ms_alloc_load_wait_ns, gethrtime() - start);
+
 			if (error)  {
 				metaslab_group_sort(msp->ms_group, msp, 0);
 				return (error);
 			}
-			for (t = 0; t < TXG_DEFER_SIZE; t++)
-				space_map_walk(&msp->ms_defermap[t],
-				    space_map_claim, sm);
-
 		}
 
 		/*
@@ -927,6 +1427,8 @@ metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
 	ASSERT(sm->sm_loaded);
 	ASSERT(msp->ms_weight & METASLAB_ACTIVE_MASK);
 
+	space_map_set_ops(sm, mg->mg_class->mc_ops);
+
 	return (0);
 }
 
@@ -943,6 +1445,66 @@ metaslab_passivate(metaslab_t *msp, uint64_t size)
 	ASSERT((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0);
 }
 
+/*
+ * Decide whether a metaslab's on-disk space map should be rewritten from
+ * its in-core state.  A condensed map holds about one entry per in-core
+ * segment, which is the optimal size we compare against.
+ */
+static boolean_t
+metaslab_should_condense(metaslab_t *msp)
+{
+	space_map_t *sm = &msp->ms_map;
+	space_map_obj_t *smo = &msp->ms_smo_syncing;
+	uint64_t optimal_size;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!sm->sm_loaded)
+		return (B_FALSE);
+
+	optimal_size = (btree_numnodes(&sm->sm_root) + 1) * sizeof (uint64_t);
+
+	if (smo->smo_objsize < (uint64_t)metaslab_condense_block_threshold <<
+	    SPACE_MAP_BLOCKSHIFT)
+		return (B_FALSE);
+
+	return (smo->smo_objsize * 100 >= optimal_size * metaslab_condense_pct);
+}
+
+/*
+ * Allocate a space map object for the metaslab and record it in the
+ * vdev's metaslab array.  With the spacemap_free_histogram feature
+ * enabled, its bonus buffer has room for the free segment histogram.
+ */
+static void
+metaslab_smo_alloc(metaslab_t *msp, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa_meta_objset(spa);
+	zfeature_info_t *hist_feat =
+	    &spa_feature_table[SPA_FEATURE_SPACEMAP_FREE_HISTOGRAM];
+	space_map_obj_t *smo = &msp->ms_smo_syncing;
+	int bonuslen = SPACE_MAP_SIZE_V0;
+
+	ASSERT(smo->smo_object == 0);
+	ASSERT(smo->smo_objsize == 0);
+	ASSERT(smo->smo_alloc == 0);
+
+	if (spa_feature_is_enabled(spa, hist_feat)) {
+		spa_feature_incr(spa, hist_feat, tx);
+		bonuslen = SPACE_MAP_SIZE_V1;
+	}
+
+	smo->smo_object = dmu_object_alloc(mos,
+	    DMU_OT_SPACE_MAP, 1 << SPACE_MAP_BLOCKSHIFT,
+	    DMU_OT_SPACE_MAP_HEADER, bonuslen, tx);
+	ASSERT(smo->smo_object != 0);
+	dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) *
+	    (msp->ms_map.sm_start >> vd->vdev_ms_shift),
+	    sizeof (uint64_t), &smo->smo_object, tx);
+}
+
 /*
  * Write a metaslab to disk in the context of the specified transaction group.
  */
@@ -953,12 +1515,19 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	spa_t *spa = vd->vdev_spa;
 	objset_t *mos = spa_meta_objset(spa);
 	space_map_t *allocmap = &msp->ms_allocmap[txg & TXG_MASK];
-	space_map_t *freemap = &msp->ms_freemap[txg & TXG_MASK];
-	space_map_t *freed_map = &msp->ms_freemap[TXG_CLEAN(txg) & TXG_MASK];
+	space_map_t *freemap = msp->ms_freemap[txg & TXG_MASK];
+	space_map_t *freed_map = msp->ms_freemap[TXG_CLEAN(txg) & TXG_MASK];
 	space_map_t *sm = &msp->ms_map;
 	space_map_obj_t *smo = &msp->ms_smo_syncing;
+	space_map_histogram_t *smh = &msp->ms_smh_syncing;
+	zfeature_info_t *hist_feat =
+	    &spa_feature_table[SPA_FEATURE_SPACEMAP_FREE_HISTOGRAM];
+	dmu_object_info_t doi;
 	dmu_buf_t *db;
 	dmu_tx_t *tx;
+	uint64_t condensed_from = 0;
+	hrtime_t start, write_start;
+	boolean_t hist_valid;
 	int t;
 
 	ASSERT(!vd->vdev_ishole);
@@ -966,6 +1535,8 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	if (allocmap->sm_space == 0 && freemap->sm_space == 0)
 		return;
 
+	start = gethrtime();
+
 	/*
 	 * The only state that can actually be changing concurrently with
 	 * metaslab_sync() is the metaslab's ms_map.  No other thread can
@@ -977,28 +1548,18 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	tx = dmu_tx_create_assigned(spa_get_dsl(spa), txg);
 
-	if (smo->smo_object == 0) {
-		ASSERT(smo->smo_objsize == 0);
-		ASSERT(smo->smo_alloc == 0);
-		smo->smo_object = dmu_object_alloc(mos,
-		    DMU_OT_SPACE_MAP, 1 << SPACE_MAP_BLOCKSHIFT,
-		    DMU_OT_SPACE_MAP_HEADER, sizeof (*smo), tx);
-		ASSERT(smo->smo_object != 0);
-		dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) *
-		    (sm->sm_start >> vd->vdev_ms_shift),
-		    sizeof (uint64_t), &smo->smo_object, tx);
-	}
+	if (smo->smo_object == 0)
+		metaslab_smo_alloc(msp, tx);
 
 	mutex_enter(&msp->ms_lock);
 
 	space_map_walk(freemap, space_map_add, freed_map);
 
-	if (sm->sm_loaded && spa_sync_pass(spa) == 1 && smo->smo_objsize >=
-	    2 * sizeof (uint64_t) * avl_numnodes(&sm->sm_root)) {
+	if (spa_sync_pass(spa) == 1 && metaslab_should_condense(msp)) {
 		/*
-		 * The in-core space map representation is twice as compact
-		 * as the on-disk one, so it's time to condense the latter
-		 * by generating a pure allocmap from first principles.
+		 * The on-disk map has grown well past what it takes to
+		 * describe the in-core one, so condense it by generating
+		 * a pure allocmap from first principles.
 		 *
 		 * This metaslab is 100% allocated,
 		 * minus the content of the in-core map (sm),
@@ -1016,30 +1577,99 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		space_map_walk(freed_map, space_map_remove, allocmap);
 
 		for (t = 0; t < TXG_DEFER_SIZE; t++)
-			space_map_walk(&msp->ms_defermap[t],
+			space_map_walk(msp->ms_defermap[t],
 			    space_map_remove, allocmap);
 
 		for (t = 1; t < TXG_CONCURRENT_STATES; t++)
 			space_map_walk(&msp->ms_allocmap[(txg + t) & TXG_MASK],
 			    space_map_remove, allocmap);
 
+		condensed_from = smo->smo_objsize;
+
+		/*
+		 * Since the whole map is being rewritten anyway, move a
+		 * map whose bonus buffer predates the histogram feature
+		 * to a new object that can hold one.
+		 */
 		mutex_exit(&msp->ms_lock);
-		space_map_truncate(smo, mos, tx);
+		VERIFY(0 == dmu_object_info(mos, smo->smo_object, &doi));
+		if (doi.doi_bonus_size < SPACE_MAP_SIZE_V1 &&
+		    spa_feature_is_enabled(spa, hist_feat)) {
+			VERIFY(0 == dmu_object_free(mos, smo->smo_object, tx));
+			smo->smo_object = 0;
+			smo->smo_objsize = 0;
+			smo->smo_alloc = 0;
+			metaslab_smo_alloc(msp, tx);
+		} else {
+			space_map_truncate(smo, mos, tx);
+		}
 		mutex_enter(&msp->ms_lock);
 	}
 
+	/*
+	 * Freed segments are added to the histogram as they are written.
+	 * They may really coalesce with existing free space, but the map
+	 * needn't be loaded to tell; the next owner to load the map and
+	 * rebuild the histogram corrects the approximation.  Allocations
+	 * only ever come from loaded maps, whose histogram is rebuilt
+	 * below.
+	 */
+	hist_valid = space_map_histogram_valid(smo, smh);
+	if (hist_valid)
+		space_map_histogram_add(freemap, smh);
+
+	write_start = gethrtime();
 	space_map_sync(allocmap, SM_ALLOC, smo, mos, tx);
 	space_map_sync(freemap, SM_FREE, smo, mos, tx);
+	MSSTAT_INCR(ms_sm_write_time_ns, gethrtime() - write_start);
+
+	if (condensed_from != 0) {
+		MSSTAT_BUMP(ms_condenses);
+		if (condensed_from > smo->smo_objsize) {
+			MSSTAT_INCR(ms_condense_bytes_saved,
+			    condensed_from - smo->smo_objsize);
+		}
+	}
+
+	if (sm->sm_loaded) {
+		/*
+		 * With the map loaded, rebuild the histogram from the
+		 * in-core histograms of everything free in core, this
+		 * txg's frees and the deferred frees, all of which will
+		 * be allocatable again shortly.  That's a sum over the
+		 * buckets, not a walk of the maps.  Free and deferred
+		 * segments are counted apart from any free space they'll
+		 * coalesce with, as for frees to a map that isn't loaded.
+		 */
+		space_map_histogram_clear(smh);
+		space_map_histogram_add(sm, smh);
+		space_map_histogram_add(freed_map, smh);
+		for (t = 0; t < TXG_DEFER_SIZE; t++)
+			space_map_histogram_add(msp->ms_defermap[t], smh);
+		space_map_histogram_stamp(smo, smh);
+	} else if (hist_valid) {
+		space_map_histogram_stamp(smo, smh);
+	}
 
 	mutex_exit(&msp->ms_lock);
 
+	/*
+	 * Only maps whose bonus buffer was sized for it get a copy of the
+	 * histogram; the rest keep theirs in core.
+	 */
 	VERIFY(0 == dmu_bonus_hold(mos, smo->smo_object, FTAG, &db));
 	dmu_buf_will_dirty(db, tx);
-	ASSERT3U(db->db_size, >=, sizeof (*smo));
-	bcopy(smo, db->db_data, sizeof (*smo));
+	dmu_object_info_from_db(db, &doi);
+	ASSERT3U(doi.doi_bonus_size, >=, SPACE_MAP_SIZE_V0);
+	bcopy(smo, db->db_data, SPACE_MAP_SIZE_V0);
+	if (doi.doi_bonus_size >= SPACE_MAP_SIZE_V1)
+		bcopy(smh, (space_map_obj_t *)db->db_data + 1, sizeof (*smh));
 	dmu_buf_rele(db, FTAG);
 
 	dmu_tx_commit(tx);
+
+	MSSTAT_BUMP(ms_syncs);
+	MSSTAT_INCR(ms_sync_time_ns, gethrtime() - start);
 }
 
 /*
@@ -1051,12 +1681,15 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 {
 	space_map_obj_t *smo = &msp->ms_smo;
 	space_map_obj_t *smosync = &msp->ms_smo_syncing;
+	space_map_histogram_t *smh = &msp->ms_smh;
+	space_map_histogram_t *smhsync = &msp->ms_smh_syncing;
 	space_map_t *sm = &msp->ms_map;
-	space_map_t *freed_map = &msp->ms_freemap[TXG_CLEAN(txg) & TXG_MASK];
-	space_map_t *defer_map = &msp->ms_defermap[txg % TXG_DEFER_SIZE];
+	space_map_t *freed_map = msp->ms_freemap[TXG_CLEAN(txg) & TXG_MASK];
+	space_map_t *defer_map = msp->ms_defermap[txg % TXG_DEFER_SIZE];
 	metaslab_group_t *mg = msp->ms_group;
 	vdev_t *vd = mg->mg_vd;
 	int64_t alloc_delta, defer_delta;
+	hrtime_t start;
 	int t;
 
 	ASSERT(!vd->vdev_ishole);
@@ -1071,12 +1704,12 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 		for (t = 0; t < TXG_SIZE; t++) {
 			space_map_create(&msp->ms_allocmap[t], sm->sm_start,
 			    sm->sm_size, sm->sm_shift, sm->sm_lock);
-			space_map_create(&msp->ms_freemap[t], sm->sm_start,
+			space_map_create(msp->ms_freemap[t], sm->sm_start,
 			    sm->sm_size, sm->sm_shift, sm->sm_lock);
 		}
 
 		for (t = 0; t < TXG_DEFER_SIZE; t++)
-			space_map_create(&msp->ms_defermap[t], sm->sm_start,
+			space_map_create(msp->ms_defermap[t], sm->sm_start,
 			    sm->sm_size, sm->sm_shift, sm->sm_lock);
 
 		vdev_space_update(vd, 0, 0, sm->sm_size);
@@ -1088,19 +1721,26 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	vdev_space_update(vd, alloc_delta + defer_delta, defer_delta, 0);
 
 	ASSERT(msp->ms_allocmap[txg & TXG_MASK].sm_space == 0);
-	ASSERT(msp->ms_freemap[txg & TXG_MASK].sm_space == 0);
+	ASSERT(msp->ms_freemap[txg & TXG_MASK]->sm_space == 0);
 
 	/*
 	 * If there's a space_map_load() in progress, wait for it to complete
 	 * so that we have a consistent view of the in-core space map.
-	 * Then, add defer_map (oldest deferred frees) to this map and
-	 * transfer freed_map (this txg's frees) to defer_map.
+	 * Then, add defer_map (oldest deferred frees) to this map, make
+	 * freed_map (this txg's frees) the newest defer_map, and hand the
+	 * now empty defer_map to the freemap slot freed_map came from.
+	 * No freemap can be using that slot yet: it belongs to txg + 3,
+	 * which won't open until this txg is done.
 	 */
+	start = gethrtime();
 	space_map_load_wait(sm);
 	space_map_vacate(defer_map, sm->sm_loaded ? space_map_free : NULL, sm);
-	space_map_vacate(freed_map, space_map_add, defer_map);
+	msp->ms_defermap[txg % TXG_DEFER_SIZE] = freed_map;
+	msp->ms_freemap[TXG_CLEAN(txg) & TXG_MASK] = defer_map;
+	MSSTAT_INCR(ms_defer_time_ns, gethrtime() - start);
 
 	*smo = *smosync;
+	*smh = *smhsync;
 
 	msp->ms_deferspace += defer_delta;
 	ASSERT3S(msp->ms_deferspace, >=, 0);
@@ -1117,6 +1757,8 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * If the map is loaded but no longer active, evict it as soon as all
 	 * future allocations have synced.  (If we unloaded it now and then
 	 * loaded a moment later, the map wouldn't reflect those allocations.)
+	 * Maps that were used or preloaded recently are kept until
+	 * ms_access_txg has passed.
 	 */
 	if (sm->sm_loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
 		int evictable = 1;
@@ -1125,8 +1767,11 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 			if (msp->ms_allocmap[(txg + t) & TXG_MASK].sm_space)
 				evictable = 0;
 
-		if (evictable && !metaslab_debug)
+		if (evictable && !metaslab_debug &&
+		    txg > msp->ms_access_txg) {
 			space_map_unload(sm);
+			MSSTAT_BUMP(ms_unloads);
+		}
 	}
 
 	metaslab_group_sort(mg, msp, metaslab_weight(msp));
@@ -1134,6 +1779,176 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	mutex_exit(&msp->ms_lock);
 }
 
+/*
+ * The group's largest free segment is the largest of its metaslabs'.
+ * Those are only estimates for metaslabs whose maps aren't loaded, so
+ * to decide whether the whole group can be skipped we also keep a bound
+ * that no free segment can exceed: the exact value for loaded maps, and
+ * all of the free space for the rest.
+ */
+static void
+metaslab_group_max_free_update(metaslab_group_t *mg)
+{
+	vdev_t *vd = mg->mg_vd;
+	uint64_t max_free = 0;
+	uint64_t bound = 0;
+	int m;
+
+	for (m = 0; m < vd->vdev_ms_count; m++) {
+		metaslab_t *msp = vd->vdev_ms[m];
+
+		max_free = MAX(max_free, msp->ms_max_free);
+		if (msp->ms_map.sm_loaded)
+			bound = MAX(bound, msp->ms_max_free);
+		else
+			bound = MAX(bound,
+			    msp->ms_map.sm_size - msp->ms_smo.smo_alloc);
+	}
+
+	mg->mg_max_free = max_free;
+	mg->mg_max_free_bound = bound;
+}
+
+/*
+ * The group's fragmentation is the average of its metaslabs'.  If most
+ * of them don't have a trustworthy histogram yet, neither does the group.
+ */
+static void
+metaslab_group_fragmentation_update(metaslab_group_t *mg)
+{
+	vdev_t *vd = mg->mg_vd;
+	uint64_t fragmentation = 0;
+	uint64_t valid = 0;
+	int m;
+
+	for (m = 0; m < vd->vdev_ms_count; m++) {
+		metaslab_t *msp = vd->vdev_ms[m];
+
+		if (msp->ms_fragmentation == ZFS_FRAG_INVALID)
+			continue;
+
+		fragmentation += msp->ms_fragmentation;
+		valid++;
+	}
+
+	if (valid <= vd->vdev_ms_count / 2)
+		mg->mg_fragmentation = ZFS_FRAG_INVALID;
+	else
+		mg->mg_fragmentation = fragmentation / valid;
+}
+
+static void
+metaslab_preload(void *arg)
+{
+	metaslab_t *msp = arg;
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	/*
+	 * Loading reads the space map, and those reads need SCL_ZIO.  A
+	 * config writer may be in metaslab_group_passivate() waiting for
+	 * us with SCL_ZIO held, so if one holds or wants SCL_STATE, leave
+	 * the map for the allocator to load.  Holding SCL_STATE otherwise
+	 * keeps such a writer out until the load is done.
+	 */
+	if (!spa_config_tryenter(spa, SCL_STATE, FTAG, RW_READER))
+		return;
+
+	mutex_enter(&msp->ms_lock);
+	if (!msp->ms_map.sm_loaded && !msp->ms_map.sm_loading &&
+	    metaslab_load(msp) == 0)
+		MSSTAT_BUMP(ms_preloads);
+
+	/*
+	 * Keep the map around long enough for the allocator to get to it.
+	 */
+	msp->ms_access_txg = MAX(msp->ms_access_txg,
+	    spa_syncing_txg(spa) + metaslab_unload_delay + 1);
+	mutex_exit(&msp->ms_lock);
+
+	spa_config_exit(spa, SCL_STATE, FTAG);
+}
+
+/*
+ * Load the metaslabs we're most likely to allocate from next, so that
+ * the allocator doesn't stall reading their space maps.
+ */
+static void
+metaslab_group_preload(metaslab_group_t *mg)
+{
+	spa_t *spa = mg->mg_vd->vdev_spa;
+	avl_tree_t *t = &mg->mg_metaslab_tree;
+	metaslab_t *msp;
+	int m = 0;
+
+	if (spa_shutting_down(spa))
+		return;
+
+	mutex_enter(&mg->mg_lock);
+	for (msp = avl_first(t); msp != NULL; msp = AVL_NEXT(t, msp)) {
+		if (++m > metaslab_preload_limit)
+			break;
+
+		/*
+		 * An unlocked peek is fine here; metaslab_preload()
+		 * checks again under the metaslab lock.
+		 */
+		if (msp->ms_map.sm_loaded || msp->ms_smo.smo_object == 0)
+			continue;
+
+		VERIFY(taskq_dispatch(mg->mg_taskq, metaslab_preload,
+		    msp, TQ_SLEEP) != 0);
+	}
+	mutex_exit(&mg->mg_lock);
+}
+
+/*
+ * Unload maps that are loaded but no longer wanted.  metaslab_sync_done()
+ * does this for the metaslabs that were just synced, but one that was
+ * preloaded and then never allocated from isn't dirty, and would
+ * otherwise stay in core until the pool is exported.
+ */
+static void
+metaslab_group_evict(metaslab_group_t *mg, uint64_t txg)
+{
+	vdev_t *vd = mg->mg_vd;
+	int m, t;
+
+	if (metaslab_debug)
+		return;
+
+	for (m = 0; m < vd->vdev_ms_count; m++) {
+		metaslab_t *msp = vd->vdev_ms[m];
+		space_map_t *sm = &msp->ms_map;
+		int evictable = 1;
+
+		/*
+		 * An unlocked peek is fine here; we check again under the
+		 * metaslab lock.
+		 */
+		if (!sm->sm_loaded)
+			continue;
+
+		mutex_enter(&msp->ms_lock);
+
+		if (!sm->sm_loaded ||
+		    (msp->ms_weight & METASLAB_ACTIVE_MASK) != 0 ||
+		    txg <= msp->ms_access_txg)
+			evictable = 0;
+
+		for (t = 0; t < TXG_SIZE; t++)
+			if (msp->ms_allocmap[t].sm_space)
+				evictable = 0;
+
+		if (evictable) {
+			space_map_unload(sm);
+			MSSTAT_BUMP(ms_unloads);
+			metaslab_group_sort(mg, msp, metaslab_weight(msp));
+		}
+
+		mutex_exit(&msp->ms_lock);
+	}
+}
+
 void
 metaslab_sync_reassess(metaslab_group_t *mg)
 {
@@ -1158,10 +1973,40 @@ metaslab_sync_reassess(metaslab_group_t *mg)
 
 	atomic_add_64(&mg->mg_alloc_failures, -failures);
 
+	metaslab_group_evict(mg, spa_syncing_txg(vd->vdev_spa));
+
+	metaslab_group_fragmentation_update(mg);
+	metaslab_group_max_free_update(mg);
+
 	/*
-	 * Prefetch the next potential metaslabs
+	 * Preload (or at least prefetch) the next potential metaslabs
 	 */
-	metaslab_prefetch(mg);
+	if (metaslab_preload_enabled)
+		metaslab_group_preload(mg);
+	else
+		metaslab_prefetch(mg);
+}
+
+void
+metaslab_stat_init(void)
+{
+	metaslab_ksp = kstat_create("zfs", 0, "metaslabstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (metaslab_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (metaslab_ksp != NULL) {
+		metaslab_ksp->ks_data = &metaslab_stats;
+		kstat_install(metaslab_ksp);
+	}
+}
+
+void
+metaslab_stat_fini(void)
+{
+	if (metaslab_ksp != NULL) {
+		kstat_delete(metaslab_ksp);
+		metaslab_ksp = NULL;
+	}
 }
 
 static uint64_t
@@ -1201,6 +2046,33 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t psize, uint64_t asize,
 		}
 	}
 
+	/*
+	 * If no metaslab in the group can have a large enough free
+	 * segment, don't bother; the caller will try elsewhere or gang.
+	 * Zero means the group hasn't been assessed yet.  A retry to avoid
+	 * ganging doesn't trust the bound, which may be a txg stale.
+	 */
+	if (metaslab_max_free_enabled && !(flags & METASLAB_GANG_AVOID) &&
+	    mg->mg_max_free_bound != 0 && mg->mg_max_free_bound < asize) {
+		MSSTAT_BUMP(ms_group_max_free_skips);
+		return (-1ULL);
+	}
+
+	/*
+	 * A retry to avoid ganging (METASLAB_GANG_RETRY) searches groups
+	 * that normal allocations have stopped trying this txg, and may
+	 * load their space maps in sync context.  Let it do that once per
+	 * group per txg; after that the group is skipped as before.
+	 */
+	if ((flags & METASLAB_GANG_RETRY) &&
+	    mg->mg_alloc_failures > zfs_mg_alloc_failures &&
+	    psize > SPA_GANGBLOCKSIZE &&
+	    activation_weight == METASLAB_WEIGHT_PRIMARY) {
+		if (mg->mg_gang_retry_txg == txg)
+			return (-1ULL);
+		mg->mg_gang_retry_txg = txg;
+	}
+
 	for (;;) {
 		boolean_t was_active;
 
@@ -1217,6 +2089,17 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t psize, uint64_t asize,
 				mutex_exit(&mg->mg_lock);
 				return (-1ULL);
 			}
+			/*
+			 * Only a loaded map's largest free segment is
+			 * known exactly.  Frees may have coalesced an
+			 * unloaded one's into more than it records.
+			 */
+			if (metaslab_max_free_enabled &&
+			    msp->ms_map.sm_loaded &&
+			    msp->ms_max_free < asize) {
+				MSSTAT_BUMP(ms_max_free_skips);
+				continue;
+			}
 			was_active = msp->ms_weight & METASLAB_ACTIVE_MASK;
 			if (activation_weight == METASLAB_WEIGHT_PRIMARY)
 				break;
@@ -1287,7 +2170,8 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t psize, uint64_t asize,
 
 		atomic_inc_64(&mg->mg_alloc_failures);
 
-		metaslab_passivate(msp, space_map_maxsize(&msp->ms_map));
+		msp->ms_max_free = space_map_maxsize(&msp->ms_map);
+		metaslab_passivate(msp, msp->ms_max_free);
 
 		mutex_exit(&msp->ms_lock);
 	}
@@ -1296,6 +2180,7 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t psize, uint64_t asize,
 		vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
 
 	space_map_add(&msp->ms_allocmap[txg & TXG_MASK], offset, asize);
+	msp->ms_access_txg = txg + metaslab_unload_delay;
 
 	mutex_exit(&msp->ms_lock);
 
@@ -1315,6 +2200,7 @@ metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
 	int all_zero;
 	int zio_lock = B_FALSE;
 	boolean_t allocatable;
+	boolean_t throttle, throttled = B_FALSE;
 	uint64_t offset = -1ULL;
 	uint64_t asize;
 	uint64_t distance;
@@ -1330,6 +2216,9 @@ metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
 	if (flags & METASLAB_FASTWRITE)
 		mutex_enter(&mc->mc_fastwrite_lock);
 
+	throttle = (flags & METASLAB_ASYNC_ALLOC) &&
+	    metaslab_alloc_throttle_enabled;
+
 	/*
 	 * Start at the rotor and loop through all mgs until we find something.
 	 * Note that there's no locking on mc_rotor or mc_aliquot because
@@ -1413,6 +2302,21 @@ top:
 		if (!allocatable)
 			goto next;
 
+		/*
+		 * Pass over vdevs with a backlog of async writes.  Count
+		 * each allocation once, and once for each vdev it passed
+		 * over: the later, wider passes (dshift > 3) revisit them.
+		 */
+		if (throttle && vd->vdev_alloc_queue_depth >=
+		    metaslab_alloc_max_queue_depth) {
+			if (dshift == 3)
+				atomic_inc_64(&vd->vdev_stat.vs_alloc_throttled);
+			if (!throttled)
+				MSSTAT_BUMP(ms_alloc_throttled);
+			throttled = B_TRUE;
+			goto next;
+		}
+
 		/*
 		 * Avoid writing single-copy data to a failing vdev
 		 */
@@ -1498,6 +2402,16 @@ next:
 		goto top;
 	}
 
+	/*
+	 * Every vdev with space is over its queue depth limit, so take
+	 * whichever comes next.
+	 */
+	if (throttled) {
+		dshift = 3;
+		throttle = throttled = B_FALSE;
+		goto top;
+	}
+
 	if (!allocatable && !zio_lock) {
 		dshift = 3;
 		zio_lock = B_TRUE;
@@ -1548,10 +2462,11 @@ metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
 		space_map_remove(&msp->ms_allocmap[txg & TXG_MASK],
 		    offset, size);
 		space_map_free(&msp->ms_map, offset, size);
+		msp->ms_max_free = space_map_maxsize(&msp->ms_map);
 	} else {
-		if (msp->ms_freemap[txg & TXG_MASK].sm_space == 0)
+		if (msp->ms_freemap[txg & TXG_MASK]->sm_space == 0)
 			vdev_dirty(vd, VDD_METASLAB, msp, txg);
-		space_map_add(&msp->ms_freemap[txg & TXG_MASK], offset, size);
+		space_map_add(msp->ms_freemap[txg & TXG_MASK], offset, size);
 	}
 
 	mutex_exit(&msp->ms_lock);
@@ -1647,6 +2562,16 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 	ASSERT(error == 0);
 	ASSERT(BP_GET_NDVAS(bp) == ndvas);
 
+	for (d = 0; d < ndvas; d++) {
+		vdev_t *vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d]));
+
+		atomic_inc_64(&vd->vdev_stat.vs_alloc_ops);
+		atomic_add_64(&vd->vdev_stat.vs_alloc_bytes,
+		    DVA_GET_ASIZE(&dva[d]));
+		if (flags & METASLAB_ASYNC_ALLOC)
+			atomic_inc_64(&vd->vdev_alloc_queue_depth);
+	}
+
 	spa_config_exit(spa, SCL_ALLOC, FTAG);
 
 	BP_SET_BIRTH(bp, txg, txg);
@@ -1746,3 +2671,75 @@ void metaslab_fastwrite_unmark(spa_t *spa, const blkptr_t *bp)
 
 	spa_config_exit(spa, SCL_VDEV, FTAG);
 }
+
+/*
+ * Drop the allocation queue depth charged to each of bp's vdevs by an
+ * async write, now that the write is done.
+ */
+void
+metaslab_alloc_queue_done(spa_t *spa, const blkptr_t *bp)
+{
+	const dva_t *dva = bp->blk_dva;
+	int ndvas = BP_GET_NDVAS(bp);
+	int d;
+	vdev_t *vd;
+
+	ASSERT(!BP_IS_HOLE(bp));
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+
+	for (d = 0; d < ndvas; d++) {
+		if ((vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d]))) == NULL)
+			continue;
+		ASSERT3U(vd->vdev_alloc_queue_depth, >, 0);
+		atomic_dec_64(&vd->vdev_alloc_queue_depth);
+	}
+
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(metaslab_fragmentation_factor_enabled, int, 0644);
+MODULE_PARM_DESC(metaslab_fragmentation_factor_enabled,
+	"Scale metaslab weights by free space fragmentation");
+
+module_param(metaslab_max_free_enabled, int, 0644);
+MODULE_PARM_DESC(metaslab_max_free_enabled,
+	"Skip metaslabs whose largest free segment is too small");
+
+module_param(metaslab_preload_enabled, int, 0644);
+MODULE_PARM_DESC(metaslab_preload_enabled,
+	"Load the best metaslabs of each group in the background");
+
+module_param(metaslab_preload_limit, int, 0644);
+MODULE_PARM_DESC(metaslab_preload_limit,
+	"Max metaslabs per group to preload");
+
+module_param(metaslab_unload_delay, int, 0644);
+MODULE_PARM_DESC(metaslab_unload_delay,
+	"Txgs a recently used metaslab stays loaded");
+
+module_param(metaslab_condense_pct, int, 0644);
+MODULE_PARM_DESC(metaslab_condense_pct,
+	"Condense a space map at this percentage of its optimal size");
+
+module_param(metaslab_condense_block_threshold, int, 0644);
+MODULE_PARM_DESC(metaslab_condense_block_threshold,
+	"Min space map blocks before a space map is condensed");
+
+module_param(metaslab_alloc_throttle_enabled, int, 0644);
+MODULE_PARM_DESC(metaslab_alloc_throttle_enabled,
+	"Skip vdevs with too many async writes outstanding");
+
+module_param(metaslab_alloc_max_queue_depth, int, 0644);
+MODULE_PARM_DESC(metaslab_alloc_max_queue_depth,
+	"Max outstanding async writes per top-level vdev");
+
+module_param(metaslab_sf_small_size, ulong, 0644);
+MODULE_PARM_DESC(metaslab_sf_small_size,
+	"Largest block placed in the segregated-fit small block region");
+
+module_param(metaslab_sf_region_shift, int, 0644);
+MODULE_PARM_DESC(metaslab_sf_region_shift,
+	"Segregated-fit small block region is 1/2^shift of each metaslab");
+#endif
@@ -131,6 +131,7 @@ uint_t		zio_taskq_batch_pct = 100;	/* 1 thread per cpu in pset */
 id_t		zio_taskq_psrset_bind = PS_NONE;
 boolean_t	zio_taskq_sysdc = B_TRUE;	/* use SDC scheduling class */
 uint_t		zio_taskq_basedc = 80;		/* base duty cycle */
+uint_t		zio_taskq_compress_pct = 100;	/* compression threads */
 
 boolean_t	spa_create_process = B_TRUE;	/* no process ==> no sysdc */
 
@@ -187,13 +188,19 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 	ASSERT(MUTEX_HELD(&spa->spa_props_lock));
 
 	if (rvd != NULL) {
-		alloc = metaslab_class_get_alloc(spa_normal_class(spa));
-		size = metaslab_class_get_space(spa_normal_class(spa));
+		alloc = metaslab_class_get_alloc(spa_normal_class(spa)) +
+		    metaslab_class_get_alloc(spa_special_class(spa));
+		size = metaslab_class_get_space(spa_normal_class(spa)) +
+		    metaslab_class_get_space(spa_special_class(spa));
 		spa_prop_add_list(*nvp, ZPOOL_PROP_NAME, spa_name(spa), 0, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_SIZE, NULL, size, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_ALLOCATED, NULL, alloc, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_FREE, NULL,
 		    size - alloc, src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_FRAGMENTATION, NULL,
+		    metaslab_class_fragmentation(spa_normal_class(spa)), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_MAXFREE, NULL,
+		    metaslab_class_max_free(spa_normal_class(spa)), src);
 
 		space = 0;
 		for (c = 0; c < rvd->vdev_children; c++) {
@@ -370,6 +377,24 @@ out:
 	return (0);
 }
 
+/*
+ * Point the pool's metaslab classes at the block allocator selected by
+ * its "allocator" property.
+ */
+static void
+spa_allocator_update(spa_t *spa)
+{
+	space_map_ops_t *ops;
+
+	if (spa->spa_allocator >= ZPOOL_NUM_ALLOCATORS)
+		spa->spa_allocator = ZPOOL_ALLOCATOR_DF;
+	ops = metaslab_ops_table[spa->spa_allocator];
+
+	metaslab_class_set_ops(spa_normal_class(spa), ops);
+	metaslab_class_set_ops(spa_log_class(spa), ops);
+	metaslab_class_set_ops(spa_special_class(spa), ops);
+}
+
 /*
  * Validate the given pool properties nvlist and modify the list
  * for the property values to be set.
@@ -515,6 +540,12 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 			}
 			break;
 
+		case ZPOOL_PROP_ALLOCATOR:
+			error = nvpair_value_uint64(elem, &intval);
+			if (!error && intval >= ZPOOL_NUM_ALLOCATORS)
+				error = EINVAL;
+			break;
+
 		case ZPOOL_PROP_CACHEFILE:
 			if ((error = nvpair_value_string(elem, &strval)) != 0)
 				break;
@@ -859,6 +890,18 @@ spa_create_zio_taskqs(spa_t *spa)
 			    spa_taskq_create(spa, name, mode, value);
 		}
 	}
+
+	/*
+	 * Compression of large writes is handed off from the write issue
+	 * taskq to this one (see zio_write_bp_init()), so that CPU-bound
+	 * compression work is spread over all CPUs and never sits behind
+	 * issue threads blocked in metaslab allocation.
+	 */
+	if (zio_taskq_compress_pct != 0) {
+		spa->spa_zio_compress_taskq = spa_taskq_create(spa,
+		    "z_wr_compress", zti_mode_online_percent,
+		    MIN(zio_taskq_compress_pct, 100));
+	}
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPA_THREAD)
@@ -931,6 +974,43 @@ spa_thread(void *arg)
 }
 #endif
 
+static const spa_gang_stats_t spa_gang_stats_template = {
+	{ "headers",		KSTAT_DATA_UINT64 },
+	{ "members",		KSTAT_DATA_UINT64 },
+	{ "avoided",		KSTAT_DATA_UINT64 },
+	{ "header_reads",	KSTAT_DATA_UINT64 },
+};
+
+static void
+spa_gang_stats_init(spa_t *spa)
+{
+	char name[KSTAT_STRLEN];
+
+	bcopy(&spa_gang_stats_template, &spa->spa_gang_stats,
+	    sizeof (spa_gang_stats_t));
+
+	if (strcmp(spa->spa_name, TRYIMPORT_NAME) == 0)
+		return;
+
+	(void) snprintf(name, KSTAT_STRLEN, "gangs-%s", spa_name(spa));
+	spa->spa_gang_ksp = kstat_create("zfs", 0, name, "misc",
+	    KSTAT_TYPE_NAMED, sizeof (spa_gang_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (spa->spa_gang_ksp != NULL) {
+		spa->spa_gang_ksp->ks_data = &spa->spa_gang_stats;
+		kstat_install(spa->spa_gang_ksp);
+	}
+}
+
+static void
+spa_gang_stats_fini(spa_t *spa)
+{
+	if (spa->spa_gang_ksp != NULL) {
+		kstat_delete(spa->spa_gang_ksp);
+		spa->spa_gang_ksp = NULL;
+	}
+}
+
 /*
  * Activate an uninitialized pool.
  */
@@ -944,6 +1024,9 @@ spa_activate(spa_t *spa, int mode)
 
 	spa->spa_normal_class = metaslab_class_create(spa, zfs_metaslab_ops);
 	spa->spa_log_class = metaslab_class_create(spa, zfs_metaslab_ops);
+	spa->spa_special_class = metaslab_class_create(spa, zfs_metaslab_ops);
+
+	spa_gang_stats_init(spa);
 
 	/* Try to create a covering process */
 	mutex_enter(&spa->spa_proc_lock);
@@ -1023,12 +1106,22 @@ spa_deactivate(spa_t *spa)
 		}
 	}
 
+	if (spa->spa_zio_compress_taskq != NULL) {
+		taskq_destroy(spa->spa_zio_compress_taskq);
+		spa->spa_zio_compress_taskq = NULL;
+	}
+
 	metaslab_class_destroy(spa->spa_normal_class);
 	spa->spa_normal_class = NULL;
 
 	metaslab_class_destroy(spa->spa_log_class);
 	spa->spa_log_class = NULL;
 
+	metaslab_class_destroy(spa->spa_special_class);
+	spa->spa_special_class = NULL;
+
+	spa_gang_stats_fini(spa);
+
 	/*
 	 * If this was part of an import or the open otherwise failed, we may
 	 * still have errors left in the queues.  Empty them just in case.
@@ -2429,6 +2522,7 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	}
 
 	spa->spa_delegation = zpool_prop_default_numeric(ZPOOL_PROP_DELEGATION);
+	spa->spa_allocator = zpool_prop_default_numeric(ZPOOL_PROP_ALLOCATOR);
 
 	error = spa_dir_prop(spa, DMU_POOL_PROPS, &spa->spa_pool_props_object);
 	if (error && error != ENOENT)
@@ -2441,6 +2535,7 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		spa_prop_find(spa, ZPOOL_PROP_AUTOREPLACE, &autoreplace);
 		spa_prop_find(spa, ZPOOL_PROP_DELEGATION, &spa->spa_delegation);
 		spa_prop_find(spa, ZPOOL_PROP_FAILUREMODE, &spa->spa_failmode);
+		spa_prop_find(spa, ZPOOL_PROP_ALLOCATOR, &spa->spa_allocator);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
 		spa_prop_find(spa, ZPOOL_PROP_DEDUPDITTO,
 		    &spa->spa_dedup_ditto);
@@ -2448,6 +2543,8 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		spa->spa_autoreplace = (autoreplace != 0);
 	}
 
+	spa_allocator_update(spa);
+
 	/*
 	 * If the 'autoreplace' property is set, then post a resource notifying
 	 * the ZFS DE that it should not issue any faults for unopenable
@@ -3492,6 +3589,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_delegation = zpool_prop_default_numeric(ZPOOL_PROP_DELEGATION);
 	spa->spa_failmode = zpool_prop_default_numeric(ZPOOL_PROP_FAILUREMODE);
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
+	spa->spa_allocator = zpool_prop_default_numeric(ZPOOL_PROP_ALLOCATOR);
 
 	if (props != NULL) {
 		spa_configfile_set(spa, props, B_FALSE);
@@ -5912,6 +6010,10 @@ spa_sync_props(void *arg1, void *arg2, dmu_tx_t *tx)
 			case ZPOOL_PROP_FAILUREMODE:
 				spa->spa_failmode = intval;
 				break;
+			case ZPOOL_PROP_ALLOCATOR:
+				spa->spa_allocator = intval;
+				spa_allocator_update(spa);
+				break;
 			case ZPOOL_PROP_AUTOEXPAND:
 				spa->spa_autoexpand = intval;
 				if (tx->tx_txg != TXG_INITIAL)
@@ -6436,4 +6538,8 @@ EXPORT_SYMBOL(spa_prop_clear_bootfs);
 
 /* asynchronous event notification */
 EXPORT_SYMBOL(spa_event_notify);
+
+module_param(zio_taskq_compress_pct, uint, 0444);
+MODULE_PARM_DESC(zio_taskq_compress_pct,
+	"Percentage of CPUs used for write compression threads");
 #endif
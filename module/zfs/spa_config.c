@@ -381,6 +381,9 @@ spa_config_generate(spa_t *spa, vdev_t *vd, uint64_t txg, int getstats)
 		if (vd->vdev_islog)
 			VERIFY(nvlist_add_uint64(config, ZPOOL_CONFIG_IS_LOG,
 			    1ULL) == 0);
+		if (vd->vdev_top->vdev_isspecial)
+			VERIFY(nvlist_add_uint64(config,
+			    ZPOOL_CONFIG_IS_SPECIAL, 1ULL) == 0);
 		vd = vd->vdev_top;		/* label contains top config */
 	} else {
 		/*
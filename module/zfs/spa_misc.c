@@ -38,6 +38,7 @@
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
 #include <sys/avl.h>
+#include <sys/btree.h>
 #include <sys/unique.h>
 #include <sys/dsl_pool.h>
 #include <sys/dsl_dir.h>
@@ -229,6 +230,13 @@ static kcondvar_t spa_namespace_cv;
 static int spa_active_count;
 int spa_max_replication_override = SPA_DVAS_PER_BP;
 
+/*
+ * Percentage of the special class that is held back for metadata:
+ * small file blocks stop going to the special vdevs once they are
+ * this close to full, so that they don't crowd out metadata.
+ */
+int zfs_special_class_metadata_reserve_pct = 25;
+
 static kmutex_t spa_spare_lock;
 static avl_tree_t spa_spare_avl;
 static kmutex_t spa_l2cache_lock;
@@ -915,6 +923,7 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 	 */
 	ASSERT(metaslab_class_validate(spa_normal_class(spa)) == 0);
 	ASSERT(metaslab_class_validate(spa_log_class(spa)) == 0);
+	ASSERT(metaslab_class_validate(spa_special_class(spa)) == 0);
 
 	spa_config_exit(spa, SCL_ALL, spa);
 
@@ -1431,6 +1440,7 @@ void
 spa_update_dspace(spa_t *spa)
 {
 	spa->spa_dspace = metaslab_class_get_dspace(spa_normal_class(spa)) +
+	    metaslab_class_get_dspace(spa_special_class(spa)) +
 	    ddt_get_dedup_dspace(spa);
 }
 
@@ -1474,6 +1484,46 @@ spa_log_class(spa_t *spa)
 	return (spa->spa_log_class);
 }
 
+metaslab_class_t *
+spa_special_class(spa_t *spa)
+{
+	return (spa->spa_special_class);
+}
+
+/*
+ * Pick the class a block should be allocated from.  Metadata (indirect
+ * blocks, dnodes, ZAPs, DDT entries and the rest of DMU_OT_IS_METADATA)
+ * goes to the special class whenever the pool has one.  Level 0 file
+ * blocks go there too if they're no larger than the dataset's
+ * special_small_blocks, as long as that leaves the metadata reserve
+ * free.  The caller falls back to the normal class if the special one
+ * can't satisfy the allocation.
+ */
+metaslab_class_t *
+spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t objtype,
+    uint_t level, uint64_t special_smallblk)
+{
+	metaslab_class_t *special = spa_special_class(spa);
+	uint64_t space, limit;
+
+	if (!spa_has_special(spa))
+		return (spa_normal_class(spa));
+
+	if (level > 0 || DMU_OT_IS_METADATA(objtype))
+		return (special);
+
+	if (size > special_smallblk)
+		return (spa_normal_class(spa));
+
+	space = metaslab_class_get_space(special);
+	limit = space / 100 *
+	    (100 - MIN(zfs_special_class_metadata_reserve_pct, 100));
+	if (metaslab_class_get_alloc(special) + size > limit)
+		return (spa_normal_class(spa));
+
+	return (special);
+}
+
 int
 spa_max_replication(spa_t *spa)
 {
@@ -1592,10 +1642,12 @@ spa_init(int mode)
 	fm_init();
 	refcount_init();
 	unique_init();
+	btree_init();
 	zio_init();
 	dmu_init();
 	zil_init();
 	vdev_cache_stat_init();
+	metaslab_stat_init();
 	zfs_prop_init();
 	zpool_prop_init();
 	zpool_feature_init();
@@ -1610,10 +1662,12 @@ spa_fini(void)
 
 	spa_evict_all();
 
+	metaslab_stat_fini();
 	vdev_cache_stat_fini();
 	zil_fini();
 	dmu_fini();
 	zio_fini();
+	btree_fini();
 	unique_fini();
 	refcount_fini();
 	fm_fini();
@@ -1639,6 +1693,17 @@ spa_has_slogs(spa_t *spa)
 	return (spa->spa_log_class->mc_rotor != NULL);
 }
 
+/*
+ * Return whether this pool has special (metadata) vdevs.  As with
+ * spa_has_slogs(), no locking is needed since the answer only steers
+ * block placement.
+ */
+boolean_t
+spa_has_special(spa_t *spa)
+{
+	return (spa->spa_special_class->mc_rotor != NULL);
+}
+
 spa_log_state_t
 spa_get_log_state(spa_t *spa)
 {
@@ -1790,6 +1855,7 @@ EXPORT_SYMBOL(spa_update_dspace);
 EXPORT_SYMBOL(spa_deflate);
 EXPORT_SYMBOL(spa_normal_class);
 EXPORT_SYMBOL(spa_log_class);
+EXPORT_SYMBOL(spa_special_class);
 EXPORT_SYMBOL(spa_max_replication);
 EXPORT_SYMBOL(spa_prev_software_version);
 EXPORT_SYMBOL(spa_get_failmode);
@@ -1815,10 +1881,15 @@ EXPORT_SYMBOL(dva_get_dsize_sync);
 EXPORT_SYMBOL(bp_get_dsize_sync);
 EXPORT_SYMBOL(bp_get_dsize);
 EXPORT_SYMBOL(spa_has_slogs);
+EXPORT_SYMBOL(spa_has_special);
 EXPORT_SYMBOL(spa_is_root);
 EXPORT_SYMBOL(spa_writeable);
 EXPORT_SYMBOL(spa_mode);
 
 EXPORT_SYMBOL(spa_namespace_lock);
 #endif
+
+module_param(zfs_special_class_metadata_reserve_pct, int, 0644);
+MODULE_PARM_DESC(zfs_special_class_metadata_reserve_pct,
+	"Percent of the special class kept free of small file blocks");
 #endif
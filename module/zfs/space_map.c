@@ -60,8 +60,7 @@ space_map_create(space_map_t *sm, uint64_t start, uint64_t size, uint8_t shift,
 
 	cv_init(&sm->sm_load_cv, NULL, CV_DEFAULT, NULL);
 
-	avl_create(&sm->sm_root, space_map_seg_compare,
-	    sizeof (space_seg_t), offsetof(struct space_seg, ss_node));
+	btree_create(&sm->sm_root, space_map_seg_compare, sizeof (space_seg_t));
 
 	sm->sm_start = start;
 	sm->sm_size = size;
@@ -74,15 +73,27 @@ space_map_destroy(space_map_t *sm)
 {
 	ASSERT(!sm->sm_loaded && !sm->sm_loading);
 	VERIFY3U(sm->sm_space, ==, 0);
-	avl_destroy(&sm->sm_root);
+	btree_destroy(&sm->sm_root);
 	cv_destroy(&sm->sm_load_cv);
 }
 
+/*
+ * Count a segment of the given size into (delta > 0) or out of
+ * (delta < 0) the map's histogram.
+ */
+static void
+space_map_histogram_seg(space_map_t *sm, uint64_t size, int delta)
+{
+	int idx = highbit(size >> sm->sm_shift) - 1;
+
+	sm->sm_histogram[MIN(idx, SPACE_MAP_HISTOGRAM_SIZE - 1)] += delta;
+}
+
 void
 space_map_add(space_map_t *sm, uint64_t start, uint64_t size)
 {
-	avl_index_t where;
-	space_seg_t ssearch, *ss_before, *ss_after, *ss;
+	btree_index_t where, where_before, where_after;
+	space_seg_t ssearch, seg, *ss_before, *ss_after, *ss;
 	uint64_t end = start + size;
 	int merge_before, merge_after;
 
@@ -96,7 +107,7 @@ space_map_add(space_map_t *sm, uint64_t start, uint64_t size)
 
 	ssearch.ss_start = start;
 	ssearch.ss_end = end;
-	ss = avl_find(&sm->sm_root, &ssearch, &where);
+	ss = btree_find(&sm->sm_root, &ssearch, &where);
 
 	if (ss != NULL && ss->ss_start <= start && ss->ss_end >= end) {
 		zfs_panic_recover("zfs: allocating allocated segment"
@@ -108,40 +119,48 @@ space_map_add(space_map_t *sm, uint64_t start, uint64_t size)
 	/* Make sure we don't overlap with either of our neighbors */
 	VERIFY(ss == NULL);
 
-	ss_before = avl_nearest(&sm->sm_root, where, AVL_BEFORE);
-	ss_after = avl_nearest(&sm->sm_root, where, AVL_AFTER);
+	ss_before = btree_prev(&sm->sm_root, &where, &where_before);
+	ss_after = btree_next(&sm->sm_root, &where, &where_after);
 
 	merge_before = (ss_before != NULL && ss_before->ss_end == start);
 	merge_after = (ss_after != NULL && ss_after->ss_start == end);
 
+	/*
+	 * The picker-private tree is sorted by size, so a segment has to
+	 * come out of it before it is resized in place.
+	 */
+	if (sm->sm_pp_root) {
+		if (merge_before)
+			btree_remove(sm->sm_pp_root, ss_before);
+		if (merge_after)
+			btree_remove(sm->sm_pp_root, ss_after);
+	}
+	if (merge_before)
+		space_map_histogram_seg(sm,
+		    ss_before->ss_end - ss_before->ss_start, -1);
+	if (merge_after)
+		space_map_histogram_seg(sm,
+		    ss_after->ss_end - ss_after->ss_start, -1);
+
 	if (merge_before && merge_after) {
-		avl_remove(&sm->sm_root, ss_before);
-		if (sm->sm_pp_root) {
-			avl_remove(sm->sm_pp_root, ss_before);
-			avl_remove(sm->sm_pp_root, ss_after);
-		}
-		ss_after->ss_start = ss_before->ss_start;
-		kmem_free(ss_before, sizeof (*ss_before));
-		ss = ss_after;
+		ss_before->ss_end = ss_after->ss_end;
+		seg = *ss_before;
+		btree_remove_idx(&sm->sm_root, &where_after);
 	} else if (merge_before) {
 		ss_before->ss_end = end;
-		if (sm->sm_pp_root)
-			avl_remove(sm->sm_pp_root, ss_before);
-		ss = ss_before;
+		seg = *ss_before;
 	} else if (merge_after) {
 		ss_after->ss_start = start;
-		if (sm->sm_pp_root)
-			avl_remove(sm->sm_pp_root, ss_after);
-		ss = ss_after;
+		seg = *ss_after;
 	} else {
-		ss = kmem_alloc(sizeof (*ss), KM_PUSHPAGE);
-		ss->ss_start = start;
-		ss->ss_end = end;
-		avl_insert(&sm->sm_root, ss, where);
+		seg.ss_start = start;
+		seg.ss_end = end;
+		btree_insert(&sm->sm_root, &seg, &where);
 	}
 
 	if (sm->sm_pp_root)
-		avl_add(sm->sm_pp_root, ss);
+		btree_add(sm->sm_pp_root, &seg);
+	space_map_histogram_seg(sm, seg.ss_end - seg.ss_start, 1);
 
 	sm->sm_space += size;
 }
@@ -149,8 +168,8 @@ space_map_add(space_map_t *sm, uint64_t start, uint64_t size)
 void
 space_map_remove(space_map_t *sm, uint64_t start, uint64_t size)
 {
-	avl_index_t where;
-	space_seg_t ssearch, *ss, *newseg;
+	btree_index_t where;
+	space_seg_t ssearch, seg, newseg, *ss;
 	uint64_t end = start + size;
 	int left_over, right_over;
 
@@ -161,7 +180,7 @@ space_map_remove(space_map_t *sm, uint64_t start, uint64_t size)
 
 	ssearch.ss_start = start;
 	ssearch.ss_end = end;
-	ss = avl_find(&sm->sm_root, &ssearch, &where);
+	ss = btree_find(&sm->sm_root, &ssearch, &where);
 
 	/* Make sure we completely overlap with someone */
 	if (ss == NULL) {
@@ -178,28 +197,34 @@ space_map_remove(space_map_t *sm, uint64_t start, uint64_t size)
 	right_over = (ss->ss_end != end);
 
 	if (sm->sm_pp_root)
-		avl_remove(sm->sm_pp_root, ss);
+		btree_remove(sm->sm_pp_root, ss);
+	space_map_histogram_seg(sm, ss->ss_end - ss->ss_start, -1);
 
 	if (left_over && right_over) {
-		newseg = kmem_alloc(sizeof (*newseg), KM_PUSHPAGE);
-		newseg->ss_start = end;
-		newseg->ss_end = ss->ss_end;
+		newseg.ss_start = end;
+		newseg.ss_end = ss->ss_end;
 		ss->ss_end = start;
-		avl_insert_here(&sm->sm_root, newseg, ss, AVL_AFTER);
+		seg = *ss;
+		btree_add(&sm->sm_root, &newseg);
 		if (sm->sm_pp_root)
-			avl_add(sm->sm_pp_root, newseg);
+			btree_add(sm->sm_pp_root, &newseg);
+		space_map_histogram_seg(sm, newseg.ss_end - newseg.ss_start, 1);
 	} else if (left_over) {
 		ss->ss_end = start;
+		seg = *ss;
 	} else if (right_over) {
 		ss->ss_start = end;
+		seg = *ss;
 	} else {
-		avl_remove(&sm->sm_root, ss);
-		kmem_free(ss, sizeof (*ss));
+		btree_remove_idx(&sm->sm_root, &where);
 		ss = NULL;
 	}
 
-	if (sm->sm_pp_root && ss != NULL)
-		avl_add(sm->sm_pp_root, ss);
+	if (ss != NULL) {
+		if (sm->sm_pp_root)
+			btree_add(sm->sm_pp_root, &seg);
+		space_map_histogram_seg(sm, seg.ss_end - seg.ss_start, 1);
+	}
 
 	sm->sm_space -= size;
 }
@@ -207,7 +232,6 @@ space_map_remove(space_map_t *sm, uint64_t start, uint64_t size)
 boolean_t
 space_map_contains(space_map_t *sm, uint64_t start, uint64_t size)
 {
-	avl_index_t where;
 	space_seg_t ssearch, *ss;
 	uint64_t end = start + size;
 
@@ -218,7 +242,7 @@ space_map_contains(space_map_t *sm, uint64_t start, uint64_t size)
 
 	ssearch.ss_start = start;
 	ssearch.ss_end = end;
-	ss = avl_find(&sm->sm_root, &ssearch, &where);
+	ss = btree_find(&sm->sm_root, &ssearch, NULL);
 
 	return (ss != NULL && ss->ss_start <= start && ss->ss_end >= end);
 }
@@ -226,27 +250,33 @@ space_map_contains(space_map_t *sm, uint64_t start, uint64_t size)
 void
 space_map_vacate(space_map_t *sm, space_map_func_t *func, space_map_t *mdest)
 {
+	btree_t *t = &sm->sm_root;
+	btree_index_t where;
 	space_seg_t *ss;
-	void *cookie = NULL;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 
-	while ((ss = avl_destroy_nodes(&sm->sm_root, &cookie)) != NULL) {
-		if (func != NULL)
+	if (func != NULL) {
+		for (ss = btree_first(t, &where); ss != NULL;
+		    ss = btree_next(t, &where, &where))
 			func(mdest, ss->ss_start, ss->ss_end - ss->ss_start);
-		kmem_free(ss, sizeof (*ss));
 	}
+	btree_clear(t);
+	bzero(sm->sm_histogram, sizeof (sm->sm_histogram));
 	sm->sm_space = 0;
 }
 
 void
 space_map_walk(space_map_t *sm, space_map_func_t *func, space_map_t *mdest)
 {
+	btree_t *t = &sm->sm_root;
+	btree_index_t where;
 	space_seg_t *ss;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 
-	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
+	for (ss = btree_first(t, &where); ss != NULL;
+	    ss = btree_next(t, &where, &where))
 		func(mdest, ss->ss_start, ss->ss_end - ss->ss_start);
 }
 
@@ -350,6 +380,26 @@ space_map_load(space_map_t *sm, space_map_ops_t *ops, uint8_t maptype,
 	return (error);
 }
 
+/*
+ * Switch a loaded map to a different block picker, rebuilding the
+ * picker-private state from the map.
+ */
+void
+space_map_set_ops(space_map_t *sm, space_map_ops_t *ops)
+{
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+	ASSERT(sm->sm_loaded);
+
+	if (sm->sm_ops == ops)
+		return;
+
+	if (sm->sm_ops != NULL)
+		sm->sm_ops->smop_unload(sm);
+	sm->sm_ops = ops;
+	if (ops != NULL)
+		ops->smop_load(sm);
+}
+
 void
 space_map_unload(space_map_t *sm)
 {
@@ -404,7 +454,8 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 	space_map_obj_t *smo, objset_t *os, dmu_tx_t *tx)
 {
 	spa_t *spa = dmu_objset_spa(os);
-	void *cookie = NULL;
+	btree_t *t = &sm->sm_root;
+	btree_index_t where;
 	space_seg_t *ss;
 	uint64_t bufsize, start, size, run_len;
 	uint64_t *entry, *entry_map, *entry_map_end;
@@ -416,7 +467,7 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 
 	dprintf("object %4llu, txg %llu, pass %d, %c, count %lu, space %llx\n",
 	    smo->smo_object, dmu_tx_get_txg(tx), spa_sync_pass(spa),
-	    maptype == SM_ALLOC ? 'A' : 'F', avl_numnodes(&sm->sm_root),
+	    maptype == SM_ALLOC ? 'A' : 'F', btree_numnodes(&sm->sm_root),
 	    sm->sm_space);
 
 	if (maptype == SM_ALLOC)
@@ -424,7 +475,7 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 	else
 		smo->smo_alloc -= sm->sm_space;
 
-	bufsize = (8 + avl_numnodes(&sm->sm_root)) * sizeof (uint64_t);
+	bufsize = (8 + btree_numnodes(&sm->sm_root)) * sizeof (uint64_t);
 	bufsize = MIN(bufsize, 1ULL << SPACE_MAP_BLOCKSHIFT);
 	entry_map = zio_buf_alloc(bufsize);
 	entry_map_end = entry_map + (bufsize / sizeof (uint64_t));
@@ -435,7 +486,12 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 	    SM_DEBUG_SYNCPASS_ENCODE(spa_sync_pass(spa)) |
 	    SM_DEBUG_TXG_ENCODE(dmu_tx_get_txg(tx));
 
-	while ((ss = avl_destroy_nodes(&sm->sm_root, &cookie)) != NULL) {
+	/*
+	 * Nobody else touches the map while it's being synced, so the
+	 * walk survives dropping sm_lock around dmu_write().
+	 */
+	for (ss = btree_first(t, &where); ss != NULL;
+	    ss = btree_next(t, &where, &where)) {
 		size = ss->ss_end - ss->ss_start;
 		start = (ss->ss_start - sm->sm_start) >> sm->sm_shift;
 
@@ -461,8 +517,8 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 			start += run_len;
 			size -= run_len;
 		}
-		kmem_free(ss, sizeof (*ss));
 	}
+	btree_clear(t);
 
 	if (entry != entry_map) {
 		size = (entry - entry_map) * sizeof (uint64_t);
@@ -487,6 +543,71 @@ space_map_truncate(space_map_obj_t *smo, objset_t *os, dmu_tx_t *tx)
 	smo->smo_alloc = 0;
 }
 
+boolean_t
+space_map_histogram_valid(space_map_obj_t *smo, space_map_histogram_t *smh)
+{
+	return (smo->smo_objsize != 0 &&
+	    smh->smh_objsize == smo->smo_objsize &&
+	    smh->smh_alloc == smo->smo_alloc);
+}
+
+void
+space_map_histogram_clear(space_map_histogram_t *smh)
+{
+	bzero(smh, sizeof (*smh));
+}
+
+/*
+ * Add the in-core map's segments to the histogram.  A loaded map's
+ * block picker knows its largest segment; for any other map the top
+ * bucket bounds it from below (see space_map_max_free()).
+ */
+void
+space_map_histogram_add(space_map_t *sm, space_map_histogram_t *smh)
+{
+	int i;
+
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+
+	for (i = 0; i < SPACE_MAP_HISTOGRAM_SIZE; i++)
+		smh->smh_histogram[i] += sm->sm_histogram[i];
+
+	if (sm->sm_loaded && sm->sm_ops != NULL)
+		smh->smh_max_free = MAX(smh->smh_max_free,
+		    space_map_maxsize(sm));
+}
+
+/*
+ * Return the largest free segment the map is known to have, or zero if
+ * the histogram can't be trusted.  The top bucket bounds it from below
+ * even if smh_max_free wasn't maintained.
+ */
+uint64_t
+space_map_max_free(space_map_obj_t *smo, space_map_histogram_t *smh,
+    uint8_t shift)
+{
+	int i;
+
+	if (!space_map_histogram_valid(smo, smh))
+		return (0);
+
+	for (i = SPACE_MAP_HISTOGRAM_SIZE - 1; i >= 0; i--) {
+		if (smh->smh_histogram[i] != 0)
+			return (MAX(smh->smh_max_free, 1ULL << (i + shift)));
+	}
+	return (smh->smh_max_free);
+}
+
+/*
+ * Record that the histogram describes the map as of its current size.
+ */
+void
+space_map_histogram_stamp(space_map_obj_t *smo, space_map_histogram_t *smh)
+{
+	smh->smh_objsize = smo->smo_objsize;
+	smh->smh_alloc = smo->smo_alloc;
+}
+
 /*
  * Space map reference trees.
  *
@@ -572,11 +693,13 @@ space_map_ref_add_seg(avl_tree_t *t, uint64_t start, uint64_t end,
 void
 space_map_ref_add_map(avl_tree_t *t, space_map_t *sm, int64_t refcnt)
 {
+	btree_index_t where;
 	space_seg_t *ss;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 
-	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
+	for (ss = btree_first(&sm->sm_root, &where); ss;
+	    ss = btree_next(&sm->sm_root, &where, &where))
 		space_map_ref_add_seg(t, ss->ss_start, ss->ss_end, refcnt);
 }
 
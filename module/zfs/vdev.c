@@ -42,6 +42,7 @@
 #include <sys/arc.h>
 #include <sys/zil.h>
 #include <sys/dsl_scan.h>
+#include <sys/zfeature.h>
 
 /*
  * Virtual device management.
@@ -350,7 +351,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 {
 	vdev_ops_t *ops;
 	char *type;
-	uint64_t guid = 0, islog, nparity;
+	uint64_t guid = 0, islog, isspecial, nparity;
 	vdev_t *vd;
 
 	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
@@ -399,6 +400,15 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (islog && spa_version(spa) < SPA_VERSION_SLOGS)
 		return (ENOTSUP);
 
+	/*
+	 * Determine whether we belong to the special (metadata) class.
+	 * A vdev can't be both an intent log and a special device.
+	 */
+	isspecial = 0;
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL, &isspecial);
+	if (islog && isspecial)
+		return (EINVAL);
+
 	if (ops == &vdev_hole_ops && spa_version(spa) < SPA_VERSION_HOLES)
 		return (ENOTSUP);
 
@@ -441,6 +451,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vd = vdev_alloc_common(spa, id, guid, ops);
 
 	vd->vdev_islog = islog;
+	vd->vdev_isspecial = isspecial;
 	vd->vdev_nparity = nparity;
 
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
@@ -500,7 +511,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    alloctype == VDEV_ALLOC_SPLIT ||
 		    alloctype == VDEV_ALLOC_ROOTPOOL);
 		vd->vdev_mg = metaslab_group_create(islog ?
-		    spa_log_class(spa) : spa_normal_class(spa), vd);
+		    spa_log_class(spa) : isspecial ?
+		    spa_special_class(spa) : spa_normal_class(spa), vd);
 	}
 
 	/*
@@ -714,6 +726,8 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
+	tvd->vdev_isspecial = svd->vdev_isspecial;
+	svd->vdev_isspecial = 0;
 }
 
 static void
@@ -850,6 +864,7 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 
 	for (m = oldc; m < newc; m++) {
 		space_map_obj_t smo = { 0, 0, 0 };
+		space_map_histogram_t smh = { 0 };
 		if (txg == 0) {
 			uint64_t object = 0;
 			error = dmu_read(mos, vd->vdev_ms_array,
@@ -858,17 +873,27 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 			if (error)
 				return (error);
 			if (object != 0) {
+				dmu_object_info_t doi;
 				dmu_buf_t *db;
 				error = dmu_bonus_hold(mos, object, FTAG, &db);
 				if (error)
 					return (error);
-				ASSERT3U(db->db_size, >=, sizeof (smo));
+				/*
+				 * Only maps created with the histogram
+				 * feature enabled carry a histogram.
+				 */
+				dmu_object_info_from_db(db, &doi);
+				ASSERT3U(doi.doi_bonus_size, >=,
+				    SPACE_MAP_SIZE_V0);
 				bcopy(db->db_data, &smo, sizeof (smo));
+				if (doi.doi_bonus_size >= SPACE_MAP_SIZE_V1)
+					bcopy((space_map_obj_t *)db->db_data +
+					    1, &smh, sizeof (smh));
 				ASSERT3U(smo.smo_object, ==, object);
 				dmu_buf_rele(db, FTAG);
 			}
 		}
-		vd->vdev_ms[m] = metaslab_init(vd->vdev_mg, &smo,
+		vd->vdev_ms[m] = metaslab_init(vd->vdev_mg, &smo, &smh,
 		    m << vd->vdev_ms_shift, 1ULL << vd->vdev_ms_shift, txg);
 	}
 
@@ -905,6 +930,7 @@ vdev_metaslab_fini(vdev_t *vd)
 	}
 
 	ASSERT3U(vd->vdev_pending_fastwrite, ==, 0);
+	ASSERT3U(vd->vdev_alloc_queue_depth, ==, 0);
 }
 
 typedef struct vdev_probe_stats {
@@ -1928,9 +1954,11 @@ vdev_resilver_needed(vdev_t *vd, uint64_t *minp, uint64_t *maxp)
 		    vdev_writeable(vd)) {
 			space_seg_t *ss;
 
-			ss = avl_first(&vd->vdev_dtl[DTL_MISSING].sm_root);
+			ss = btree_first(&vd->vdev_dtl[DTL_MISSING].sm_root,
+			    NULL);
 			thismin = ss->ss_start - 1;
-			ss = avl_last(&vd->vdev_dtl[DTL_MISSING].sm_root);
+			ss = btree_last(&vd->vdev_dtl[DTL_MISSING].sm_root,
+			    NULL);
 			thismax = ss->ss_end;
 			needed = B_TRUE;
 		}
@@ -2044,11 +2072,18 @@ vdev_remove(vdev_t *vd, uint64_t txg)
 	if (vd->vdev_ms != NULL) {
 		for (m = 0; m < vd->vdev_ms_count; m++) {
 			metaslab_t *msp = vd->vdev_ms[m];
+			dmu_object_info_t doi;
 
 			if (msp == NULL || msp->ms_smo.smo_object == 0)
 				continue;
 
 			ASSERT3U(msp->ms_smo.smo_alloc, ==, 0);
+			VERIFY(0 == dmu_object_info(mos,
+			    msp->ms_smo.smo_object, &doi));
+			if (doi.doi_bonus_size >= SPACE_MAP_SIZE_V1) {
+				spa_feature_decr(spa, &spa_feature_table[
+				    SPA_FEATURE_SPACEMAP_FREE_HISTOGRAM], tx);
+			}
 			(void) dmu_object_free(mos, msp->ms_smo.smo_object, tx);
 			msp->ms_smo.smo_object = 0;
 		}
@@ -2514,6 +2549,7 @@ vdev_get_stats(vdev_t *vd, vdev_stat_t *vs)
 	if (vd->vdev_ops->vdev_op_leaf)
 		vs->vs_rsize += VDEV_LABEL_START_SIZE + VDEV_LABEL_END_SIZE;
 	vs->vs_esize = vd->vdev_max_asize - vd->vdev_asize;
+	vs->vs_alloc_queue_depth = vd->vdev_alloc_queue_depth;
 	mutex_exit(&vd->vdev_stat_lock);
 
 	/*
@@ -2530,6 +2566,10 @@ vdev_get_stats(vdev_t *vd, vdev_stat_t *vs)
 				vs->vs_ops[t] += cvs->vs_ops[t];
 				vs->vs_bytes[t] += cvs->vs_bytes[t];
 			}
+			vs->vs_alloc_ops += cvs->vs_alloc_ops;
+			vs->vs_alloc_bytes += cvs->vs_alloc_bytes;
+			vs->vs_alloc_queue_depth += cvd->vdev_alloc_queue_depth;
+			vs->vs_alloc_throttled += cvs->vs_alloc_throttled;
 			cvs->vs_scan_removing = cvd->vdev_removing;
 			mutex_exit(&vd->vdev_stat_lock);
 		}
@@ -2733,7 +2773,11 @@ vdev_space_update(vdev_t *vd, int64_t alloc_delta, int64_t defer_delta,
 	vd->vdev_stat.vs_dspace += dspace_delta;
 	mutex_exit(&vd->vdev_stat_lock);
 
-	if (mc == spa_normal_class(spa)) {
+	/*
+	 * The special class holds ordinary pool data, so its space counts
+	 * toward the pool totals; only the intent log is kept out of them.
+	 */
+	if (mc == spa_normal_class(spa) || mc == spa_special_class(spa)) {
 		mutex_enter(&rvd->vdev_stat_lock);
 		rvd->vdev_stat.vs_alloc += alloc_delta;
 		rvd->vdev_stat.vs_space += space_delta;
@@ -286,6 +286,9 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		    vd->vdev_asize) == 0);
 		VERIFY(nvlist_add_uint64(nv, ZPOOL_CONFIG_IS_LOG,
 		    vd->vdev_islog) == 0);
+		if (vd->vdev_isspecial)
+			VERIFY(nvlist_add_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL,
+			    vd->vdev_isspecial) == 0);
 		if (vd->vdev_removing)
 			VERIFY(nvlist_add_uint64(nv, ZPOOL_CONFIG_REMOVING,
 			    vd->vdev_removing) == 0);
@@ -160,4 +160,10 @@ zpool_feature_init(void)
 	zfeature_register(SPA_FEATURE_EMPTY_BPOBJ,
 	    "com.delphix:empty_bpobj", "empty_bpobj",
 	    "Snapshots use less space.", B_TRUE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_SPACEMAP_FREE_HISTOGRAM,
+	    "org.maczfs:spacemap_free_histogram", "spacemap_free_histogram",
+	    "Space maps record free segment sizes.", B_TRUE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_COMPRESS_AUTO,
+	    "org.maczfs:compress_auto", "compress_auto",
+	    "compression=auto property value.", B_FALSE, B_FALSE, NULL);
 }
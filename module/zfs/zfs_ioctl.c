@@ -71,6 +71,7 @@
 #include <sys/zfs_onexit.h>
 #include <sys/zvol.h>
 #include <sys/dsl_scan.h>
+#include <sys/zfeature.h>
 #include <sharefs/share.h>
 #include <sys/dmu_objset.h>
 #include <sys/fm/util.h>
@@ -194,6 +195,22 @@ zfs_earlier_version(const char *name, int version)
 	return (0);
 }
 
+/*
+ * Return TRUE if the pool holding name has the feature enabled.
+ */
+static boolean_t
+zfs_feature_enabled(const char *name, spa_feature_t fid)
+{
+	spa_t *spa;
+	boolean_t enabled = B_FALSE;
+
+	if (spa_open(name, &spa, FTAG) == 0) {
+		enabled = spa_feature_is_enabled(spa, &spa_feature_table[fid]);
+		spa_close(spa, FTAG);
+	}
+	return (enabled);
+}
+
 /*
  * zpl_earlier_version
  *
@@ -2127,6 +2144,53 @@ zfs_prop_set_userquota(const char *dsname, nvpair_t *pair)
 	return (err);
 }
 
+/*
+ * Mark a feature active the first time a property value that depends on
+ * it is set.  Such features never go back to being only enabled.
+ */
+static int
+zfs_prop_activate_feature_check(void *arg1, void *arg2, dmu_tx_t *tx)
+{
+	spa_t *spa = arg1;
+	zfeature_info_t *feature = arg2;
+
+	if (!spa_feature_is_enabled(spa, feature))
+		return (ENOTSUP);
+	if (spa_feature_is_active(spa, feature))
+		return (EBUSY);
+	return (0);
+}
+
+static void
+zfs_prop_activate_feature_sync(void *arg1, void *arg2, dmu_tx_t *tx)
+{
+	spa_t *spa = arg1;
+	zfeature_info_t *feature = arg2;
+
+	spa_feature_incr(spa, feature, tx);
+}
+
+static int
+zfs_prop_activate_feature(const char *dsname, zfeature_info_t *feature)
+{
+	spa_t *spa;
+	int err;
+
+	if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+		return (err);
+
+	if (!spa_feature_is_active(spa, feature)) {
+		err = dsl_sync_task_do(spa_get_dsl(spa),
+		    zfs_prop_activate_feature_check,
+		    zfs_prop_activate_feature_sync, spa, feature, 2);
+		if (err == EBUSY)
+			err = 0;
+	}
+
+	spa_close(spa, FTAG);
+	return (err);
+}
+
 /*
  * If the named property is one that has a special function to set its value,
  * return 0 on success and a positive error code on failure; otherwise if it is
@@ -2199,6 +2263,19 @@ zfs_prop_set_special(const char *dsname, zprop_source_t source,
 		}
 		break;
 	}
+	case ZFS_PROP_COMPRESSION:
+		/*
+		 * Activate the feature for compression=auto before the value
+		 * is stored; the property itself is set by the caller.
+		 */
+		err = -1;
+		if (intval == ZIO_COMPRESS_AUTO) {
+			int ferr = zfs_prop_activate_feature(dsname,
+			    &spa_feature_table[SPA_FEATURE_COMPRESS_AUTO]);
+			if (ferr != 0)
+				err = ferr;
+		}
+		break;
 
 	default:
 		err = -1;
@@ -3423,6 +3500,15 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				return (ENOTSUP);
 			}
 
+			/*
+			 * compression=auto is stored as a value older
+			 * software doesn't know, so it needs its feature.
+			 */
+			if (intval == ZIO_COMPRESS_AUTO &&
+			    !zfs_feature_enabled(dsname,
+			    SPA_FEATURE_COMPRESS_AUTO))
+				return (ENOTSUP);
+
 			if (intval == ZIO_COMPRESS_ZLE &&
 			    zfs_earlier_version(dsname,
 			    SPA_VERSION_ZLE_COMPRESSION))
@@ -440,6 +440,12 @@ zfs_log_rename(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
  */
 ssize_t zfs_immediate_write_sz = 32768;
 
+/*
+ * Log the data of synchronous (FDSYNC) writes by reference, as
+ * WR_NEED_COPY, rather than copying it into the itx as WR_COPIED.
+ */
+int zfs_log_sync_need_copy = 1;
+
 void
 zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	znode_t *zp, offset_t off, ssize_t resid, int ioflag)
@@ -455,23 +461,30 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	 * Writes are handled in three different ways:
 	 *
 	 * WR_INDIRECT:
-	 *    If the write is greater than zfs_immediate_write_sz and there are
-	 *    no separate logs in this pool then later *if* we need to log the
-	 *    write then dmu_sync() is used to immediately write the block and
-	 *    its block pointer is put in the log record.
+	 *    If the write is greater than zfs_immediate_write_sz and
+	 *    zil_prefer_indirect() finds that writing it in place is
+	 *    better than copying it to the log (always so without separate
+	 *    logs) then later *if* we need to log the write then dmu_sync()
+	 *    is used to immediately write the block and its block pointer
+	 *    is put in the log record.
 	 * WR_COPIED:
 	 *    If we know we'll immediately be committing the
 	 *    transaction (FDSYNC (O_DSYNC)), the we allocate a larger
 	 *    log record here for the data and copy the data in.
+	 *    Only done when zfs_log_sync_need_copy is clear.
 	 * WR_NEED_COPY:
 	 *    Otherwise we don't allocate a buffer, and *if* we need to
-	 *    flush the write later then a buffer is allocated and
-	 *    we retrieve the data using the dmu.
+	 *    flush the write later then the data is read from the dmu
+	 *    straight into the log block.  The data was copied into its
+	 *    dbufs by the write, so this saves copying it to the itx and
+	 *    from there to the log block, and holding a second copy until
+	 *    the commit.  The commit follows straight after a sync write,
+	 *    so the dbufs are still cached.
 	 */
 	slogging = spa_has_slogs(zilog->zl_spa);
-	if (resid > zfs_immediate_write_sz && !slogging)
+	if (resid > zfs_immediate_write_sz && zil_prefer_indirect(zilog))
 		write_state = WR_INDIRECT;
-	else if (ioflag & FDSYNC)
+	else if ((ioflag & FDSYNC) && !zfs_log_sync_need_copy)
 		write_state = WR_COPIED;
 	else
 		write_state = WR_NEED_COPY;
@@ -486,11 +499,12 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 		ssize_t len;
 
 		/*
-		 * If there are slogs and the write would overflow the largest
-		 * block, then because we don't want to use the main pool
-		 * to dmu_sync, we have to split the write.
+		 * If the write is to be copied to slogs and would overflow
+		 * the largest block, then because we don't want to use the
+		 * main pool to dmu_sync, we have to split the write.
 		 */
-		if (slogging && resid > ZIL_MAX_LOG_DATA)
+		if (slogging && write_state != WR_INDIRECT &&
+		    resid > ZIL_MAX_LOG_DATA)
 			len = SPA_MAXBLOCKSIZE >> 1;
 		else
 			len = resid;
@@ -509,6 +523,8 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 		}
 
 		itx->itx_wr_state = write_state;
+		itx->itx_sod += (write_state == WR_NEED_COPY ? len : 0);
+		itx->itx_coalesce = (write_state != WR_INDIRECT);
 		lr->lr_foid = zp->z_id;
 		lr->lr_offset = off;
 		lr->lr_length = len;
@@ -660,7 +660,7 @@ zfs_replay_write(zfsvfs_t *zfsvfs, lr_write_t *lr, boolean_t byteswap)
 {
 	char *data = (char *)(lr + 1);	/* data follows lr_write_t */
 	znode_t	*zp;
-	int error, written;
+	int error;
     ssize_t resid;
 	uint64_t eod, offset, length;
 
@@ -690,10 +690,11 @@ zfs_replay_write(zfsvfs_t *zfsvfs, lr_write_t *lr, boolean_t byteswap)
 	 * write needs to be there. So we write the whole block and
 	 * reduce the eof. This needs to be done within the single dmu
 	 * transaction created within vn_rdwr -> zfs_write. So a possible
-	 * new end of file is passed through in zsb->z_replay_eof
+	 * new end of file is passed through in zp->z_replay_eof.  Each
+	 * file's writes are replayed by one thread, so it needs no lock.
 	 */
 
-	zfsvfs->z_replay_eof = 0; /* 0 means don't change end of file */
+	zp->z_replay_eof = 0; /* 0 means don't change end of file */
 
 	/* If it's a dmu_sync() block, write the whole block */
 	if (lr->lr_common.lrc_reclen == sizeof (lr_write_t)) {
@@ -703,7 +704,7 @@ zfs_replay_write(zfsvfs_t *zfsvfs, lr_write_t *lr, boolean_t byteswap)
 			length = blocksize;
 		}
 		if (zp->z_size < eod)
-			zfsvfs->z_replay_eof = eod;
+			zp->z_replay_eof = eod;
 	}
 
 	//written = zpl_write_common(ZTOI(zp), data, length, offset,
@@ -711,14 +712,16 @@ zfs_replay_write(zfsvfs_t *zfsvfs, lr_write_t *lr, boolean_t byteswap)
     error = vn_rdwr(UIO_WRITE, ZTOV(zp), data, length, offset,
                     UIO_SYSSPACE, 0, RLIM64_INFINITY, kcred, &resid);
 
-	if (written < 0)
-		error = -written;
-	else if (written < length)
+	/*
+	 * A record may carry several adjacent writes merged together, so
+	 * a short write loses more than the tail of one write call.
+	 */
+	if (error == 0 && resid != 0)
 		error = EIO; /* short write */
 
     //    vnode_put(vf->vf_vnode);
+	zp->z_replay_eof = 0;	/* safety */
     vnode_put(ZTOV(zp));
-    zfsvfs->z_replay_eof = 0;       /* safety */
 
 	return (error);
 }
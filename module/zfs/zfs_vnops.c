@@ -1183,11 +1183,11 @@ again:
 		}
 		/*
 		 * If we are replaying and eof is non zero then force
-		 * the file size to the specified eof. Note, there's no
-		 * concurrency during replay.
+		 * the file size to the specified eof.  Only the thread
+		 * replaying this file's writes sets it.
 		 */
-		if (zfsvfs->z_replay && zfsvfs->z_replay_eof != 0)
-			zp->z_size = zfsvfs->z_replay_eof;
+		if (zfsvfs->z_replay && zp->z_replay_eof != 0)
+			zp->z_size = zp->z_replay_eof;
 
 		error = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
 
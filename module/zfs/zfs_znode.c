@@ -468,6 +468,7 @@ zfs_znode_alloc(zfsvfs_t *zfsvfs, dmu_buf_t *db, int blksz,
 	zp->z_blksz = blksz;
 	zp->z_seq = 0x7A4653;
 	zp->z_sync_cnt = 0;
+	zp->z_replay_eof = 0;
     zp->z_acl_cached = NULL;
 
     zp->z_is_zvol = 0;
@@ -72,6 +72,7 @@
 zil_stats_t zil_stats = {
 	{ "zil_commit_count",              KSTAT_DATA_UINT64 },
 	{ "zil_commit_writer_count",       KSTAT_DATA_UINT64 },
+	{ "zil_commit_pipelined_count",    KSTAT_DATA_UINT64 },
 	{ "zil_itx_count",                 KSTAT_DATA_UINT64 },
 	{ "zil_itx_indirect_count",        KSTAT_DATA_UINT64 },
 	{ "zil_itx_indirect_bytes",        KSTAT_DATA_UINT64 },
@@ -79,14 +80,77 @@ zil_stats_t zil_stats = {
 	{ "zil_itx_copied_bytes",          KSTAT_DATA_UINT64 },
 	{ "zil_itx_needcopy_count",        KSTAT_DATA_UINT64 },
 	{ "zil_itx_needcopy_bytes",        KSTAT_DATA_UINT64 },
+	{ "zil_itx_coalesced_count",       KSTAT_DATA_UINT64 },
+	{ "zil_itx_coalesced_bytes",       KSTAT_DATA_UINT64 },
+	{ "zil_itx_deferred_count",        KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_normal_count", KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_normal_bytes", KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_count",   KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_bytes",   KSTAT_DATA_UINT64 },
+	{ "zil_lwb_alloc_bytes",           KSTAT_DATA_UINT64 },
+	{ "zil_lwb_wasted_bytes",          KSTAT_DATA_UINT64 },
 };
 
 static kstat_t *zil_ksp;
 
+/*
+ * Each commit phase's histogram has ZIL_HIST_BUCKETS power of two
+ * buckets, named for the bound in microseconds they count samples below.
+ */
+#define	ZCS_HIST_STAT(phase, us) \
+	{ phase "_" #us "us", KSTAT_DATA_UINT64 }
+#define	ZCS_HIST(phase) { \
+	ZCS_HIST_STAT(phase, 1), \
+	ZCS_HIST_STAT(phase, 2), \
+	ZCS_HIST_STAT(phase, 4), \
+	ZCS_HIST_STAT(phase, 8), \
+	ZCS_HIST_STAT(phase, 16), \
+	ZCS_HIST_STAT(phase, 32), \
+	ZCS_HIST_STAT(phase, 64), \
+	ZCS_HIST_STAT(phase, 128), \
+	ZCS_HIST_STAT(phase, 256), \
+	ZCS_HIST_STAT(phase, 512), \
+	ZCS_HIST_STAT(phase, 1024), \
+	ZCS_HIST_STAT(phase, 2048), \
+	ZCS_HIST_STAT(phase, 4096), \
+	ZCS_HIST_STAT(phase, 8192), \
+	ZCS_HIST_STAT(phase, 16384), \
+	ZCS_HIST_STAT(phase, 32768), \
+	ZCS_HIST_STAT(phase, 65536), \
+	ZCS_HIST_STAT(phase, 131072), \
+	ZCS_HIST_STAT(phase, 262144), \
+	ZCS_HIST_STAT(phase, 524288), \
+	ZCS_HIST_STAT(phase, 1048576), \
+	ZCS_HIST_STAT(phase, 2097152), \
+	ZCS_HIST_STAT(phase, 4194304), \
+	ZCS_HIST_STAT(phase, 8388608) }
+
+static const zil_commit_stats_t zil_commit_stats_template = {
+	{ "commits",			KSTAT_DATA_UINT64 },
+	{ "batches",			KSTAT_DATA_UINT64 },
+	{ "itxs",			KSTAT_DATA_UINT64 },
+	{ "bytes",			KSTAT_DATA_UINT64 },
+	{ "lwbs",			KSTAT_DATA_UINT64 },
+	{ "lwbs_inflight_max",		KSTAT_DATA_UINT64 },
+	{
+		ZCS_HIST("wait"),
+		ZCS_HIST("build"),
+		ZCS_HIST("write"),
+		ZCS_HIST("flush"),
+		ZCS_HIST("total"),
+	},
+};
+
+/*
+ * The per-dataset commit stats only exist while the log is open.
+ */
+#define	ZIL_COMMIT_STAT_INCR(zilog, stat, val) \
+	do { \
+		if ((zilog)->zl_commit_stats != NULL) \
+			atomic_add_64( \
+			    &(zilog)->zl_commit_stats->stat.value.ui64, (val)); \
+	} while (0)
+
 /*
  * This global ZIL switch affects all pools
  */
@@ -99,9 +163,60 @@ int zil_replay_disable = 0;    /* disable intent logging replay */
  */
 int zfs_nocacheflush = 0;
 
+/*
+ * Let the next commit batch start building log blocks as soon as the
+ * previous batch has issued its own, rather than after they and the
+ * vdev cache flushes have completed.
+ */
+int zil_commit_pipeline = 1;
+
+/*
+ * Adjacent writes to the same object are merged into a single TX_WRITE
+ * record, of at most this many data bytes, while they wait to be
+ * committed.  Zero disables merging.
+ */
+int zil_itx_coalesce_max = 32768;
+
+/*
+ * Log blocks are sized for the zil_lwb_size_pct percentile of the last
+ * ZIL_PREV_BLKS commit batches.  Zero selects the fixed block size
+ * buckets instead.
+ */
+int zil_lwb_size_pct = 90;
+
+/*
+ * Write and truncate records are replayed by this many threads, with
+ * each object's records kept in order on one of them.  The
+ * records waiting to be replayed are limited to zil_replay_max_pending
+ * bytes.  One or fewer threads replays every record in order.
+ */
+int zil_replay_threads = 8;
+unsigned long zil_replay_max_pending = 16 * 1024 * 1024;
+
+/*
+ * With log devices, one in this many large writes is logged the way
+ * zil_prefer_indirect() didn't choose, to keep the latency measurement
+ * of the other path current.  Zero disables these probes.
+ */
+int zil_indirect_probe = 64;
+
+/*
+ * Stage newly assigned itxs on the current CPU's list.  When clear,
+ * every itx is staged on the same list, which serializes zil_itx_assign()
+ * the way a single itxg lock does.
+ */
+int zil_itx_percpu = 1;
+
+/*
+ * Commit only the itxs of the objects a zil_commit() names, along with
+ * everything they depend on, rather than every pending sync itx.
+ */
+int zil_commit_scoped = 1;
+
 static kmem_cache_t *zil_lwb_cache;
 
 static void zil_async_to_sync(zilog_t *zilog, uint64_t foid);
+static itxs_t *zil_itxg_merge(zilog_t *zilog, itxg_t *itxg, uint64_t txg);
 
 #define	LWB_EMPTY(lwb) ((BP_GET_LSIZE(&lwb->lwb_blk) - \
     sizeof (zil_chain_t)) == (lwb->lwb_sz - lwb->lwb_nused))
@@ -492,6 +607,14 @@ zilog_dirty(zilog_t *zilog, uint64_t txg)
 	if (dsl_dataset_is_snapshot(ds))
 		panic("dirtying snapshot!");
 
+	/*
+	 * Every itx dirties the zilog, so skip the pool wide list lock
+	 * once it's on the list.  It can't come off until this txg has
+	 * synced, which our caller's open tx prevents.
+	 */
+	if (txg_list_member(&dp->dp_dirty_zilogs, zilog, txg))
+		return;
+
 	if (txg_list_add(&dp->dp_dirty_zilogs, zilog, txg) == 0) {
 		/* up the hold count until we can be written out */
 		dmu_buf_add_ref(ds->ds_dbuf, zilog);
@@ -785,57 +908,75 @@ zil_add_block(zilog_t *zilog, const blkptr_t *bp)
 	avl_index_t where;
 	zil_vdev_node_t *zv, zvsearch;
 	int ndvas = BP_GET_NDVAS(bp);
+	uint64_t batch;
 	int i;
 
 	if (zfs_nocacheflush)
 		return;
 
-	ASSERT(zilog->zl_writer);
-
 	/*
-	 * Even though we're zl_writer, we still need a lock because the
-	 * zl_get_data() callbacks may have dmu_sync() done callbacks
-	 * that will run concurrently.
+	 * Label the vdev with the batch being built.  The zl_get_data()
+	 * callbacks may have dmu_sync() done callbacks that run after the
+	 * next batch has started, so the label can be too new, but never
+	 * too old; zil_flush_vdevs() relies on that.
 	 */
+	batch = zilog->zl_next_batch - 1;
+
 	mutex_enter(&zilog->zl_vdev_lock);
 	for (i = 0; i < ndvas; i++) {
 		zvsearch.zv_vdev = DVA_GET_VDEV(&bp->blk_dva[i]);
-		if (avl_find(t, &zvsearch, &where) == NULL) {
+		if ((zv = avl_find(t, &zvsearch, &where)) == NULL) {
 			zv = kmem_alloc(sizeof (*zv), KM_PUSHPAGE);
 			zv->zv_vdev = zvsearch.zv_vdev;
 			avl_insert(t, zv, where);
 		}
+		zv->zv_batch = MAX(zv->zv_batch, batch);
 	}
 	mutex_exit(&zilog->zl_vdev_lock);
 }
 
+/*
+ * Flush the write caches of the vdevs written by commit batches up to
+ * and including batch, all of whose writes have completed.  The tree
+ * may also hold vdevs written by later batches still in flight: flush
+ * those too, in case their label is too new, but leave them in the
+ * tree so that their own batch flushes them again once it's done.
+ */
 static void
-zil_flush_vdevs(zilog_t *zilog)
+zil_flush_vdevs(zilog_t *zilog, uint64_t batch)
 {
 	spa_t *spa = zilog->zl_spa;
 	avl_tree_t *t = &zilog->zl_vdev_tree;
-	void *cookie = NULL;
-	zil_vdev_node_t *zv;
+	zil_vdev_node_t *zv, *next;
+	uint64_t *vdevs;
+	int i, nvdevs;
 	zio_t *zio;
 
-	ASSERT(zilog->zl_writer);
-
-	/*
-	 * We don't need zl_vdev_lock here because we're the zl_writer,
-	 * and all zl_get_data() callbacks are done.
-	 */
-	if (avl_numnodes(t) == 0)
+	mutex_enter(&zilog->zl_vdev_lock);
+	nvdevs = avl_numnodes(t);
+	if (nvdevs == 0) {
+		mutex_exit(&zilog->zl_vdev_lock);
 		return;
+	}
+	vdevs = kmem_alloc(nvdevs * sizeof (uint64_t), KM_PUSHPAGE);
+	for (i = 0, zv = avl_first(t); zv != NULL; zv = next) {
+		next = AVL_NEXT(t, zv);
+		vdevs[i++] = zv->zv_vdev;
+		if (zv->zv_batch <= batch) {
+			avl_remove(t, zv);
+			kmem_free(zv, sizeof (*zv));
+		}
+	}
+	mutex_exit(&zilog->zl_vdev_lock);
 
 	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
 
 	zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
 
-	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
-		vdev_t *vd = vdev_lookup_top(spa, zv->zv_vdev);
+	for (i = 0; i < nvdevs; i++) {
+		vdev_t *vd = vdev_lookup_top(spa, vdevs[i]);
 		if (vd != NULL)
 			zio_flush(zio, vd);
-		kmem_free(zv, sizeof (*zv));
 	}
 
 	/*
@@ -845,6 +986,8 @@ zil_flush_vdevs(zilog_t *zilog)
 	(void) zio_wait(zio);
 
 	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	kmem_free(vdevs, nvdevs * sizeof (uint64_t));
 }
 
 /*
@@ -875,6 +1018,7 @@ zil_lwb_write_done(zio_t *zio)
 	 * the lwb if lwb_buf is null.
 	 */
 	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
+	atomic_dec_64(&zilog->zl_lwb_inflight);
 	mutex_enter(&zilog->zl_lock);
 	lwb->lwb_zio = NULL;
 	lwb->lwb_fastwrite = FALSE;
@@ -918,7 +1062,7 @@ zil_lwb_write_init(zilog_t *zilog, lwb_t *lwb)
 		    0, &lwb->lwb_blk, lwb->lwb_buf, BP_GET_LSIZE(&lwb->lwb_blk),
 		    zil_lwb_write_done, lwb, ZIO_PRIORITY_LOG_WRITE,
 		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
-		    ZIO_FLAG_FASTWRITE, &zb);
+		    ZIO_FLAG_FASTWRITE | ZIO_FLAG_SYNC_LATENCY, &zb);
 	}
 	mutex_exit(&zilog->zl_lock);
 }
@@ -940,17 +1084,125 @@ uint64_t zil_block_buckets[] = {
  * Use the slog as long as the current commit size is less than the
  * limit or the total list size is less than 2X the limit.  Limit
  * checking is disabled by setting zil_slog_limit to UINT64_MAX.
+ *
+ * The limit is per log device.  Successive log blocks are spread over
+ * the log devices by their pending fastwrite bytes, and are in flight
+ * together, so several devices can take a proportionally larger
+ * commit before it's better sent to the main pool.
  */
 unsigned long zil_slog_limit = 1024 * 1024;
-#define	USE_SLOG(zilog) (((zilog)->zl_cur_used < zil_slog_limit) || \
-	((zilog)->zl_itx_list_sz < (zil_slog_limit << 1)))
+
+static uint64_t
+zil_slog_limit_scaled(zilog_t *zilog)
+{
+	uint64_t nlogs = metaslab_class_groups(spa_log_class(zilog->zl_spa));
+
+	if (nlogs <= 1)
+		return (zil_slog_limit);
+	if (zil_slog_limit >= UINT64_MAX / nlogs)
+		return (UINT64_MAX);
+	return (zil_slog_limit * nlogs);
+}
+
+#define	USE_SLOG(zilog) \
+	(((zilog)->zl_cur_used < zil_slog_limit_scaled(zilog)) || \
+	((zilog)->zl_itx_list_sz < (zil_slog_limit_scaled(zilog) << 1)))
+
+/*
+ * Remember the log space used by a commit batch, for sizing later
+ * log blocks.
+ */
+static void
+zil_commit_size_record(zilog_t *zilog, uint64_t size)
+{
+	zilog->zl_commit_sizes[zilog->zl_commit_rotor] = size;
+	zilog->zl_commit_rotor =
+	    (zilog->zl_commit_rotor + 1) & (ZIL_PREV_BLKS - 1);
+}
+
+/*
+ * Return the zil_lwb_size_pct percentile of the recent commit batch
+ * sizes.  A high percentile still covers a stream which alternates
+ * between small and large commits, but unlike the maximum a single
+ * large commit doesn't oversize the next ZIL_PREV_BLKS blocks.
+ */
+static uint64_t
+zil_commit_size_predict(zilog_t *zilog)
+{
+	uint64_t sizes[ZIL_PREV_BLKS], size;
+	int pct = MIN(zil_lwb_size_pct, 100);
+	int i, j;
+
+	for (i = 0; i < ZIL_PREV_BLKS; i++) {
+		size = zilog->zl_commit_sizes[i];
+		for (j = i; j > 0 && sizes[j - 1] > size; j--)
+			sizes[j] = sizes[j - 1];
+		sizes[j] = size;
+	}
+
+	return (sizes[(pct * (ZIL_PREV_BLKS - 1) + 50) / 100]);
+}
+
+/*
+ * Log blocks are pre-allocated, so choose the size of the next block
+ * before we know what will go in it.  If this is the last block of a
+ * commit batch the next one starts the following batch, which is
+ * predicted from the history of batch sizes alone.  Otherwise the
+ * current batch has outgrown its blocks, and the next must at least
+ * hold what the batch has used so far, which includes the record that
+ * didn't fit.
+ *
+ * Note we only write what is used, but we can't just allocate
+ * the maximum block size because we can exhaust the available
+ * pool log space.
+ */
+static uint64_t
+zil_lwb_next_size(zilog_t *zilog, boolean_t last)
+{
+	uint64_t zil_blksz = zilog->zl_cur_used + sizeof (zil_chain_t);
+	int i;
+
+	if (zil_lwb_size_pct > 0) {
+		if (last)
+			zil_blksz = zil_commit_size_predict(zilog);
+		else
+			zil_blksz = MAX(zil_blksz,
+			    zil_commit_size_predict(zilog));
+		zil_blksz = P2ROUNDUP_TYPED(MAX(zil_blksz, ZIL_MIN_BLKSZ),
+		    ZIL_MIN_BLKSZ, uint64_t);
+		return (MIN(zil_blksz, SPA_MAXBLOCKSIZE));
+	}
+
+	/*
+	 * - first find the smallest bucket that will fit the block from a
+	 *   limited set of block sizes. This is because it's faster to write
+	 *   blocks allocated from the same metaslab as they are adjacent or
+	 *   close.
+	 * - next find the maximum from the new suggested size and an array of
+	 *   previous sizes. This lessens a picket fence effect of wrongly
+	 *   guesssing the size if we have a stream of say 2k, 64k, 2k, 64k
+	 *   requests.
+	 */
+	for (i = 0; zil_blksz > zil_block_buckets[i]; i++)
+		continue;
+	zil_blksz = zil_block_buckets[i];
+	if (zil_blksz == UINT64_MAX)
+		zil_blksz = SPA_MAXBLOCKSIZE;
+	zilog->zl_prev_blks[zilog->zl_prev_rotor] = zil_blksz;
+	for (i = 0; i < ZIL_PREV_BLKS; i++)
+		zil_blksz = MAX(zil_blksz, zilog->zl_prev_blks[i]);
+	zilog->zl_prev_rotor =
+	    (zilog->zl_prev_rotor + 1) & (ZIL_PREV_BLKS - 1);
+
+	return (zil_blksz);
+}
 
 /*
- * Start a log block write and advance to the next log block.
- * Calls are serialized.
+ * Start a log block write and advance to the next log block.  last is
+ * set for the final block of a commit batch.  Calls are serialized.
  */
 static lwb_t *
-zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb, boolean_t last)
 {
 	lwb_t *nlwb = NULL;
 	zil_chain_t *zilc;
@@ -958,8 +1210,8 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	blkptr_t *bp;
 	dmu_tx_t *tx;
 	uint64_t txg;
-	uint64_t zil_blksz, wsz;
-	int i, error;
+	uint64_t zil_blksz, wsz, inflight;
+	int error;
 	boolean_t use_slog;
 
 	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
@@ -988,36 +1240,11 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 
 	lwb->lwb_tx = tx;
 
-	/*
-	 * Log blocks are pre-allocated. Here we select the size of the next
-	 * block, based on size used in the last block.
-	 * - first find the smallest bucket that will fit the block from a
-	 *   limited set of block sizes. This is because it's faster to write
-	 *   blocks allocated from the same metaslab as they are adjacent or
-	 *   close.
-	 * - next find the maximum from the new suggested size and an array of
-	 *   previous sizes. This lessens a picket fence effect of wrongly
-	 *   guesssing the size if we have a stream of say 2k, 64k, 2k, 64k
-	 *   requests.
-	 *
-	 * Note we only write what is used, but we can't just allocate
-	 * the maximum block size because we can exhaust the available
-	 * pool log space.
-	 */
-	zil_blksz = zilog->zl_cur_used + sizeof (zil_chain_t);
-	for (i = 0; zil_blksz > zil_block_buckets[i]; i++)
-		continue;
-	zil_blksz = zil_block_buckets[i];
-	if (zil_blksz == UINT64_MAX)
-		zil_blksz = SPA_MAXBLOCKSIZE;
-	zilog->zl_prev_blks[zilog->zl_prev_rotor] = zil_blksz;
-	for (i = 0; i < ZIL_PREV_BLKS; i++)
-		zil_blksz = MAX(zil_blksz, zilog->zl_prev_blks[i]);
-	zilog->zl_prev_rotor = (zilog->zl_prev_rotor + 1) & (ZIL_PREV_BLKS - 1);
+	zil_blksz = zil_lwb_next_size(zilog, last);
 
 	BP_ZERO(bp);
 	use_slog = USE_SLOG(zilog);
-	error = zio_alloc_zil(spa, txg, bp, zil_blksz, USE_SLOG(zilog));
+	error = zio_alloc_zil(spa, txg, bp, zil_blksz, use_slog);
 	if (use_slog)
 	{
 		ZIL_STAT_BUMP(zil_itx_metaslab_slog_count);
@@ -1051,6 +1278,8 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	} else {
 		wsz = lwb->lwb_sz;
 	}
+	ZIL_STAT_INCR(zil_lwb_alloc_bytes, BP_GET_LSIZE(&lwb->lwb_blk));
+	ZIL_STAT_INCR(zil_lwb_wasted_bytes, lwb->lwb_sz - lwb->lwb_nused);
 
 	zilc->zc_pad = 0;
 	zilc->zc_nused = lwb->lwb_nused;
@@ -1061,6 +1290,17 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	 */
 	bzero(lwb->lwb_buf + lwb->lwb_nused, wsz - lwb->lwb_nused);
 
+	/*
+	 * Count the lwbs in flight.  The maximum is only a statistic, so
+	 * a lost race updating it doesn't matter.
+	 */
+	inflight = atomic_inc_64_nv(&zilog->zl_lwb_inflight);
+	ZIL_COMMIT_STAT_INCR(zilog, zcs_lwbs, 1);
+	if (zilog->zl_commit_stats != NULL && inflight >
+	    zilog->zl_commit_stats->zcs_lwbs_inflight_max.value.ui64)
+		zilog->zl_commit_stats->zcs_lwbs_inflight_max.value.ui64 =
+		    inflight;
+
 	zio_nowait(lwb->lwb_zio); /* Kick off the write for the old log block */
 
 	/*
@@ -1099,7 +1339,7 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	 * If this record won't fit in the current log block, start a new one.
 	 */
 	if (lwb->lwb_nused + reclen + dlen > lwb->lwb_sz) {
-		lwb = zil_lwb_write_start(zilog, lwb);
+		lwb = zil_lwb_write_start(zilog, lwb, B_FALSE);
 		if (lwb == NULL)
 			return (NULL);
 		zil_lwb_write_init(zilog, lwb);
@@ -1185,6 +1425,7 @@ zil_itx_create(uint64_t txtype, size_t lrsize)
 	itx->itx_sod = lrsize; /* if write & WR_NEED_COPY will be increased */
 	itx->itx_lr.lrc_seq = 0;	/* defensive */
 	itx->itx_sync = B_TRUE;		/* default is synchronous */
+	itx->itx_coalesce = B_FALSE;
 
 	return (itx);
 }
@@ -1257,6 +1498,7 @@ zil_remove_async(zilog_t *zilog, uint64_t oid)
 	avl_tree_t *t;
 	avl_index_t where;
 	list_t clean_list;
+	itxs_t *clean;
 	itx_t *itx;
 
 	ASSERT(oid != 0);
@@ -1271,6 +1513,7 @@ zil_remove_async(zilog_t *zilog, uint64_t oid)
 		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
 
 		mutex_enter(&itxg->itxg_lock);
+		clean = zil_itxg_merge(zilog, itxg, txg);
 		if (itxg->itxg_txg != txg) {
 			mutex_exit(&itxg->itxg_lock);
 			continue;
@@ -1284,6 +1527,9 @@ zil_remove_async(zilog_t *zilog, uint64_t oid)
 		if (ian != NULL)
 			list_move_tail(&clean_list, &ian->ia_list);
 		mutex_exit(&itxg->itxg_lock);
+
+		if (clean != NULL)
+			zil_itxg_clean(clean);
 	}
 	while ((itx = list_head(&clean_list)) != NULL) {
 		list_remove(&clean_list, itx);
@@ -1293,62 +1539,104 @@ zil_remove_async(zilog_t *zilog, uint64_t oid)
 	list_destroy(&clean_list);
 }
 
-void
-zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
+/*
+ * Try to merge a TX_WRITE itx into the itx at the tail of the list it's
+ * about to join, if that is a write of the same kind, in the same txg,
+ * ending where this one starts.  Returns B_TRUE if the itx was merged
+ * and freed.  The caller holds the itxg lock, so the tail can't be
+ * moved to the commit list underneath us.
+ */
+static boolean_t
+zil_itx_coalesce(zilog_t *zilog, itxg_t *itxg, list_t *list, itx_t *itx)
 {
-	uint64_t txg;
-	itxg_t *itxg;
-	itxs_t *itxs, *clean = NULL;
+	itx_t *tail = list_tail(list);
+	lr_write_t *lr = (lr_write_t *)&itx->itx_lr;
+	lr_write_t *tlr, *mlr;
+	uint64_t len, dlen, reclen;
+	itx_t *mitx;
+
+	if (!itx->itx_coalesce || tail == NULL || !tail->itx_coalesce)
+		return (B_FALSE);
+
+	tlr = (lr_write_t *)&tail->itx_lr;
+	if (tlr->lr_common.lrc_txtype != lr->lr_common.lrc_txtype ||
+	    tlr->lr_common.lrc_txg != lr->lr_common.lrc_txg ||
+	    tail->itx_wr_state != itx->itx_wr_state ||
+	    tail->itx_private != itx->itx_private ||
+	    tlr->lr_foid != lr->lr_foid ||
+	    tlr->lr_offset + tlr->lr_length != lr->lr_offset)
+		return (B_FALSE);
+
+	dlen = lr->lr_length;
+	len = tlr->lr_length + dlen;
+	if (len > zil_itx_coalesce_max || len > ZIL_MAX_LOG_DATA)
+		return (B_FALSE);
+
+	if (itx->itx_wr_state == WR_NEED_COPY) {
+		/*
+		 * The data is only read in when the record is committed,
+		 * but it's counted in the record's size on disk now.
+		 */
+		tlr->lr_length = len;
+		tail->itx_sod += dlen;
+		if (tail->itx_sync) {
+			atomic_add_64(&zilog->zl_itx_list_sz, dlen);
+			itxg->itxg_sod += dlen;
+		}
+	} else {
+		ASSERT(itx->itx_wr_state == WR_COPIED);
+
+		mitx = zil_itx_create(tlr->lr_common.lrc_txtype,
+		    sizeof (lr_write_t) + len);
+		mlr = (lr_write_t *)&mitx->itx_lr;
+		reclen = mlr->lr_common.lrc_reclen;
+		bcopy(tlr, mlr, sizeof (lr_write_t) + tlr->lr_length);
+		bcopy(lr + 1, (char *)(mlr + 1) + tlr->lr_length, dlen);
+		mlr->lr_common.lrc_reclen = reclen;
+		mlr->lr_length = len;
+
+		mitx->itx_private = tail->itx_private;
+		mitx->itx_wr_state = tail->itx_wr_state;
+		mitx->itx_sync = tail->itx_sync;
+		mitx->itx_coalesce = tail->itx_coalesce;
+		mitx->itx_oid = tail->itx_oid;
+
+		if (tail->itx_sync) {
+			atomic_add_64(&zilog->zl_itx_list_sz,
+			    mitx->itx_sod - tail->itx_sod);
+			itxg->itxg_sod += mitx->itx_sod - tail->itx_sod;
+		}
 
-	/*
-	 * Object ids can be re-instantiated in the next txg so
-	 * remove any async transactions to avoid future leaks.
-	 * This can happen if a fsync occurs on the re-instantiated
-	 * object for a WR_INDIRECT or WR_NEED_COPY write, which gets
-	 * the new file data and flushes a write record for the old object.
-	 */
-	if ((itx->itx_lr.lrc_txtype & ~TX_CI) == TX_REMOVE)
-		zil_remove_async(zilog, itx->itx_oid);
+		list_insert_after(list, tail, mitx);
+		list_remove(list, tail);
+		zil_itx_destroy(tail);
+	}
+	zil_itx_destroy(itx);
 
-	/*
-	 * Ensure the data of a renamed file is committed before the rename.
-	 */
-	if ((itx->itx_lr.lrc_txtype & ~TX_CI) == TX_RENAME)
-		zil_async_to_sync(zilog, itx->itx_oid);
+	ZIL_STAT_BUMP(zil_itx_coalesced_count);
+	ZIL_STAT_INCR(zil_itx_coalesced_bytes, dlen);
 
-	if (spa_freeze_txg(zilog->zl_spa) != UINT64_MAX)
-		txg = ZILTEST_TXG;
-	else
-		txg = dmu_tx_get_txg(tx);
+	return (B_TRUE);
+}
 
-	itxg = &zilog->zl_itxg[txg & TXG_MASK];
-	mutex_enter(&itxg->itxg_lock);
-	itxs = itxg->itxg_itxs;
-	if (itxg->itxg_txg != txg) {
-		if (itxs != NULL) {
-			/*
-			 * The zil_clean callback hasn't got around to cleaning
-			 * this itxg. Save the itxs for release below.
-			 * This should be rare.
-			 */
-			atomic_add_64(&zilog->zl_itx_list_sz, -itxg->itxg_sod);
-			itxg->itxg_sod = 0;
-			clean = itxg->itxg_itxs;
-		}
-		ASSERT(itxg->itxg_sod == 0);
-		itxg->itxg_txg = txg;
-		itxs = itxg->itxg_itxs = kmem_zalloc(sizeof (itxs_t), KM_PUSHPAGE);
+/*
+ * Add an itx to the itxg's sync list, or to its object's async list.
+ * Sync itxs were counted in zl_itx_list_sz and the itxg's size by
+ * zil_itxg_merge(), so only a merge into the tail adjusts them here.
+ */
+static void
+zil_itxg_insert(zilog_t *zilog, itxg_t *itxg, itx_t *itx)
+{
+	itxs_t *itxs = itxg->itxg_itxs;
+	uint64_t sod = itx->itx_sod;
 
-		list_create(&itxs->i_sync_list, sizeof (itx_t),
-		    offsetof(itx_t, itx_node));
-		avl_create(&itxs->i_async_tree, zil_aitx_compare,
-		    sizeof (itx_async_node_t),
-		    offsetof(itx_async_node_t, ia_node));
-	}
 	if (itx->itx_sync) {
-		list_insert_tail(&itxs->i_sync_list, itx);
-		atomic_add_64(&zilog->zl_itx_list_sz, itx->itx_sod);
-		itxg->itxg_sod += itx->itx_sod;
+		if (zil_itx_coalesce(zilog, itxg, &itxs->i_sync_list, itx)) {
+			atomic_add_64(&zilog->zl_itx_list_sz, -sod);
+			itxg->itxg_sod -= sod;
+		} else {
+			list_insert_tail(&itxs->i_sync_list, itx);
+		}
 	} else {
 		avl_tree_t *t = &itxs->i_async_tree;
 		uint64_t foid = ((lr_ooo_t *)&itx->itx_lr)->lr_foid;
@@ -1363,109 +1651,434 @@ zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 			ian->ia_foid = foid;
 			avl_insert(t, ian, where);
 		}
-		list_insert_tail(&ian->ia_list, itx);
+		if (!zil_itx_coalesce(zilog, itxg, &ian->ia_list, itx))
+			list_insert_tail(&ian->ia_list, itx);
 	}
-
-	itx->itx_lr.lrc_txg = dmu_tx_get_txg(tx);
-	zilog_dirty(zilog, txg);
-	mutex_exit(&itxg->itxg_lock);
-
-	/* Release the old itxs now we've dropped the lock */
-	if (clean != NULL)
-		zil_itxg_clean(clean);
 }
 
 /*
- * If there are any in-memory intent log transactions which have now been
- * synced then start up a taskq to free them. We should only do this after we
- * have written out the uberblocks (i.e. txg has been comitted) so that
- * don't inadvertently clean out in-memory log records that would be required
- * by zil_commit().
+ * Note that CPU c has itxs staged in txg slot t, or with set clear, that
+ * it has none.  Called with the CPU's lock held.
  */
-void
-zil_clean(zilog_t *zilog, uint64_t synced_txg)
+static void
+zil_itx_staged_set(zilog_t *zilog, int t, int c, boolean_t set)
 {
-	itxg_t *itxg = &zilog->zl_itxg[synced_txg & TXG_MASK];
-	itxs_t *clean_me;
+	uint64_t *word = &zilog->zl_itx_staged[t * zilog->zl_itx_staged_words +
+	    c / 64];
 
-	mutex_enter(&itxg->itxg_lock);
-	if (itxg->itxg_itxs == NULL || itxg->itxg_txg == ZILTEST_TXG) {
-		mutex_exit(&itxg->itxg_lock);
-		return;
-	}
-	ASSERT3U(itxg->itxg_txg, <=, synced_txg);
-	ASSERT(itxg->itxg_txg != 0);
-	ASSERT(zilog->zl_clean_taskq != NULL);
-	atomic_add_64(&zilog->zl_itx_list_sz, -itxg->itxg_sod);
-	itxg->itxg_sod = 0;
-	clean_me = itxg->itxg_itxs;
-	itxg->itxg_itxs = NULL;
-	itxg->itxg_txg = 0;
-	mutex_exit(&itxg->itxg_lock);
-	/*
-	 * Preferably start a task queue to free up the old itxs but
-	 * if taskq_dispatch can't allocate resources to do that then
-	 * free it in-line. This should be rare. Note, using TQ_SLEEP
-	 * created a bad performance problem.
-	 */
-	if (taskq_dispatch(zilog->zl_clean_taskq,
-	    (void (*)(void *))zil_itxg_clean, clean_me, TQ_NOSLEEP) == 0)
-		zil_itxg_clean(clean_me);
+	ASSERT(MUTEX_HELD(&zilog->zl_itx_cpu[c].ic_lock));
+
+	mutex_enter(&zilog->zl_itx_staged_lock);
+	if (set)
+		*word |= 1ULL << (c % 64);
+	else
+		*word &= ~(1ULL << (c % 64));
+	mutex_exit(&zilog->zl_itx_staged_lock);
 }
 
 /*
- * Get the list of itxs to commit into zl_itx_commit_list.
+ * Move the itxs staged for this txg into the itxg, in the order they
+ * were assigned.  Only the CPUs marked in zl_itx_staged are visited,
+ * one at a time.
+ *
+ * Each itx is stamped with gethrtime() under its CPU's lock, so each
+ * CPU's list is in assignment order, and an itx assigned after another
+ * one's zil_itx_assign() returned has a later time.  The clock is the
+ * global ordering point: only itxs stamped no later than cutoff are
+ * taken, and cutoff is in the past before any CPU is looked at, so an itx
+ * assigned while we visit the others is left for the next merge rather
+ * than taken ahead of one it may depend on.  Everything assigned before
+ * we were called is taken.  Called with the itxg lock held.  Returns
+ * the itxs of an older txg that hadn't been cleaned, for the caller to
+ * free once it has dropped the lock.
  */
-static void
-zil_get_commit_list(zilog_t *zilog)
+static itxs_t *
+zil_itxg_merge(zilog_t *zilog, itxg_t *itxg, uint64_t txg)
 {
-	uint64_t otxg, txg;
-	list_t *commit_list = &zilog->zl_itx_commit_list;
-	uint64_t push_sod = 0;
+	int t = txg & TXG_MASK;
+	int nwords = zilog->zl_itx_staged_words;
+	itxs_t *itxs, *clean = NULL;
+	list_t staged;
+	uint64_t sod = 0;
+	uint64_t cpus;
+	hrtime_t cutoff;
+	itx_t *itx, *next;
+	int w, c;
 
-	if (spa_freeze_txg(zilog->zl_spa) != UINT64_MAX) /* ziltest support */
-		otxg = ZILTEST_TXG;
-	else
-		otxg = spa_last_synced_txg(zilog->zl_spa) + 1;
+	ASSERT(MUTEX_HELD(&itxg->itxg_lock));
+	list_create(&staged, sizeof (itx_t), offsetof(itx_t, itx_node));
 
-	for (txg = otxg; txg < (otxg + TXG_CONCURRENT_STATES); txg++) {
-		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
+	/*
+	 * Anything stamped at or before cutoff was assigned, and marked
+	 * staged, before we read zl_itx_staged below.
+	 */
+	cutoff = gethrtime();
+	while (gethrtime() <= cutoff)
+		continue;
 
-		mutex_enter(&itxg->itxg_lock);
-		if (itxg->itxg_txg != txg) {
-			mutex_exit(&itxg->itxg_lock);
-			continue;
-		}
+	for (w = 0; w < nwords; w++) {
+		mutex_enter(&zilog->zl_itx_staged_lock);
+		cpus = zilog->zl_itx_staged[t * nwords + w];
+		mutex_exit(&zilog->zl_itx_staged_lock);
 
-		list_move_tail(commit_list, &itxg->itxg_itxs->i_sync_list);
-		push_sod += itxg->itxg_sod;
-		itxg->itxg_sod = 0;
+		for (c = w * 64; cpus != 0; c++, cpus >>= 1) {
+			itx_cpu_t *ic = &zilog->zl_itx_cpu[c];
 
-		mutex_exit(&itxg->itxg_lock);
-	}
-	atomic_add_64(&zilog->zl_itx_list_sz, -push_sod);
-}
+			if (!(cpus & 1))
+				continue;
 
-/*
- * Move the async itxs for a specified object to commit into sync lists.
- */
-static void
-zil_async_to_sync(zilog_t *zilog, uint64_t foid)
-{
-	uint64_t otxg, txg;
-	itx_async_node_t *ian;
-	avl_tree_t *t;
-	avl_index_t where;
+			mutex_enter(&ic->ic_lock);
+			if (ic->ic_txg[t] != txg) {
+				/* zil_itx_assign() will clean up */
+				mutex_exit(&ic->ic_lock);
+				continue;
+			}
 
-	if (spa_freeze_txg(zilog->zl_spa) != UINT64_MAX) /* ziltest support */
-		otxg = ZILTEST_TXG;
-	else
+			/* each CPU's list is already in order; merge it in */
+			next = list_head(&staged);
+			while ((itx = list_head(&ic->ic_list[t])) != NULL &&
+			    itx->itx_time <= cutoff) {
+				list_remove(&ic->ic_list[t], itx);
+				if (itx->itx_sync) {
+					ic->ic_sod[t] -= itx->itx_sod;
+					sod += itx->itx_sod;
+				}
+				while (next != NULL &&
+				    next->itx_time <= itx->itx_time)
+					next = list_next(&staged, next);
+				if (next == NULL)
+					list_insert_tail(&staged, itx);
+				else
+					list_insert_before(&staged, next, itx);
+			}
+			if (list_is_empty(&ic->ic_list[t]))
+				zil_itx_staged_set(zilog, t, c, B_FALSE);
+			mutex_exit(&ic->ic_lock);
+		}
+	}
+
+	if (list_is_empty(&staged)) {
+		list_destroy(&staged);
+		return (NULL);
+	}
+
+	itxs = itxg->itxg_itxs;
+	if (itxg->itxg_txg != txg) {
+		if (itxs != NULL) {
+			/*
+			 * The zil_clean callback hasn't got around to cleaning
+			 * this itxg. Save the itxs for release by the caller.
+			 * This should be rare.
+			 */
+			atomic_add_64(&zilog->zl_itx_list_sz, -itxg->itxg_sod);
+			itxg->itxg_sod = 0;
+			clean = itxg->itxg_itxs;
+		}
+		ASSERT(itxg->itxg_sod == 0);
+		itxg->itxg_txg = txg;
+		itxs = itxg->itxg_itxs = kmem_zalloc(sizeof (itxs_t),
+		    KM_PUSHPAGE);
+
+		list_create(&itxs->i_sync_list, sizeof (itx_t),
+		    offsetof(itx_t, itx_node));
+		avl_create(&itxs->i_async_tree, zil_aitx_compare,
+		    sizeof (itx_async_node_t),
+		    offsetof(itx_async_node_t, ia_node));
+	}
+
+	itxg->itxg_sod += sod;
+	while ((itx = list_remove_head(&staged)) != NULL)
+		zil_itxg_insert(zilog, itxg, itx);
+	list_destroy(&staged);
+
+	return (clean);
+}
+
+void
+zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
+{
+	uint64_t txg;
+	itx_cpu_t *ic;
+	list_t clean_list;
+	int t, c;
+
+	/*
+	 * Object ids can be re-instantiated in the next txg so
+	 * remove any async transactions to avoid future leaks.
+	 * This can happen if a fsync occurs on the re-instantiated
+	 * object for a WR_INDIRECT or WR_NEED_COPY write, which gets
+	 * the new file data and flushes a write record for the old object.
+	 */
+	if ((itx->itx_lr.lrc_txtype & ~TX_CI) == TX_REMOVE)
+		zil_remove_async(zilog, itx->itx_oid);
+
+	/*
+	 * Ensure the data of a renamed file is committed before the rename.
+	 */
+	if ((itx->itx_lr.lrc_txtype & ~TX_CI) == TX_RENAME)
+		zil_async_to_sync(zilog, itx->itx_oid);
+
+	if (spa_freeze_txg(zilog->zl_spa) != UINT64_MAX)
+		txg = ZILTEST_TXG;
+	else
+		txg = dmu_tx_get_txg(tx);
+
+	itx->itx_lr.lrc_txg = dmu_tx_get_txg(tx);
+
+	list_create(&clean_list, sizeof (itx_t), offsetof(itx_t, itx_node));
+	t = txg & TXG_MASK;
+
+	kpreempt_disable();
+	c = zil_itx_percpu ? CPU_SEQID : 0;
+	kpreempt_enable();
+	ic = &zilog->zl_itx_cpu[c];
+
+	mutex_enter(&ic->ic_lock);
+	if (ic->ic_txg[t] != txg) {
+		/*
+		 * Anything still staged here is from a txg that has synced
+		 * without being merged. Save it for release below.
+		 * This should be rare.
+		 */
+		list_move_tail(&clean_list, &ic->ic_list[t]);
+		atomic_add_64(&zilog->zl_itx_list_sz, -ic->ic_sod[t]);
+		ic->ic_sod[t] = 0;
+		ic->ic_txg[t] = txg;
+	}
+
+	/*
+	 * The time is taken under the CPU's lock, so each CPU's list
+	 * stays sorted; see zil_itxg_merge().
+	 */
+	if (list_is_empty(&ic->ic_list[t]))
+		zil_itx_staged_set(zilog, t, c, B_TRUE);
+	itx->itx_time = gethrtime();
+	list_insert_tail(&ic->ic_list[t], itx);
+	if (itx->itx_sync) {
+		atomic_add_64(&zilog->zl_itx_list_sz, itx->itx_sod);
+		ic->ic_sod[t] += itx->itx_sod;
+	}
+
+	zilog_dirty(zilog, txg);
+	mutex_exit(&ic->ic_lock);
+
+	/* Release the old itxs now we've dropped the lock */
+	while ((itx = list_remove_head(&clean_list)) != NULL)
+		zil_itx_destroy(itx);
+	list_destroy(&clean_list);
+}
+
+/*
+ * If there are any in-memory intent log transactions which have now been
+ * synced then start up a taskq to free them. We should only do this after we
+ * have written out the uberblocks (i.e. txg has been comitted) so that
+ * don't inadvertently clean out in-memory log records that would be required
+ * by zil_commit().
+ */
+void
+zil_clean(zilog_t *zilog, uint64_t synced_txg)
+{
+	itxg_t *itxg = &zilog->zl_itxg[synced_txg & TXG_MASK];
+	itxs_t *clean_me, *clean = NULL;
+
+	mutex_enter(&itxg->itxg_lock);
+	if (itxg->itxg_txg != ZILTEST_TXG)
+		clean = zil_itxg_merge(zilog, itxg, synced_txg);
+	if (itxg->itxg_itxs == NULL || itxg->itxg_txg == ZILTEST_TXG) {
+		mutex_exit(&itxg->itxg_lock);
+		return;
+	}
+	ASSERT3U(itxg->itxg_txg, <=, synced_txg);
+	ASSERT(itxg->itxg_txg != 0);
+	ASSERT(zilog->zl_clean_taskq != NULL);
+	atomic_add_64(&zilog->zl_itx_list_sz, -itxg->itxg_sod);
+	itxg->itxg_sod = 0;
+	clean_me = itxg->itxg_itxs;
+	itxg->itxg_itxs = NULL;
+	itxg->itxg_txg = 0;
+	mutex_exit(&itxg->itxg_lock);
+
+	if (clean != NULL)
+		zil_itxg_clean(clean);
+
+	/*
+	 * Preferably start a task queue to free up the old itxs but
+	 * if taskq_dispatch can't allocate resources to do that then
+	 * free it in-line. This should be rare. Note, using TQ_SLEEP
+	 * created a bad performance problem.
+	 */
+	if (taskq_dispatch(zilog->zl_clean_taskq,
+	    (void (*)(void *))zil_itxg_clean, clean_me, TQ_NOSLEEP) == 0)
+		zil_itxg_clean(clean_me);
+}
+
+/*
+ * Add foid to the objects a commit batch must make stable.
+ */
+static void
+zil_scope_add(zil_scope_t *zs, uint64_t foid)
+{
+	int i;
+
+	if (zs->zs_all)
+		return;
+
+	if (foid == 0 || !zil_commit_scoped) {
+		zs->zs_all = B_TRUE;
+		return;
+	}
+
+	for (i = 0; i < zs->zs_nfoids; i++) {
+		if (zs->zs_foids[i] == foid)
+			return;
+	}
+
+	if (zs->zs_nfoids == ZIL_SCOPE_FOIDS)
+		zs->zs_all = B_TRUE;
+	else
+		zs->zs_foids[zs->zs_nfoids++] = foid;
+}
+
+static boolean_t
+zil_scope_has(zil_scope_t *zs, itx_t *itx)
+{
+	uint64_t foid = ((lr_ooo_t *)&itx->itx_lr)->lr_foid;
+	int i;
+
+	for (i = 0; i < zs->zs_nfoids; i++) {
+		if (zs->zs_foids[i] == foid)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Move the itxs a scoped commit needs from a txg's sync list onto list,
+ * and return the size on disk of the sync itxs among them.
+ *
+ * Any record that isn't out of order (TX_OOO()) is a barrier: it goes
+ * out with everything assigned before it.  Only out of order records
+ * that follow the last barrier may be left behind, and those for
+ * different objects commute, so a record is never logged ahead of an
+ * earlier one it depends on.  In particular a deferred write to an
+ * object is always logged before a later remove of that object, or a
+ * create that reuses its id.  *barrierp is set if the list had one.
+ */
+static uint64_t
+zil_scope_take(zil_scope_t *zs, list_t *sync_list, list_t *list,
+    boolean_t *barrierp)
+{
+	itx_t *itx, *next, *last;
+	boolean_t take;
+	uint64_t sod = 0;
+
+	for (last = list_tail(sync_list); last != NULL;
+	    last = list_prev(sync_list, last)) {
+		if (!TX_OOO(last->itx_lr.lrc_txtype))
+			break;
+	}
+	take = (last != NULL);
+	if (take)
+		*barrierp = B_TRUE;
+
+	for (itx = list_head(sync_list); itx != NULL; itx = next) {
+		next = list_next(sync_list, itx);
+
+		if (take || zil_scope_has(zs, itx)) {
+			list_remove(sync_list, itx);
+			list_insert_tail(list, itx);
+			if (itx->itx_sync)
+				sod += itx->itx_sod;
+		} else {
+			ZIL_STAT_BUMP(zil_itx_deferred_count);
+		}
+
+		if (itx == last)
+			take = B_FALSE;
+	}
+
+	return (sod);
+}
+
+/*
+ * Get the list of itxs to commit into zl_itx_commit_list.
+ *
+ * The txgs are visited newest first, so that a barrier found in a
+ * later txg pulls in all of the earlier ones, and each txg's itxs are
+ * put ahead of those already gathered.
+ */
+static void
+zil_get_commit_list(zilog_t *zilog, zil_scope_t *zs)
+{
+	uint64_t otxg, txg;
+	list_t *commit_list = &zilog->zl_itx_commit_list;
+	list_t *sync_list, txg_list;
+	boolean_t barrier = zs->zs_all;
+	uint64_t sod, push_sod = 0;
+	itxs_t *clean;
+
+	if (spa_freeze_txg(zilog->zl_spa) != UINT64_MAX) /* ziltest support */
+		otxg = ZILTEST_TXG;
+	else
+		otxg = spa_last_synced_txg(zilog->zl_spa) + 1;
+
+	list_create(&txg_list, sizeof (itx_t), offsetof(itx_t, itx_node));
+
+	for (txg = otxg + TXG_CONCURRENT_STATES - 1; txg >= otxg; txg--) {
+		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
+
+		mutex_enter(&itxg->itxg_lock);
+		clean = zil_itxg_merge(zilog, itxg, txg);
+		if (itxg->itxg_txg != txg) {
+			mutex_exit(&itxg->itxg_lock);
+			continue;
+		}
+
+		sync_list = &itxg->itxg_itxs->i_sync_list;
+		if (barrier) {
+			list_move_tail(&txg_list, sync_list);
+			sod = itxg->itxg_sod;
+		} else {
+			sod = zil_scope_take(zs, sync_list, &txg_list,
+			    &barrier);
+		}
+		push_sod += sod;
+		itxg->itxg_sod -= sod;
+
+		mutex_exit(&itxg->itxg_lock);
+
+		list_move_tail(&txg_list, commit_list);
+		list_move_tail(commit_list, &txg_list);
+
+		if (clean != NULL)
+			zil_itxg_clean(clean);
+	}
+	list_destroy(&txg_list);
+	atomic_add_64(&zilog->zl_itx_list_sz, -push_sod);
+}
+
+/*
+ * Move the async itxs for a specified object to commit into sync lists.
+ */
+static void
+zil_async_to_sync(zilog_t *zilog, uint64_t foid)
+{
+	uint64_t otxg, txg;
+	itx_async_node_t *ian;
+	avl_tree_t *t;
+	avl_index_t where;
+	itxs_t *clean;
+
+	if (spa_freeze_txg(zilog->zl_spa) != UINT64_MAX) /* ziltest support */
+		otxg = ZILTEST_TXG;
+	else
 		otxg = spa_last_synced_txg(zilog->zl_spa) + 1;
 
 	for (txg = otxg; txg < (otxg + TXG_CONCURRENT_STATES); txg++) {
 		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
 
 		mutex_enter(&itxg->itxg_lock);
+		clean = zil_itxg_merge(zilog, itxg, txg);
 		if (itxg->itxg_txg != txg) {
 			mutex_exit(&itxg->itxg_lock);
 			continue;
@@ -1495,23 +2108,65 @@ zil_async_to_sync(zilog_t *zilog, uint64_t foid)
 			}
 		}
 		mutex_exit(&itxg->itxg_lock);
+
+		if (clean != NULL)
+			zil_itxg_clean(clean);
 	}
 }
 
-static void
-zil_commit_writer(zilog_t *zilog)
+static zil_commit_stats_t *
+zil_commit_stats_alloc(void)
+{
+	zil_commit_stats_t *zcs;
+
+	zcs = kmem_alloc(sizeof (zil_commit_stats_t), KM_SLEEP);
+	bcopy(&zil_commit_stats_template, zcs, sizeof (zil_commit_stats_t));
+
+	return (zcs);
+}
+
+/*
+ * Add the time since start to a commit phase's histogram, and return
+ * the current time for the next phase to start from.
+ */
+static hrtime_t
+zil_commit_hist(zilog_t *zilog, zil_commit_phase_t phase, hrtime_t start)
+{
+	hrtime_t now = gethrtime();
+	uint64_t us = (now - start) / (NANOSEC / MICROSEC);
+	int b = MIN(highbit(us), ZIL_HIST_BUCKETS - 1);
+
+	DTRACE_PROBE3(zil__commit__phase, zilog_t *, zilog,
+	    zil_commit_phase_t, phase, hrtime_t, now - start);
+	ZIL_COMMIT_STAT_INCR(zilog, zcs_hist[phase][b], 1);
+
+	return (now);
+}
+
+/*
+ * Build and issue the log blocks for one commit batch.  Returns the
+ * batch's root zio for zil_commit_done() to wait on, or NULL if there
+ * was nothing to write or the log chain ended and we fell back to
+ * txg_wait_synced().  *lr_seqp is set to the last log record sequence
+ * number written, or zero if the batch can't vouch for the log chain.
+ */
+static zio_t *
+zil_commit_writer(zilog_t *zilog, zil_scope_t *zs, uint64_t *lr_seqp)
 {
 	uint64_t txg;
 	itx_t *itx;
 	lwb_t *lwb;
 	spa_t *spa = zilog->zl_spa;
-	int error = 0;
+	uint64_t nitxs = 0;
+	zio_t *zio;
 
 	ASSERT(zilog->zl_root_zio == NULL);
 
+	*lr_seqp = 0;
+
 	mutex_exit(&zilog->zl_lock);
 
-	zil_get_commit_list(zilog);
+	zil_get_commit_list(zilog, zs);
 
 	/*
 	 * Return if there's nothing to commit before we dirty the fs by
@@ -1519,7 +2174,7 @@ zil_commit_writer(zilog_t *zilog)
 	 */
 	if (list_head(&zilog->zl_itx_commit_list) == NULL) {
 		mutex_enter(&zilog->zl_lock);
-		return;
+		return (NULL);
 	}
 
 	if (zilog->zl_suspend) {
@@ -1537,6 +2192,7 @@ zil_commit_writer(zilog_t *zilog)
 
 		if (txg > spa_last_synced_txg(spa) || txg > spa_freeze_txg(spa)) {
 			lwb = zil_lwb_commit(zilog, itx, lwb);
+			nitxs++;
         }
 		list_remove(&zilog->zl_itx_commit_list, itx);
 		kmem_free(itx, offsetof(itx_t, itx_lr)
@@ -1544,33 +2200,99 @@ zil_commit_writer(zilog_t *zilog)
 	}
 	DTRACE_PROBE1(zil__cw2, zilog_t *, zilog);
 
+	if (nitxs != 0)
+		zil_commit_size_record(zilog,
+		    zilog->zl_cur_used + sizeof (zil_chain_t));
+
 	/* write the last block out */
 	if (lwb != NULL && lwb->lwb_zio != NULL)
-		lwb = zil_lwb_write_start(zilog, lwb);
+		lwb = zil_lwb_write_start(zilog, lwb, B_TRUE);
 
+	if (nitxs != 0) {
+		ZIL_COMMIT_STAT_INCR(zilog, zcs_batches, 1);
+		ZIL_COMMIT_STAT_INCR(zilog, zcs_itxs, nitxs);
+		ZIL_COMMIT_STAT_INCR(zilog, zcs_bytes, zilog->zl_cur_used);
+	}
 	zilog->zl_cur_used = 0;
 
+	zio = zilog->zl_root_zio;
+	zilog->zl_root_zio = NULL;
+
 	/*
-	 * Wait if necessary for the log blocks to be on stable storage.
+	 * If we couldn't allocate the next log block the chain ends here,
+	 * and the next batch has nothing to build on until zil_sync() has
+	 * cleaned up after us, so finish synchronously.
 	 */
-	if (zilog->zl_root_zio) {
-		error = zio_wait(zilog->zl_root_zio);
-		zilog->zl_root_zio = NULL;
-		zil_flush_vdevs(zilog);
+	if (lwb == NULL) {
+		if (zio != NULL)
+			(void) zio_wait(zio);
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+		mutex_enter(&zilog->zl_lock);
+		return (NULL);
 	}
 
-	if (error || lwb == NULL)
+	mutex_enter(&zilog->zl_lock);
+	*lr_seqp = zilog->zl_lr_seq;
+
+	return (zio);
+}
+
+/*
+ * Wait for a commit batch's log blocks to be on stable storage.
+ * Batches complete in the order they were built, because the log chain
+ * is only as good as its first missing block: a batch isn't committed
+ * until every batch before it is.  Called and returns with zl_lock held.
+ */
+static void
+zil_commit_done(zilog_t *zilog, uint64_t batch, zio_t *zio, uint64_t lr_seq)
+{
+	hrtime_t start = gethrtime();
+	boolean_t covered;
+	int error = 0;
+
+	if (zio != NULL) {
+		mutex_exit(&zilog->zl_lock);
+		error = zio_wait(zio);
+		mutex_enter(&zilog->zl_lock);
+	}
+
+	while (zilog->zl_com_batch + 1 < batch)
+		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+
+	/*
+	 * A failed log block write breaks the chain for every batch that
+	 * was built on it before the failing batch's txg_wait_synced()
+	 * moved the log header past it.  Those batches must rely on the
+	 * txg sync as well.
+	 */
+	covered = (batch <= zilog->zl_fail_batch);
+	mutex_exit(&zilog->zl_lock);
+
+	start = zil_commit_hist(zilog, ZIL_PHASE_WRITE, start);
+
+	if (zio != NULL) {
+		zil_flush_vdevs(zilog, batch);
+		(void) zil_commit_hist(zilog, ZIL_PHASE_FLUSH, start);
+	}
+
+	if (error || covered)
 		txg_wait_synced(zilog->zl_dmu_pool, 0);
 
 	mutex_enter(&zilog->zl_lock);
+	if (error)
+		zilog->zl_fail_batch = zilog->zl_next_batch - 1;
 
 	/*
 	 * Remember the highest committed log sequence number for ztest.
 	 * We only update this value when all the log writes succeeded,
 	 * because ztest wants to ASSERT that it got the whole log chain.
 	 */
-	if (error == 0 && lwb != NULL)
-		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
+	if (error == 0 && !covered && lr_seq != 0)
+		zilog->zl_commit_lr_seq = lr_seq;
+
+	ASSERT3U(zilog->zl_com_batch + 1, ==, batch);
+	zilog->zl_com_batch = batch;
+	cv_broadcast(&zilog->zl_cv_writer);
 }
 
 /*
@@ -1589,17 +2311,32 @@ zil_commit_writer(zilog_t *zilog)
  * cthreads. One of the new cthreads becomes the writer thread for the
  * batch. Any new threads arriving become new qthreads.
  *
+ * Each thread adds its foid to its batch's zl_batch_scope[] entry, and
+ * the writer commits what all of them need (see zil_get_commit_list()).
+ *
  * Only 2 condition variables are needed and there's no transition
  * between the two cvs needed. They just flip-flop between qthreads
  * and cthreads.
  *
  * Using this scheme we can efficiently wakeup up only those threads
  * that have been committed.
+ *
+ * With zil_commit_pipeline set, the writer gives up zl_writer as soon
+ * as its batch's log blocks are issued, so the next batch is built
+ * into the following log block while they're in flight.  Several
+ * batches can then be outstanding, and both cvs may have committing
+ * and queued threads on them at once, so every waiter rechecks its
+ * own batch when woken.  zil_commit_done() completes the batches in
+ * order and wakes each one's threads as soon as it's on disk.
  */
 void
 zil_commit(zilog_t *zilog, uint64_t foid)
 {
-	uint64_t mybatch;
+	uint64_t mybatch, lr_seq;
+	boolean_t pipeline;
+	hrtime_t start, t;
+	zil_scope_t zs;
+	zio_t *zio;
 
     // OSX often has NULL zil for some reason
     if (!zilog) return;
@@ -1608,34 +2345,66 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 		return;
 
 	ZIL_STAT_BUMP(zil_commit_count);
+	ZIL_COMMIT_STAT_INCR(zilog, zcs_commits, 1);
+	start = gethrtime();
 
 	/* move the async itxs for the foid to the sync queues */
 	zil_async_to_sync(zilog, foid);
 
 	mutex_enter(&zilog->zl_lock);
 	mybatch = zilog->zl_next_batch;
-	while (zilog->zl_writer) {
-		cv_wait(&zilog->zl_cv_batch[mybatch & 1], &zilog->zl_lock);
+	zil_scope_add(&zilog->zl_batch_scope[mybatch & 1], foid);
+	for (;;) {
 		if (mybatch <= zilog->zl_com_batch) {
 			mutex_exit(&zilog->zl_lock);
+			(void) zil_commit_hist(zilog, ZIL_PHASE_WAIT, start);
+			(void) zil_commit_hist(zilog, ZIL_PHASE_TOTAL, start);
 			return;
 		}
+		if (!zilog->zl_writer && mybatch == zilog->zl_next_batch)
+			break;
+		cv_wait(&zilog->zl_cv_batch[mybatch & 1], &zilog->zl_lock);
 	}
 
+	if (zilog->zl_com_batch + 1 < mybatch)
+		ZIL_STAT_BUMP(zil_commit_pipelined_count);
+
 	zilog->zl_next_batch++;
 	zilog->zl_writer = B_TRUE;
 	ZIL_STAT_BUMP(zil_commit_writer_count);
-	zil_commit_writer(zilog);
-	zilog->zl_com_batch = mybatch;
-	zilog->zl_writer = B_FALSE;
 
-	/* wake up one thread to become the next writer */
-	cv_signal(&zilog->zl_cv_batch[(mybatch+1) & 1]);
+	/* the batch is closed; its slot now gathers the one after next */
+	zs = zilog->zl_batch_scope[mybatch & 1];
+	bzero(&zilog->zl_batch_scope[mybatch & 1], sizeof (zil_scope_t));
+
+	t = zil_commit_hist(zilog, ZIL_PHASE_WAIT, start);
+	zio = zil_commit_writer(zilog, &zs, &lr_seq);
+	(void) zil_commit_hist(zilog, ZIL_PHASE_BUILD, t);
+
+	pipeline = !!zil_commit_pipeline;
+	if (pipeline) {
+		/* let a queued thread start building the next batch */
+		zilog->zl_writer = B_FALSE;
+		cv_broadcast(&zilog->zl_cv_batch[(mybatch + 1) & 1]);
+	}
 
-	/* wake up all threads waiting for this batch to be committed */
+	zil_commit_done(zilog, mybatch, zio, lr_seq);
+
+	if (!pipeline)
+		zilog->zl_writer = B_FALSE;
+
+	/*
+	 * Wake up a thread to become the next writer, if that hasn't
+	 * happened already, and all threads waiting for this batch to be
+	 * committed.  A single signal could land on a thread from an
+	 * older, still outstanding batch, so broadcast.
+	 */
+	cv_broadcast(&zilog->zl_cv_batch[(mybatch + 1) & 1]);
 	cv_broadcast(&zilog->zl_cv_batch[mybatch & 1]);
 
 	mutex_exit(&zilog->zl_lock);
+
+	(void) zil_commit_hist(zilog, ZIL_PHASE_TOTAL, start);
 }
 
 /*
@@ -1768,7 +2537,7 @@ zilog_t *
 zil_alloc(objset_t *os, zil_header_t *zh_phys)
 {
 	zilog_t *zilog;
-	int i;
+	int i, c;
 
 	zilog = kmem_zalloc(sizeof (zilog_t), KM_PUSHPAGE);
 
@@ -1788,6 +2557,24 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 		    MUTEX_DEFAULT, NULL);
 	}
 
+	zilog->zl_itx_cpu_buf = vmem_zalloc(max_ncpus * sizeof (itx_cpu_t) +
+	    ITX_CPU_ALIGN, KM_SLEEP);
+	zilog->zl_itx_cpu = (itx_cpu_t *)P2ROUNDUP(
+	    (uintptr_t)zilog->zl_itx_cpu_buf, ITX_CPU_ALIGN);
+	mutex_init(&zilog->zl_itx_staged_lock, NULL, MUTEX_DEFAULT, NULL);
+	zilog->zl_itx_staged_words = (max_ncpus + 63) / 64;
+	zilog->zl_itx_staged = kmem_zalloc(TXG_SIZE *
+	    zilog->zl_itx_staged_words * sizeof (uint64_t), KM_SLEEP);
+	for (c = 0; c < max_ncpus; c++) {
+		itx_cpu_t *ic = &zilog->zl_itx_cpu[c];
+
+		mutex_init(&ic->ic_lock, NULL, MUTEX_DEFAULT, NULL);
+		for (i = 0; i < TXG_SIZE; i++) {
+			list_create(&ic->ic_list[i], sizeof (itx_t),
+			    offsetof(itx_t, itx_node));
+		}
+	}
+
 	list_create(&zilog->zl_lwb_list, sizeof (lwb_t),
 	    offsetof(lwb_t, lwb_node));
 
@@ -1810,7 +2597,8 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 void
 zil_free(zilog_t *zilog)
 {
-	int i;
+	itx_t *itx;
+	int i, c;
 
 	zilog->zl_stop_sync = 1;
 
@@ -1836,6 +2624,22 @@ zil_free(zilog_t *zilog)
 		mutex_destroy(&zilog->zl_itxg[i].itxg_lock);
 	}
 
+	for (c = 0; c < max_ncpus; c++) {
+		itx_cpu_t *ic = &zilog->zl_itx_cpu[c];
+
+		for (i = 0; i < TXG_SIZE; i++) {
+			while ((itx = list_remove_head(&ic->ic_list[i])) != NULL)
+				zil_itx_destroy(itx);
+			list_destroy(&ic->ic_list[i]);
+		}
+		mutex_destroy(&ic->ic_lock);
+	}
+	vmem_free(zilog->zl_itx_cpu_buf, max_ncpus * sizeof (itx_cpu_t) +
+	    ITX_CPU_ALIGN);
+	kmem_free(zilog->zl_itx_staged, TXG_SIZE *
+	    zilog->zl_itx_staged_words * sizeof (uint64_t));
+	mutex_destroy(&zilog->zl_itx_staged_lock);
+
 	mutex_destroy(&zilog->zl_lock);
 
 	cv_destroy(&zilog->zl_cv_writer);
@@ -1853,6 +2657,7 @@ zilog_t *
 zil_open(objset_t *os, zil_get_data_t *get_data)
 {
 	zilog_t *zilog = dmu_objset_zil(os);
+	char name[KSTAT_STRLEN];
 
 	ASSERT(zilog->zl_clean_taskq == NULL);
 	ASSERT(zilog->zl_get_data == NULL);
@@ -1862,6 +2667,17 @@ zil_open(objset_t *os, zil_get_data_t *get_data)
 	zilog->zl_clean_taskq = taskq_create("zil_clean", 1, minclsyspri,
 	    2, 2, TASKQ_PREPOPULATE);
 
+	zilog->zl_commit_stats = zil_commit_stats_alloc();
+	(void) snprintf(name, KSTAT_STRLEN, "zil-%s-%llu",
+	    spa_name(zilog->zl_spa), (u_longlong_t)dmu_objset_id(os));
+	zilog->zl_commit_ksp = kstat_create("zfs", 0, name, "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zil_commit_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (zilog->zl_commit_ksp != NULL) {
+		zilog->zl_commit_ksp->ks_data = zilog->zl_commit_stats;
+		kstat_install(zilog->zl_commit_ksp);
+	}
+
 	return (zilog);
 }
 
@@ -1910,6 +2726,13 @@ zil_close(zilog_t *zilog)
 		kmem_cache_free(zil_lwb_cache, lwb);
 	}
 	mutex_exit(&zilog->zl_lock);
+
+	if (zilog->zl_commit_ksp != NULL) {
+		kstat_delete(zilog->zl_commit_ksp);
+		zilog->zl_commit_ksp = NULL;
+	}
+	kmem_free(zilog->zl_commit_stats, sizeof (zil_commit_stats_t));
+	zilog->zl_commit_stats = NULL;
 }
 
 /*
@@ -1967,14 +2790,40 @@ typedef struct zil_replay_arg {
 	void		*zr_arg;
 	boolean_t	zr_byteswap;
 	char		*zr_lr;
+	taskq_t		**zr_taskqs;	/* parallel replay, one per thread */
+	int		zr_ntaskqs;
+	kmutex_t	zr_lock;	/* protects the fields below */
+	kcondvar_t	zr_cv;		/* a parallel record completed */
+	uint64_t	zr_pending;	/* parallel records not yet replayed */
+	uint64_t	zr_pending_bytes; /* and their buffer sizes */
+	int		zr_error;	/* first parallel replay error */
+	lr_t		zr_error_lr;	/* and the record it was for */
 } zil_replay_arg_t;
 
+/*
+ * The out of order records that may be replayed in parallel.  Setattr
+ * and acl records hand their FUIDs to the replay vector through the
+ * filesystem's one z_fuid_replay, so they are replayed in order.
+ */
+#define	ZIL_REPLAY_PARALLEL(txtype)	\
+	((txtype) == TX_WRITE ||	\
+	(txtype) == TX_TRUNCATE ||	\
+	(txtype) == TX_WRITE2)
+
+typedef struct zil_replay_task {
+	zilog_t		*zrt_zilog;
+	zil_replay_arg_t *zrt_zr;
+	lr_t		zrt_lr;		/* record header, as parsed */
+	size_t		zrt_size;	/* record and data buffer size */
+} zil_replay_task_t;
+
 static int
 zil_replay_error(zilog_t *zilog, lr_t *lr, int error)
 {
 	char name[MAXNAMELEN];
 
-	zilog->zl_replaying_seq--;	/* didn't actually replay this one */
+	/* didn't actually replay this one */
+	zilog->zl_replaying_seq = lr->lrc_seq - 1;
 
 	dmu_objset_name(zilog->zl_os, name);
 
@@ -1987,6 +2836,171 @@ zil_replay_error(zilog_t *zilog, lr_t *lr, int error)
 	return (error);
 }
 
+/*
+ * Replay the log record lr, a copy of which the caller has made in buf
+ * with enough room after it for a TX_WRITE's data.  buf may be lr.
+ */
+static int
+zil_replay_apply(zilog_t *zilog, zil_replay_arg_t *zr, lr_t *lr, char *buf)
+{
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t txtype = lr->lrc_txtype & ~TX_CI;
+	int error;
+
+	/*
+	 * If this is a TX_WRITE with a blkptr, suck in the data.
+	 */
+	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
+		error = zil_read_log_data(zilog, (lr_write_t *)lr,
+		    buf + reclen);
+		if (error)
+			return (error);
+	}
+
+	/*
+	 * The log block containing this lr may have been byteswapped
+	 * so that we can easily examine common fields like lrc_txtype.
+	 * However, the log is a mix of different record types, and only the
+	 * replay vectors know how to byteswap their records.  Therefore, if
+	 * the lr was byteswapped, undo it before invoking the replay vector.
+	 */
+	if (zr->zr_byteswap)
+		byteswap_uint64_array(buf, reclen);
+
+	/*
+	 * We must now do two things atomically: replay this log record,
+	 * and update the log header sequence number to reflect the fact that
+	 * we did so. At the end of each replay function the sequence number
+	 * is updated if we are in replay mode.
+	 */
+	error = zr->zr_replay[txtype](zr->zr_arg, buf, zr->zr_byteswap);
+	if (error) {
+		/*
+		 * The DMU's dnode layer doesn't see removes until the txg
+		 * commits, so a subsequent claim can spuriously fail with
+		 * EEXIST. So if we receive any error we try syncing out
+		 * any removes then retry the transaction.  Note that we
+		 * specify B_FALSE for byteswap now, so we don't do it twice.
+		 */
+		txg_wait_synced(spa_get_dsl(zilog->zl_spa), 0);
+		error = zr->zr_replay[txtype](zr->zr_arg, buf, B_FALSE);
+	}
+	return (error);
+}
+
+static void
+zil_replay_task(void *arg)
+{
+	zil_replay_task_t *zrt = arg;
+	zil_replay_arg_t *zr = zrt->zrt_zr;
+	size_t size = zrt->zrt_size;
+	boolean_t failed;
+	int error = 0;
+
+	/*
+	 * Once a record has failed, those queued after it are dropped,
+	 * as serial replay would never have reached them.
+	 */
+	mutex_enter(&zr->zr_lock);
+	failed = (zr->zr_error != 0);
+	mutex_exit(&zr->zr_lock);
+
+	if (!failed)
+		error = zil_replay_apply(zrt->zrt_zilog, zr,
+		    (lr_t *)(zrt + 1), (char *)(zrt + 1));
+
+	mutex_enter(&zr->zr_lock);
+	if (error != 0 && zr->zr_error == 0) {
+		zr->zr_error = error;
+		zr->zr_error_lr = zrt->zrt_lr;
+	}
+	zr->zr_pending--;
+	zr->zr_pending_bytes -= size;
+	cv_broadcast(&zr->zr_cv);
+	mutex_exit(&zr->zr_lock);
+
+	kmem_free(zrt, sizeof (zil_replay_task_t) + size);
+}
+
+/*
+ * Wait for the records replaying in parallel to finish, and report the
+ * first of them to fail, by its own sequence number.  An error is only
+ * returned once.
+ */
+static int
+zil_replay_drain(zilog_t *zilog, zil_replay_arg_t *zr)
+{
+	lr_t lr;
+	int error;
+
+	if (zr->zr_ntaskqs == 0)
+		return (0);
+
+	mutex_enter(&zr->zr_lock);
+	while (zr->zr_pending != 0)
+		cv_wait(&zr->zr_cv, &zr->zr_lock);
+	zilog->zl_replay_parallel = B_FALSE;
+	error = zr->zr_error;
+	lr = zr->zr_error_lr;
+	zr->zr_error = 0;
+	mutex_exit(&zr->zr_lock);
+
+	if (error)
+		return (zil_replay_error(zilog, &lr, error));
+	return (0);
+}
+
+/*
+ * Queue a write or truncate record to be replayed in parallel with those
+ * for other objects.  Records for the same object always go to the
+ * same single threaded taskq, so they are replayed in log order.
+ *
+ * These records don't advance the replayed sequence number as they
+ * complete (see zil_replaying()); the next record replayed in order
+ * does, once they are all done.  So if we crash part way through,
+ * some of them may be replayed twice.  That's harmless, as each of
+ * them sets object state rather than changing it.
+ */
+static int
+zil_replay_dispatch(zilog_t *zilog, zil_replay_arg_t *zr, lr_t *lr,
+    uint64_t txtype)
+{
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t foid = ((lr_ooo_t *)lr)->lr_foid;
+	size_t size = reclen;
+	zil_replay_task_t *zrt;
+
+	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
+		lr_write_t *lrw = (lr_write_t *)lr;
+		size += MAX(BP_GET_LSIZE(&lrw->lr_blkptr), lrw->lr_length);
+	}
+
+	mutex_enter(&zr->zr_lock);
+	while (zr->zr_error == 0 && zr->zr_pending != 0 &&
+	    zr->zr_pending_bytes + size > zil_replay_max_pending)
+		cv_wait(&zr->zr_cv, &zr->zr_lock);
+	if (zr->zr_error != 0) {
+		mutex_exit(&zr->zr_lock);
+		return (zil_replay_drain(zilog, zr));
+	}
+	zr->zr_pending++;
+	zr->zr_pending_bytes += size;
+	zilog->zl_replay_parallel = B_TRUE;
+	mutex_exit(&zr->zr_lock);
+
+	zrt = kmem_alloc(sizeof (zil_replay_task_t) + size, KM_PUSHPAGE);
+	zrt->zrt_zilog = zilog;
+	zrt->zrt_zr = zr;
+	zrt->zrt_lr = *lr;
+	zrt->zrt_size = size;
+	bcopy(lr, zrt + 1, reclen);
+
+	(void) taskq_dispatch(zr->zr_taskqs[foid % zr->zr_ntaskqs],
+	    zil_replay_task, zrt, TQ_SLEEP);
+
+	return (0);
+}
+
 static int
 zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 {
@@ -1996,6 +3010,18 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 	uint64_t txtype = lr->lrc_txtype;
 	int error = 0;
 
+	/*
+	 * Stop at the first record that failed in parallel, before this
+	 * one is looked at, let alone applied.
+	 */
+	if (zr->zr_ntaskqs != 0) {
+		mutex_enter(&zr->zr_lock);
+		error = zr->zr_error;
+		mutex_exit(&zr->zr_lock);
+		if (error)
+			return (zil_replay_drain(zilog, zr));
+	}
+
 	zilog->zl_replaying_seq = lr->lrc_seq;
 
 	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
@@ -2019,53 +3045,29 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 		    ((lr_ooo_t *)lr)->lr_foid, NULL);
 		if (error == ENOENT || error == EEXIST)
 			return (0);
-	}
-
-	/*
-	 * Make a copy of the data so we can revise and extend it.
-	 */
-	bcopy(lr, zr->zr_lr, reclen);
 
-	/*
-	 * If this is a TX_WRITE with a blkptr, suck in the data.
-	 */
-	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
-		error = zil_read_log_data(zilog, (lr_write_t *)lr,
-		    zr->zr_lr + reclen);
-		if (error)
-			return (zil_replay_error(zilog, lr, error));
+		if (zr->zr_ntaskqs != 0 && ZIL_REPLAY_PARALLEL(txtype))
+			return (zil_replay_dispatch(zilog, zr, lr, txtype));
 	}
 
 	/*
-	 * The log block containing this lr may have been byteswapped
-	 * so that we can easily examine common fields like lrc_txtype.
-	 * However, the log is a mix of different record types, and only the
-	 * replay vectors know how to byteswap their records.  Therefore, if
-	 * the lr was byteswapped, undo it before invoking the replay vector.
+	 * Other records, such as TX_CREATE, TX_REMOVE and TX_RENAME,
+	 * change the namespace the records around them depend on, so
+	 * they are replayed in order once those before them are done.
+	 * So are TX_SETATTR and TX_ACL (see ZIL_REPLAY_PARALLEL()).
 	 */
-	if (zr->zr_byteswap)
-		byteswap_uint64_array(zr->zr_lr, reclen);
+	error = zil_replay_drain(zilog, zr);
+	if (error)
+		return (error);
 
 	/*
-	 * We must now do two things atomically: replay this log record,
-	 * and update the log header sequence number to reflect the fact that
-	 * we did so. At the end of each replay function the sequence number
-	 * is updated if we are in replay mode.
+	 * Make a copy of the data so we can revise and extend it.
 	 */
-	error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, zr->zr_byteswap);
-	if (error) {
-		/*
-		 * The DMU's dnode layer doesn't see removes until the txg
-		 * commits, so a subsequent claim can spuriously fail with
-		 * EEXIST. So if we receive any error we try syncing out
-		 * any removes then retry the transaction.  Note that we
-		 * specify B_FALSE for byteswap now, so we don't do it twice.
-		 */
-		txg_wait_synced(spa_get_dsl(zilog->zl_spa), 0);
-		error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, B_FALSE);
-		if (error)
-			return (zil_replay_error(zilog, lr, error));
-	}
+	bcopy(lr, zr->zr_lr, reclen);
+
+	error = zil_replay_apply(zilog, zr, lr, zr->zr_lr);
+	if (error)
+		return (zil_replay_error(zilog, lr, error));
 	return (0);
 }
 
@@ -2078,6 +3080,45 @@ zil_incr_blks(zilog_t *zilog, blkptr_t *bp, void *arg, uint64_t claim_txg)
 	return (0);
 }
 
+static void
+zil_replay_init(zil_replay_arg_t *zr)
+{
+	int i;
+
+	mutex_init(&zr->zr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zr->zr_cv, NULL, CV_DEFAULT, NULL);
+	zr->zr_pending = 0;
+	zr->zr_pending_bytes = 0;
+	zr->zr_error = 0;
+
+	zr->zr_ntaskqs = (zil_replay_threads > 1) ? zil_replay_threads : 0;
+	zr->zr_taskqs = NULL;
+	if (zr->zr_ntaskqs == 0)
+		return;
+
+	zr->zr_taskqs = kmem_alloc(zr->zr_ntaskqs * sizeof (taskq_t *),
+	    KM_PUSHPAGE);
+	for (i = 0; i < zr->zr_ntaskqs; i++)
+		zr->zr_taskqs[i] = taskq_create("zil_replay", 1, minclsyspri,
+		    1, INT_MAX, 0);
+}
+
+static void
+zil_replay_fini(zil_replay_arg_t *zr)
+{
+	int i;
+
+	ASSERT3U(zr->zr_pending, ==, 0);
+
+	for (i = 0; i < zr->zr_ntaskqs; i++)
+		taskq_destroy(zr->zr_taskqs[i]);
+	if (zr->zr_taskqs != NULL)
+		kmem_free(zr->zr_taskqs, zr->zr_ntaskqs * sizeof (taskq_t *));
+
+	cv_destroy(&zr->zr_cv);
+	mutex_destroy(&zr->zr_lock);
+}
+
 /*
  * If this dataset has a non-empty intent log, replay it and destroy it.
  */
@@ -2097,6 +3138,7 @@ zil_replay(objset_t *os, void *arg, zil_replay_func_t *replay_func[TX_MAX_TYPE])
 	zr.zr_arg = arg;
 	zr.zr_byteswap = BP_SHOULD_BYTESWAP(&zh->zh_log);
 	zr.zr_lr = vmem_alloc(2 * SPA_MAXBLOCKSIZE, KM_PUSHPAGE);
+	zil_replay_init(&zr);
 
 	/*
 	 * Wait for in-progress removes to sync before starting replay.
@@ -2108,6 +3150,8 @@ zil_replay(objset_t *os, void *arg, zil_replay_func_t *replay_func[TX_MAX_TYPE])
 	ASSERT(zilog->zl_replay_blks == 0);
 	(void) zil_parse(zilog, zil_incr_blks, zil_replay_log_record, &zr,
 	    zh->zh_claim_txg);
+	(void) zil_replay_drain(zilog, &zr);
+	zil_replay_fini(&zr);
 	vmem_free(zr.zr_lr, 2 * SPA_MAXBLOCKSIZE);
 
 	zil_destroy(zilog, B_FALSE);
@@ -2123,14 +3167,57 @@ zil_replaying(zilog_t *zilog, dmu_tx_t *tx)
 
 	if (zilog->zl_replay) {
 		dsl_dataset_dirty(dmu_objset_ds(zilog->zl_os), tx);
-		zilog->zl_replayed_seq[dmu_tx_get_txg(tx) & TXG_MASK] =
-		    zilog->zl_replaying_seq;
+		/*
+		 * Records replayed in parallel finish out of order, so
+		 * can't vouch for the records logged before them.
+		 */
+		if (!zilog->zl_replay_parallel)
+			zilog->zl_replayed_seq[dmu_tx_get_txg(tx) & TXG_MASK] =
+			    zilog->zl_replaying_seq;
 		return (B_TRUE);
 	}
 
 	return (B_FALSE);
 }
 
+/*
+ * Decide whether a write too large to be worth copying into the log
+ * without a log device should be logged by reference: written straight
+ * to its place in the pool by dmu_sync(), with only its block pointer
+ * in the log record.  Otherwise it's copied into the log.
+ *
+ * Without log devices the log is in the main pool anyway, and copying
+ * would just write the data twice, as it would with logbias=throughput.
+ * With them, go by which class has been completing synchronous writes
+ * sooner.  Until both have been measured, use the log devices, with
+ * the occasional probe of the main pool.
+ */
+boolean_t
+zil_prefer_indirect(zilog_t *zilog)
+{
+	spa_t *spa = zilog->zl_spa;
+	uint64_t slog_lat, pool_lat;
+	boolean_t indirect;
+
+	if (zilog->zl_logbias == ZFS_LOGBIAS_THROUGHPUT ||
+	    !spa_has_slogs(spa))
+		return (B_TRUE);
+
+	slog_lat = metaslab_class_sync_write_lat(spa_log_class(spa));
+	pool_lat = metaslab_class_sync_write_lat(spa_normal_class(spa));
+	indirect = (slog_lat != 0 && pool_lat != 0 && pool_lat < slog_lat);
+
+	if (zil_indirect_probe > 0 &&
+	    atomic_inc_64_nv(&zilog->zl_indirect_probe) %
+	    zil_indirect_probe == 0)
+		indirect = !indirect;
+
+	DTRACE_PROBE3(zil__prefer__indirect, zilog_t *, zilog,
+	    uint64_t, slog_lat, uint64_t, pool_lat);
+
+	return (indirect);
+}
+
 /* ARGSUSED */
 int
 zil_vdev_offline(const char *osname, void *arg)
@@ -2153,12 +3240,48 @@ zil_vdev_offline(const char *osname, void *arg)
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(zil_open);
+EXPORT_SYMBOL(zil_close);
+EXPORT_SYMBOL(zil_itx_create);
+EXPORT_SYMBOL(zil_itx_assign);
+EXPORT_SYMBOL(zil_commit);
+
 module_param(zil_replay_disable, int, 0644);
 MODULE_PARM_DESC(zil_replay_disable, "Disable intent logging replay");
 
 module_param(zfs_nocacheflush, int, 0644);
 MODULE_PARM_DESC(zfs_nocacheflush, "Disable cache flushes");
 
+module_param(zil_commit_pipeline, int, 0644);
+MODULE_PARM_DESC(zil_commit_pipeline,
+	"Build the next ZIL commit while the previous one is in flight");
+
+module_param(zil_itx_coalesce_max, int, 0644);
+MODULE_PARM_DESC(zil_itx_coalesce_max,
+	"Max data bytes of merged adjacent TX_WRITE records");
+
+module_param(zil_replay_threads, int, 0644);
+MODULE_PARM_DESC(zil_replay_threads, "Threads replaying out of order records");
+
+module_param(zil_replay_max_pending, ulong, 0644);
+MODULE_PARM_DESC(zil_replay_max_pending,
+	"Max bytes of records queued for parallel replay");
+
+module_param(zil_indirect_probe, int, 0644);
+MODULE_PARM_DESC(zil_indirect_probe,
+	"Log one in this many large writes the other way as a probe");
+
+module_param(zil_itx_percpu, int, 0644);
+MODULE_PARM_DESC(zil_itx_percpu, "Stage new itxs on per-CPU lists");
+
+module_param(zil_commit_scoped, int, 0644);
+MODULE_PARM_DESC(zil_commit_scoped,
+	"Commit only the requested objects and what they depend on");
+
+module_param(zil_lwb_size_pct, int, 0644);
+MODULE_PARM_DESC(zil_lwb_size_pct,
+	"Percentile of recent commit sizes to size log blocks for");
+
 module_param(zil_slog_limit, ulong, 0644);
 MODULE_PARM_DESC(zil_slog_limit, "Max commit bytes to separate log device");
 #endif
@@ -97,6 +97,25 @@ extern int zfs_mg_alloc_failures;
 
 int zio_requeue_io_start_cut_in_line = B_TRUE;
 
+/*
+ * Writes of at least this many bytes are compressed on the pool's
+ * compression taskq rather than inline in the write issue thread.
+ */
+int zio_compress_dispatch_min = 32 << 10;
+
+/*
+ * Retry a failed allocation once, searching harder, before ganging it.
+ */
+int zio_gang_avoid_enabled = B_TRUE;
+
+/*
+ * Debugging aid for ztest: write level-0 blocks whose byteswap function is
+ * a plain array swap in the opposite byte order, exactly as a host of the
+ * other endianness would.  Every later read of such a block then goes
+ * through the byteswap checksum and dmu_ot byteswap paths.
+ */
+int zio_write_foreign_endian = 0;
+
 #ifdef ZFS_DEBUG
 int zio_buf_debug_limit = 16384;
 #else
@@ -104,6 +123,8 @@ int zio_buf_debug_limit = 0;
 #endif
 
 static inline void __zio_execute(zio_t *zio);
+static void zio_taskq_dispatch(zio_t *zio, enum zio_taskq_type q,
+    boolean_t cutinline);
 
 static int
 zio_cons(void *arg, void *unused, int kmflag)
@@ -215,7 +236,7 @@ zio_init(void)
 	zfs_mg_alloc_failures = MAX((3 * max_ncpus / 2), 8);
 
 	zio_inject_init();
-
+	zio_compress_init();
 }
 
 void
@@ -243,6 +264,7 @@ zio_fini(void)
 	kmem_cache_destroy(zio_link_cache);
 	kmem_cache_destroy(zio_cache);
 
+	zio_compress_fini();
 	zio_inject_fini();
 }
 
@@ -625,6 +647,7 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	zio->io_walk_link = NULL;
 	zio->io_transform_stack = NULL;
 	zio->io_delay = 0;
+	zio->io_timestamp = 0;
 	zio->io_error = 0;
 	zio->io_child_count = 0;
 	zio->io_parent_count = 0;
@@ -1005,6 +1028,63 @@ zio_read_bp_init(zio_t *zio)
 	return (ZIO_PIPELINE_CONTINUE);
 }
 
+/*
+ * Hand a write off to the compression taskq.  The stage is rewound so
+ * that zio_write_bp_init() runs again there; everything it does before
+ * compressing is idempotent.  Returns B_FALSE if the zio should just be
+ * compressed in the current thread, including when the taskq can't take
+ * it without blocking.
+ */
+static boolean_t
+zio_compress_dispatch(zio_t *zio, enum zio_compress compress)
+{
+	taskq_t *tq = zio->io_spa->spa_zio_compress_taskq;
+
+	if (tq == NULL || zio->io_size < zio_compress_dispatch_min)
+		return (B_FALSE);
+
+	/* zle and empty are cheaper than the taskq handoff */
+	if (compress == ZIO_COMPRESS_ZLE || compress == ZIO_COMPRESS_EMPTY)
+		return (B_FALSE);
+
+	/* See zio_taskq_dispatch() */
+	if (zio->io_flags & (ZIO_FLAG_CONFIG_WRITER | ZIO_FLAG_PROBE))
+		return (B_FALSE);
+
+	if (taskq_member(tq, zio->io_executor))
+		return (B_FALSE);
+
+	zio->io_stage >>= 1;
+	if (taskq_dispatch(tq, (task_func_t *)__zio_execute, zio,
+	    TQ_NOSLEEP) == 0) {
+		zio->io_stage <<= 1;
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+static boolean_t
+zio_write_foreign_endian_ok(zio_t *zio)
+{
+	zio_prop_t *zp = &zio->io_prop;
+
+	if (!zio_write_foreign_endian || zp->zp_level != 0 || zp->zp_dedup ||
+	    zio->io_child_type != ZIO_CHILD_LOGICAL ||
+	    !DMU_OT_IS_VALID(zp->zp_type))
+		return (B_FALSE);
+
+	switch (DMU_OT_BYTESWAP(zp->zp_type)) {
+	case DMU_BSWAP_UINT8:
+	case DMU_BSWAP_UINT16:
+	case DMU_BSWAP_UINT32:
+	case DMU_BSWAP_UINT64:
+		return (B_TRUE);
+	default:
+		return (B_FALSE);
+	}
+}
+
 static int
 zio_write_bp_init(zio_t *zio)
 {
@@ -1014,6 +1094,7 @@ zio_write_bp_init(zio_t *zio)
 	blkptr_t *bp = zio->io_bp;
 	uint64_t lsize = zio->io_size;
 	uint64_t psize = lsize;
+	uint64_t byteorder = ZFS_HOST_BYTEORDER;
 	int pass = 1;
 
 	/*
@@ -1048,6 +1129,7 @@ zio_write_bp_init(zio_t *zio)
 			return (ZIO_PIPELINE_CONTINUE);
 		}
 		zio->io_bp_override = NULL;
+		zio->io_pipeline = zio->io_orig_pipeline;
 		BP_ZERO(bp);
 	}
 
@@ -1075,9 +1157,34 @@ zio_write_bp_init(zio_t *zio)
 		    spa_max_replication(spa)) == BP_GET_NDVAS(bp));
 	}
 
+	if (compress != ZIO_COMPRESS_OFF && zio_compress_dispatch(zio, compress))
+		return (ZIO_PIPELINE_STOP);
+
+	if (zio_write_foreign_endian_ok(zio)) {
+		void *sbuf = zio_buf_alloc(lsize);
+
+		bcopy(zio->io_data, sbuf, lsize);
+		dmu_ot_byteswap[DMU_OT_BYTESWAP(zp->zp_type)].ob_func(sbuf,
+		    lsize);
+		zio_push_transform(zio, sbuf, lsize, lsize, NULL);
+		byteorder = !ZFS_HOST_BYTEORDER;
+	}
+
 	if (compress != ZIO_COMPRESS_OFF) {
-		void *cbuf = zio_buf_alloc(lsize);
-		psize = zio_compress_data(compress, zio->io_data, cbuf, lsize);
+		void *cbuf;
+
+		cbuf = zio_buf_alloc(lsize);
+		if (zp->zp_compress_auto != NULL) {
+			compress = zio_compress_auto_select(
+			    zp->zp_compress_auto);
+			psize = zio_compress_auto_data(compress,
+			    zio->io_data, cbuf, lsize);
+			zio_compress_auto_done(zp->zp_compress_auto, compress,
+			    lsize, psize);
+		} else {
+			psize = zio_compress_data(compress, zio->io_data,
+			    cbuf, lsize);
+		}
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
@@ -1117,7 +1224,7 @@ zio_write_bp_init(zio_t *zio)
 		BP_SET_TYPE(bp, zp->zp_type);
 		BP_SET_LEVEL(bp, zp->zp_level);
 		BP_SET_DEDUP(bp, zp->zp_dedup);
-		BP_SET_BYTEORDER(bp, ZFS_HOST_BYTEORDER);
+		BP_SET_BYTEORDER(bp, byteorder);
 		if (zp->zp_dedup) {
 			ASSERT(zio->io_child_type == ZIO_CHILD_LOGICAL);
 			ASSERT(!(zio->io_flags & ZIO_FLAG_IO_REWRITE));
@@ -1125,6 +1232,16 @@ zio_write_bp_init(zio_t *zio)
 		}
 	}
 
+	/*
+	 * The remaining write stages may block in metaslab allocation, so
+	 * don't tie up a compression thread with them.
+	 */
+	if (spa->spa_zio_compress_taskq != NULL &&
+	    taskq_member(spa->spa_zio_compress_taskq, zio->io_executor)) {
+		zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
+		return (ZIO_PIPELINE_STOP);
+	}
+
 	return (ZIO_PIPELINE_CONTINUE);
 }
 
@@ -1729,6 +1846,10 @@ zio_gang_tree_assemble(zio_t *gio, blkptr_t *bp, zio_gang_node_t **gnpp)
 	ASSERT(gio->io_gang_leader == gio);
 	ASSERT(BP_IS_GANG(bp));
 
+	/* frees and claims assemble the tree too; count only reads */
+	if (gio->io_type == ZIO_TYPE_READ)
+		SPA_GANGSTAT_BUMP(gio->io_spa, sgs_header_reads);
+
 	zio_nowait(zio_read(gio, gio->io_spa, bp, gn->gn_gbh,
 	    SPA_GANGBLOCKSIZE, zio_gang_tree_assemble_done, gn,
 	    gio->io_priority, ZIO_GANG_CHILD_FLAGS(gio), &gio->io_bookmark));
@@ -1918,11 +2039,13 @@ zio_write_gang_block(zio_t *pio)
 
 		zp.zp_checksum = gio->io_prop.zp_checksum;
 		zp.zp_compress = ZIO_COMPRESS_OFF;
+		zp.zp_compress_auto = NULL;
 		zp.zp_type = DMU_OT_NONE;
 		zp.zp_level = 0;
 		zp.zp_copies = gio->io_prop.zp_copies;
 		zp.zp_dedup = 0;
 		zp.zp_dedup_verify = 0;
+		zp.zp_special_smallblk = 0;
 
 		zio_nowait(zio_write(zio, spa, txg, &gbh->zg_blkptr[g],
 		    (char *)pio->io_data + (pio->io_size - resid), lsize, &zp,
@@ -1931,6 +2054,9 @@ zio_write_gang_block(zio_t *pio)
 		    &pio->io_bookmark));
 	}
 
+	SPA_GANGSTAT_BUMP(spa, sgs_headers);
+	SPA_GANGSTAT_INCR(spa, sgs_members, g);
+
 	/*
 	 * Set pio's pipeline to just wait for zio to finish.
 	 */
@@ -2326,7 +2452,8 @@ static int
 zio_dva_allocate(zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
-	metaslab_class_t *mc = spa_normal_class(spa);
+	zio_prop_t *zp = &zio->io_prop;
+	metaslab_class_t *mc;
 	blkptr_t *bp = zio->io_bp;
 	int error;
 	int flags = 0;
@@ -2351,8 +2478,55 @@ zio_dva_allocate(zio_t *zio)
 	flags |= (zio->io_flags & ZIO_FLAG_GANG_CHILD) ?
 	    METASLAB_GANG_CHILD : 0;
 	flags |= (zio->io_flags & ZIO_FLAG_FASTWRITE) ? METASLAB_FASTWRITE : 0;
+
+	/*
+	 * Async writes are subject to the allocation throttle, and are
+	 * counted against their vdevs' queue depth until zio_done().
+	 */
+	if (zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE &&
+	    !(zio->io_flags & ZIO_FLAG_NODATA))
+		flags |= METASLAB_ASYNC_ALLOC;
+
+	mc = spa_preferred_class(spa, zio->io_size, zp->zp_type,
+	    zp->zp_level, zp->zp_special_smallblk);
+
 	error = metaslab_alloc(spa, mc, zio->io_size, bp,
-	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags);
+	    zp->zp_copies, zio->io_txg, NULL, flags);
+
+	/*
+	 * If the special class is full or failing, the block can still
+	 * live on the normal vdevs.
+	 */
+	if (error != 0 && mc != spa_normal_class(spa)) {
+		mc = spa_normal_class(spa);
+		error = metaslab_alloc(spa, mc, zio->io_size, bp,
+		    zp->zp_copies, zio->io_txg, NULL, flags);
+	}
+
+	/*
+	 * Before falling back to a gang block, make one more pass with
+	 * METASLAB_GANG_AVOID.  That keeps groups which have hit
+	 * zfs_mg_alloc_failures from being skipped ("fast" ganging) and
+	 * ignores each group's free-segment bound, which may be stale.
+	 * It doesn't widen the search: each group's walk still ends at
+	 * the first metaslab whose weight is below the allocation size.
+	 * METASLAB_GANG_RETRY lets such a pass into each of those groups
+	 * only once per txg, so a run of ENOSPCs can't keep loading their
+	 * space maps.  Gang blocks cost an extra header write now and an
+	 * extra read on every later access, so a second pass is worth it.
+	 */
+	if (error == ENOSPC && zio_gang_avoid_enabled &&
+	    zio->io_size > SPA_MINBLOCKSIZE &&
+	    !(flags & (METASLAB_GANG_AVOID | METASLAB_GANG_CHILD))) {
+		error = metaslab_alloc(spa, mc, zio->io_size, bp,
+		    zp->zp_copies, zio->io_txg, NULL,
+		    flags | METASLAB_GANG_AVOID | METASLAB_GANG_RETRY);
+		if (error == 0)
+			SPA_GANGSTAT_BUMP(spa, sgs_avoided);
+	}
+
+	if (error == 0 && (flags & METASLAB_ASYNC_ALLOC))
+		zio->io_flags |= ZIO_FLAG_ALLOC_QUEUED;
 
 	if (error) {
 		spa_dbgmsg(spa, "%s: metaslab allocation failure: zio %p, "
@@ -2556,6 +2730,8 @@ zio_vdev_io_start(zio_t *zio)
 		if (zio->io_type == ZIO_TYPE_READ && vdev_cache_read(zio) == 0)
 			return (ZIO_PIPELINE_CONTINUE);
 
+		zio->io_timestamp = gethrtime();
+
 		if ((zio = vdev_queue_io(zio)) == NULL)
 			return (ZIO_PIPELINE_STOP);
 
@@ -2588,6 +2764,17 @@ zio_vdev_io_done(zio_t *zio)
 		if (zio->io_type == ZIO_TYPE_WRITE)
 			vdev_cache_write(zio);
 
+		/*
+		 * Time log block and dmu_sync() writes, queueing included,
+		 * for zil_prefer_indirect().
+		 */
+		if (zio->io_type == ZIO_TYPE_WRITE && zio->io_error == 0 &&
+		    zio->io_timestamp != 0 &&
+		    (zio->io_flags & ZIO_FLAG_SYNC_LATENCY) &&
+		    vd->vdev_top->vdev_mg != NULL)
+			metaslab_group_sync_write_done(vd->vdev_top->vdev_mg,
+			    gethrtime() - zio->io_timestamp);
+
 		if (zio_injection_enabled && zio->io_error == 0)
 			zio->io_error = zio_handle_device_injection(vd,
 			    zio, EIO);
@@ -3040,6 +3227,16 @@ zio_done(zio_t *zio)
 	 */
 	zio_inherit_child_errors(zio, ZIO_CHILD_LOGICAL);
 
+	/*
+	 * The write is no longer outstanding, whether or not it will be
+	 * reexecuted.  Do this before the blocks are unallocated below.
+	 */
+	if (zio->io_flags & ZIO_FLAG_ALLOC_QUEUED) {
+		ASSERT(!BP_IS_HOLE(zio->io_bp));
+		metaslab_alloc_queue_done(zio->io_spa, zio->io_bp);
+		zio->io_flags &= ~ZIO_FLAG_ALLOC_QUEUED;
+	}
+
 	if ((zio->io_error || zio->io_reexecute) &&
 	    IO_IS_ALLOCATING(zio) && zio->io_gang_leader == zio &&
 	    !(zio->io_flags & ZIO_FLAG_IO_REWRITE))
@@ -3263,4 +3460,12 @@ MODULE_PARM_DESC(zio_delay_max, "Max zio millisec delay before posting event");
 
 module_param(zio_requeue_io_start_cut_in_line, int, 0644);
 MODULE_PARM_DESC(zio_requeue_io_start_cut_in_line, "Prioritize requeued I/O");
+
+module_param(zio_compress_dispatch_min, int, 0644);
+MODULE_PARM_DESC(zio_compress_dispatch_min,
+	"Min write size compressed on the compression taskq");
+
+module_param(zio_gang_avoid_enabled, int, 0644);
+MODULE_PARM_DESC(zio_gang_avoid_enabled,
+	"Retry failed allocations before writing gang blocks");
 #endif
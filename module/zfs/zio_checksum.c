@@ -181,7 +181,8 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 		ci->ci_func[0](data, size, &cksum);
 		eck->zec_cksum = cksum;
 	} else {
-		ci->ci_func[0](data, size, &bp->blk_cksum);
+		ci->ci_func[BP_SHOULD_BYTESWAP(bp)](data, size,
+		    &bp->blk_cksum);
 	}
 }
 
@@ -52,6 +52,100 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{zle_compress,		zle_decompress,		64,	"zle"},
 };
 
+/*
+ * Before running lzjb over a block, or whichever algorithm
+ * compression=auto picked, zio_compress_data() runs lzjb over its first
+ * zio_compress_probe bytes.  If that prefix doesn't shrink by 12.5% the
+ * block is taken to be incompressible and stored as is, which saves
+ * running the real compressor over media files and other already
+ * compressed data.  An explicitly chosen gzip level always runs, as it
+ * may well compress what lzjb can't.  Zero disables the probe.
+ */
+int zio_compress_probe = 4096;
+
+typedef struct zio_compress_stats {
+	kstat_named_t zcs_zero_blocks;
+	kstat_named_t zcs_early_aborts;
+	kstat_named_t zcs_early_abort_bytes;
+	kstat_named_t zcs_incompressible;
+	kstat_named_t zcs_compressed;
+	kstat_named_t zcs_compressed_lsize;
+	kstat_named_t zcs_compressed_psize;
+} zio_compress_stats_t;
+
+static zio_compress_stats_t zio_compress_stats = {
+	{ "zero_blocks",		KSTAT_DATA_UINT64 },
+	{ "early_aborts",		KSTAT_DATA_UINT64 },
+	{ "early_abort_bytes",		KSTAT_DATA_UINT64 },
+	{ "incompressible",		KSTAT_DATA_UINT64 },
+	{ "compressed",			KSTAT_DATA_UINT64 },
+	{ "compressed_lsize",		KSTAT_DATA_UINT64 },
+	{ "compressed_psize",		KSTAT_DATA_UINT64 },
+};
+
+#define	ZCS_INCR(stat, val) \
+	atomic_add_64(&zio_compress_stats.stat.value.ui64, (val))
+#define	ZCS_BUMP(stat)	ZCS_INCR(stat, 1)
+
+static kstat_t *zio_compress_ksp;
+
+/*
+ * compression=auto tunables.  Blocks that fail the zio_compress_probe
+ * check above are stored uncompressed.  Other blocks use gzip when it
+ * has recently saved zio_compress_auto_gain percent more than lzjb on
+ * this objset, unless zio_compress_auto_cpu_pct percent of the CPUs
+ * are already busy in gzip.  Every zio_compress_auto_probe'th block
+ * tries the other algorithm so that both estimates follow the data.
+ */
+int zio_compress_auto_gain = 10;
+int zio_compress_auto_cpu_pct = 50;
+int zio_compress_auto_probe = 16;
+
+static uint32_t zio_compress_auto_busy;	/* gzip compressions in flight */
+
+#define	ZIO_COMPRESS_AUTO_FAST	ZIO_COMPRESS_LZJB
+#define	ZIO_COMPRESS_AUTO_GZIP	ZIO_COMPRESS_GZIP_6
+
+typedef struct zio_compress_auto_stats {
+	kstat_named_t zcas_off_blocks;
+	kstat_named_t zcas_off_bytes;
+	kstat_named_t zcas_lzjb_blocks;
+	kstat_named_t zcas_lzjb_lsize;
+	kstat_named_t zcas_lzjb_psize;
+	kstat_named_t zcas_gzip_blocks;
+	kstat_named_t zcas_gzip_lsize;
+	kstat_named_t zcas_gzip_psize;
+	kstat_named_t zcas_cpu_limited;
+} zio_compress_auto_stats_t;
+
+static zio_compress_auto_stats_t zio_compress_auto_stats_template = {
+	{ "off_blocks",			KSTAT_DATA_UINT64 },
+	{ "off_bytes",			KSTAT_DATA_UINT64 },
+	{ "lzjb_blocks",		KSTAT_DATA_UINT64 },
+	{ "lzjb_lsize",			KSTAT_DATA_UINT64 },
+	{ "lzjb_psize",			KSTAT_DATA_UINT64 },
+	{ "gzip_blocks",		KSTAT_DATA_UINT64 },
+	{ "gzip_lsize",			KSTAT_DATA_UINT64 },
+	{ "gzip_psize",			KSTAT_DATA_UINT64 },
+	{ "cpu_limited",		KSTAT_DATA_UINT64 },
+};
+
+#define	ZCAS_INCR(za, stat, val) \
+	atomic_add_64(&(za)->za_stats.stat.value.ui64, (val))
+#define	ZCAS_BUMP(za, stat)	ZCAS_INCR(za, stat, 1)
+
+struct zio_compress_auto {
+	zio_compress_auto_stats_t za_stats;
+	kstat_t		*za_ksp;
+	uint64_t	za_blocks;	/* compressible blocks seen */
+	/*
+	 * Recent psize / lsize of each algorithm in 1/1024ths.  Updated
+	 * without a lock; an occasional lost update is harmless.
+	 */
+	uint64_t	za_ratio_fast;
+	uint64_t	za_ratio_gzip;
+};
+
 enum zio_compress
 zio_compress_select(enum zio_compress child, enum zio_compress parent)
 {
@@ -68,10 +162,57 @@ zio_compress_select(enum zio_compress child, enum zio_compress parent)
 	return (child);
 }
 
-size_t
-zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
+/*
+ * Return B_TRUE if the buffer is all zeroes.  Eight words are OR'd
+ * together per iteration, so there is one branch per 64 bytes and the
+ * compiler is free to vectorize the loop body.
+ */
+static boolean_t
+zio_compress_zero(void *src, size_t s_len)
+{
+	uint64_t *word = src;
+	uint64_t *word_end = (uint64_t *)((char *)src + s_len);
+
+	/* Most data that isn't zero says so in the first word */
+	if (s_len >= sizeof (uint64_t) && *word != 0)
+		return (B_FALSE);
+
+	for (; word + 8 <= word_end; word += 8) {
+		if ((word[0] | word[1] | word[2] | word[3] |
+		    word[4] | word[5] | word[6] | word[7]) != 0)
+			return (B_FALSE);
+	}
+
+	for (; word < word_end; word++) {
+		if (*word != 0)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Trial-compress the zio_compress_probe byte prefix of src into dst
+ * with lzjb, returning B_TRUE if it doesn't shrink by 12.5%.
+ */
+static boolean_t
+zio_compress_probe_fails(void *src, void *dst, size_t s_len)
+{
+	size_t n = zio_compress_probe;
+	size_t d_len;
+
+	if (n < SPA_MINBLOCKSIZE || s_len < 2 * n)
+		return (B_FALSE);
+
+	d_len = n - (n >> 3);
+
+	return (lzjb_compress(src, dst, n, d_len, 0) > d_len);
+}
+
+static size_t
+zio_compress_data_impl(enum zio_compress c, void *src, void *dst,
+    size_t s_len, boolean_t probe)
 {
-	uint64_t *word, *word_end;
 	size_t c_len, d_len, r_len;
 	zio_compress_info_t *ci = &zio_compress_table[c];
 
@@ -82,13 +223,10 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	 * If the data is all zeroes, we don't even need to allocate
 	 * a block for it.  We indicate this by returning zero size.
 	 */
-	word_end = (uint64_t *)((char *)src + s_len);
-	for (word = src; word < word_end; word++)
-		if (*word != 0)
-			break;
-
-	if (word == word_end)
+	if (zio_compress_zero(src, s_len)) {
+		ZCS_BUMP(zcs_zero_blocks);
 		return (0);
+	}
 
 	if (c == ZIO_COMPRESS_EMPTY)
 		return (s_len);
@@ -98,10 +236,20 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	if (d_len == 0)
 		return (s_len);
 
+	/* zle is cheaper than the probe */
+	if (probe && c != ZIO_COMPRESS_ZLE &&
+	    zio_compress_probe_fails(src, dst, s_len)) {
+		ZCS_BUMP(zcs_early_aborts);
+		ZCS_INCR(zcs_early_abort_bytes, s_len);
+		return (s_len);
+	}
+
 	c_len = ci->ci_compress(src, dst, s_len, d_len, ci->ci_level);
 
-	if (c_len > d_len)
+	if (c_len > d_len) {
+		ZCS_BUMP(zcs_incompressible);
 		return (s_len);
+	}
 
 	/*
 	 * Cool.  We compressed at least as much as we were hoping to.
@@ -116,9 +264,31 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	ASSERT3U(c_len, <=, d_len);
 	ASSERT(P2PHASE(c_len, (size_t)SPA_MINBLOCKSIZE) == 0);
 
+	ZCS_BUMP(zcs_compressed);
+	ZCS_INCR(zcs_compressed_lsize, s_len);
+	ZCS_INCR(zcs_compressed_psize, c_len);
+
 	return (c_len);
 }
 
+size_t
+zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
+{
+	return (zio_compress_data_impl(c, src, dst, s_len,
+	    c == ZIO_COMPRESS_LZJB));
+}
+
+/*
+ * Compress a block with the algorithm zio_compress_auto_select() chose.
+ * The probe runs whichever it is.
+ */
+size_t
+zio_compress_auto_data(enum zio_compress c, void *src, void *dst,
+    size_t s_len)
+{
+	return (zio_compress_data_impl(c, src, dst, s_len, B_TRUE));
+}
+
 int
 zio_decompress_data(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len)
@@ -130,3 +300,160 @@ zio_decompress_data(enum zio_compress c, void *src, void *dst,
 
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
+
+zio_compress_auto_t *
+zio_compress_auto_create(char *name)
+{
+	zio_compress_auto_t *za;
+
+	za = kmem_zalloc(sizeof (zio_compress_auto_t), KM_SLEEP);
+	bcopy(&zio_compress_auto_stats_template, &za->za_stats,
+	    sizeof (zio_compress_auto_stats_t));
+	za->za_ratio_fast = 1024;
+	za->za_ratio_gzip = 1024;
+
+	za->za_ksp = kstat_create("zfs", 0, name, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (zio_compress_auto_stats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (za->za_ksp != NULL) {
+		za->za_ksp->ks_data = &za->za_stats;
+		kstat_install(za->za_ksp);
+	}
+
+	return (za);
+}
+
+void
+zio_compress_auto_destroy(zio_compress_auto_t *za)
+{
+	if (za->za_ksp != NULL)
+		kstat_delete(za->za_ksp);
+
+	kmem_free(za, sizeof (zio_compress_auto_t));
+}
+
+/*
+ * Pick the algorithm for one block.  Incompressible blocks are caught
+ * by the probe in zio_compress_data(), so only lzjb or gzip is chosen
+ * here.  The caller must report the result with zio_compress_auto_done(),
+ * which also releases the gzip CPU slot.
+ */
+enum zio_compress
+zio_compress_auto_select(zio_compress_auto_t *za)
+{
+	boolean_t gzip;
+	uint32_t busy;
+
+	if (za == NULL)
+		return (ZIO_COMPRESS_ON_VALUE);
+
+	gzip = (za->za_ratio_gzip + za->za_ratio_gzip *
+	    zio_compress_auto_gain / 100 < za->za_ratio_fast);
+	if (zio_compress_auto_probe > 0 &&
+	    atomic_add_64_nv(&za->za_blocks, 1) % zio_compress_auto_probe == 0)
+		gzip = !gzip;
+
+	if (!gzip)
+		return (ZIO_COMPRESS_AUTO_FAST);
+
+	busy = atomic_add_32_nv(&zio_compress_auto_busy, 1);
+	if (busy > MAX(max_ncpus * zio_compress_auto_cpu_pct / 100, 1)) {
+		atomic_add_32(&zio_compress_auto_busy, -1);
+		ZCAS_BUMP(za, zcas_cpu_limited);
+		return (ZIO_COMPRESS_AUTO_FAST);
+	}
+
+	return (ZIO_COMPRESS_AUTO_GZIP);
+}
+
+/*
+ * Account for a block written under compression=auto.  Here c is the
+ * algorithm returned by zio_compress_auto_select() and psize what
+ * zio_compress_data() returned for it.
+ */
+void
+zio_compress_auto_done(zio_compress_auto_t *za, enum zio_compress c,
+    size_t lsize, size_t psize)
+{
+	uint64_t ratio;
+
+	if (za == NULL)
+		return;
+
+	if (c == ZIO_COMPRESS_AUTO_GZIP)
+		atomic_add_32(&zio_compress_auto_busy, -1);
+
+	/* All-zero blocks become holes and say nothing about the data */
+	if (psize == 0)
+		return;
+
+	/*
+	 * Blocks stored uncompressed count only under off.  They were
+	 * mostly turned away by the probe before c ever ran, so they
+	 * don't tell us how c does and are left out of its ratio.
+	 */
+	if (psize == lsize) {
+		ZCAS_BUMP(za, zcas_off_blocks);
+		ZCAS_INCR(za, zcas_off_bytes, lsize);
+		return;
+	}
+
+	ratio = (psize << 10) / lsize;
+
+	switch (c) {
+	case ZIO_COMPRESS_AUTO_FAST:
+		za->za_ratio_fast = (za->za_ratio_fast * 7 + ratio) >> 3;
+		ZCAS_BUMP(za, zcas_lzjb_blocks);
+		ZCAS_INCR(za, zcas_lzjb_lsize, lsize);
+		ZCAS_INCR(za, zcas_lzjb_psize, psize);
+		break;
+	case ZIO_COMPRESS_AUTO_GZIP:
+		za->za_ratio_gzip = (za->za_ratio_gzip * 7 + ratio) >> 3;
+		ZCAS_BUMP(za, zcas_gzip_blocks);
+		ZCAS_INCR(za, zcas_gzip_lsize, lsize);
+		ZCAS_INCR(za, zcas_gzip_psize, psize);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+zio_compress_init(void)
+{
+	zio_compress_ksp = kstat_create("zfs", 0, "zio_compress", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zio_compress_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if (zio_compress_ksp != NULL) {
+		zio_compress_ksp->ks_data = &zio_compress_stats;
+		kstat_install(zio_compress_ksp);
+	}
+}
+
+void
+zio_compress_fini(void)
+{
+	if (zio_compress_ksp != NULL) {
+		kstat_delete(zio_compress_ksp);
+		zio_compress_ksp = NULL;
+	}
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zio_compress_probe, int, 0644);
+MODULE_PARM_DESC(zio_compress_probe,
+	"Prefix bytes that must compress before lzjb or auto compresses a block");
+
+module_param(zio_compress_auto_gain, int, 0644);
+MODULE_PARM_DESC(zio_compress_auto_gain,
+	"Extra % savings before compression=auto prefers gzip");
+
+module_param(zio_compress_auto_cpu_pct, int, 0644);
+MODULE_PARM_DESC(zio_compress_auto_cpu_pct,
+	"Max % of CPUs compression=auto may keep busy in gzip");
+
+module_param(zio_compress_auto_probe, int, 0644);
+MODULE_PARM_DESC(zio_compress_auto_probe,
+	"compression=auto tries the other algorithm every Nth block");
+#endif
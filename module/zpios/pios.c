@@ -34,6 +34,7 @@
 #include <sys/zfs_context.h>
 #include <sys/dmu.h>
 #include <sys/txg.h>
+#include <sys/zil.h>
 #include <linux/cdev.h>
 #include "zpios-internal.h"
 
@@ -156,6 +157,20 @@ zpios_dmu_object_free(run_args_t *run_args, objset_t *os, uint64_t obj)
 	return 0;
 }
 
+/*
+ * Read the data of a WR_NEED_COPY record into the log block.
+ */
+static int
+zpios_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+{
+	run_args_t *run_args = (run_args_t *)arg;
+
+	ASSERT(buf != NULL);
+
+	return dmu_read(run_args->os, lr->lr_foid, lr->lr_offset,
+			lr->lr_length, buf, DMU_READ_NO_PREFETCH);
+}
+
 static int
 zpios_dmu_setup(run_args_t *run_args)
 {
@@ -221,6 +236,9 @@ zpios_dmu_setup(run_args_t *run_args)
 		}
 	}
 
+	if (run_args->flags & DMU_WRITE_SYNC)
+		run_args->zilog = zil_open(os, zpios_get_data);
+
 	run_args->os = os;
 out_destroy:
 	if (rc) {
@@ -392,6 +410,11 @@ zpios_remove_objset(run_args_t *run_args)
 		}
 	}
 
+	if (run_args->zilog != NULL) {
+		zil_close(run_args->zilog);
+		run_args->zilog = NULL;
+	}
+
 	dmu_objset_disown(run_args->os, zpios_tag);
 
 	if (run_args->flags & DMU_REMOVE) {
@@ -437,6 +460,47 @@ zpios_cleanup_run(run_args_t *run_args)
 	vmem_free(run_args, sizeof(*run_args) + size);
 }
 
+/*
+ * Log a write as TX_WRITE records, split as zfs_log_write() would split
+ * it for a separate log device.  The records refer to the data written
+ * to the object (WR_NEED_COPY), which the ZIL reads straight into the
+ * log block with zpios_get_data(), unless DMU_WRITE_SYNC_COPY asks for
+ * a copy of it in each record (WR_COPIED).
+ */
+static void
+zpios_dmu_log_write(run_args_t *run_args, dmu_tx_t *tx, uint64_t object,
+		    uint64_t offset, uint64_t size, const void *buf)
+{
+	boolean_t copy = !!(run_args->flags & DMU_WRITE_SYNC_COPY);
+	itx_t *itx;
+	lr_write_t *lr;
+	uint64_t len;
+
+	while (size) {
+		len = MIN(size, SPA_MAXBLOCKSIZE >> 1);
+
+		itx = zil_itx_create(TX_WRITE, sizeof (*lr) + (copy ? len : 0));
+		lr = (lr_write_t *)&itx->itx_lr;
+		lr->lr_foid = object;
+		lr->lr_offset = offset;
+		lr->lr_length = len;
+		lr->lr_blkoff = 0;
+		BP_ZERO(&lr->lr_blkptr);
+		if (copy)
+			bcopy(buf, lr + 1, len);
+
+		itx->itx_wr_state = copy ? WR_COPIED : WR_NEED_COPY;
+		itx->itx_sod += (copy ? 0 : len);
+		itx->itx_private = run_args;
+		itx->itx_sync = B_TRUE;
+		zil_itx_assign(run_args->zilog, itx, tx);
+
+		buf = (const char *)buf + len;
+		offset += len;
+		size -= len;
+	}
+}
+
 static int
 zpios_dmu_write(run_args_t *run_args, objset_t *os, uint64_t object,
 		uint64_t offset, uint64_t size, const void *buf)
@@ -471,8 +535,13 @@ zpios_dmu_write(run_args_t *run_args, objset_t *os, uint64_t object,
 //		flags |= DMU_WRITE_ZEROCOPY;
 
 	dmu_write(os, object, offset, size, buf, tx);
+	if (run_args->flags & DMU_WRITE_SYNC)
+		zpios_dmu_log_write(run_args, tx, object, offset, size, buf);
 	dmu_tx_commit(tx);
 
+	if (run_args->flags & DMU_WRITE_SYNC)
+		zil_commit(run_args->zilog, object);
+
 	return 0;
 }
 
@@ -527,6 +596,10 @@ zpios_thread_main(void *data)
 	/* Trivial data verification pattern for now. */
 	if (run_args->flags & DMU_VERIFY)
 		memset(buf, 'z', chunk_size);
+	else if (run_args->flags & DMU_FILL_ZERO)
+		memset(buf, 0, chunk_size);
+	else if (run_args->flags & DMU_FILL_RANDOM)
+		get_random_bytes(buf, chunk_size);
 
 	/* Write phase */
 	mutex_enter(&thr->lock);
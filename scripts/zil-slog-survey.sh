@@ -0,0 +1,134 @@
+#!/bin/bash
+#
+# Measure how synchronous write throughput on a single dataset scales
+# with the number of separate log devices.  For each log device count
+# a file backed pool is created (zpool-config/file-raid0-slog.sh),
+# several writers write to one sync=always dataset, so that every write
+# is committed to the log, and the throughput and peak number of log
+# blocks in flight are reported.
+#
+
+basedir="$(dirname $0)"
+
+SCRIPT_COMMON=common.sh
+if [ -f "${basedir}/${SCRIPT_COMMON}" ]; then
+. "${basedir}/${SCRIPT_COMMON}"
+else
+echo "Missing helper script ${SCRIPT_COMMON}" && exit 1
+fi
+
+PROG=zil-slog-survey.sh
+
+usage() {
+cat << EOF
+USAGE:
+$0 [hv] [-m max_logs] [-t threads] [-b blocksize] [-n count]
+
+DESCRIPTION:
+        Survey sync write throughput of one dataset against the
+        number of file backed log devices.
+
+OPTIONS:
+        -h      Show this message
+        -v      Verbose
+        -m      Largest number of log devices to try (default 4)
+        -t      Concurrent writers (default 8)
+        -b      Write size in KiB (default 8)
+        -n      Writes per writer (default 2048)
+
+EOF
+}
+
+ZPOOL_NAME=zil-slog-survey
+MAX_LOGS=4
+THREADS=8
+BLOCKSIZE=8
+COUNT=2048
+
+while getopts 'hvm:t:b:n:' OPTION; do
+	case $OPTION in
+	h)
+		usage
+		exit 1
+		;;
+	v)
+		VERBOSE=1
+		VERBOSE_FLAG="-v"
+		;;
+	m)
+		MAX_LOGS=${OPTARG}
+		;;
+	t)
+		THREADS=${OPTARG}
+		;;
+	b)
+		BLOCKSIZE=${OPTARG}
+		;;
+	n)
+		COUNT=${OPTARG}
+		;;
+	?)
+		usage
+		exit 1
+		;;
+	esac
+done
+
+if [ $(id -u) != 0 ]; then
+	die "Must run as root"
+fi
+
+# Print the zil-<pool>-<objset> kstats, from /proc on Linux or from
+# the kstat.zfs.misc sysctl tree elsewhere, as "name value" lines.
+zil_slog_kstats() {
+	if [ -d /proc/spl/kstat/zfs ]; then
+		cat /proc/spl/kstat/zfs/zil-${ZPOOL_NAME}-* 2>/dev/null | \
+			${AWK} 'NF == 3 { print $1, $3 }'
+	else
+		${SYSCTL} kstat.zfs.misc 2>/dev/null | \
+			${AWK} -v pool="zil-${ZPOOL_NAME}-" -F ': *' \
+			'index($1, pool) { n = split($1, f, "."); print f[n], $2 }'
+	fi
+}
+
+zil_slog_write() {
+	local DIR=/${ZPOOL_NAME}/wal
+
+	for (( i=0; i<${THREADS}; i++ )); do
+		dd if=/dev/zero of=${DIR}/file${i} bs=${BLOCKSIZE}k \
+			count=${COUNT} &>/dev/null &
+	done
+	wait
+}
+
+zil_slog_run() {
+	local LOGS=$1
+	local TIMEFORMAT=%R
+	local ELAPSED BYTES
+
+	LOG_DEVICES=${LOGS} ${ZPOOL_CREATE_SH} ${VERBOSE_FLAG} \
+		-p ${ZPOOL_NAME} -c file-raid0-slog || die "Unable to create pool"
+	${ZFS} create -o sync=always ${ZPOOL_NAME}/wal || \
+		die "Unable to create ${ZPOOL_NAME}/wal"
+
+	# sync=always makes each write synchronous, no O_DSYNC needed
+	ELAPSED=$( { time zil_slog_write; } 2>&1 )
+
+	BYTES=$((${THREADS} * ${COUNT} * ${BLOCKSIZE} * 1024))
+	printf "%4d %12d " ${LOGS} ${BYTES}
+	echo "${ELAPSED} ${BYTES}" | \
+		${AWK} '{ printf "%10.2f ", $2 / ($1 > 0 ? $1 : 1) / 1048576 }'
+	zil_slog_kstats | \
+		${AWK} '$1 == "lwbs_inflight_max" { m = ($2 > m) ? $2 : m }
+		END { printf "%10d\n", m }'
+
+	LOG_DEVICES=${LOGS} ${ZPOOL_CREATE_SH} ${VERBOSE_FLAG} \
+		-p ${ZPOOL_NAME} -c file-raid0-slog -d
+}
+
+printf "%4s %12s %10s %10s\n" "logs" "bytes" "MiB/s" "inflight"
+for (( LOGS=1; LOGS<=${MAX_LOGS}; LOGS++ )); do
+	zil_slog_run ${LOGS}
+done
+
+exit 0
@@ -102,6 +102,12 @@ print_stats() {
 			cat /proc/spl/kstat/zfs/vdev_cache_stats
 			echo
 		fi
+
+		if [ -f /proc/spl/kstat/zfs/zil ]; then
+			echo "* ZIL"
+			cat /proc/spl/kstat/zfs/zil
+			echo
+		fi
 	fi
 
 	if [ -f /proc/spl/kmem/slab ]; then
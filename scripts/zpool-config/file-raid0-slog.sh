@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# 4 File Raid-0 Configuration with ${LOG_DEVICES} File Log Devices
+#
+
+LOG_DEVICES=${LOG_DEVICES:-4}
+
+FILES="/tmp/zpool-vdev0  \
+       /tmp/zpool-vdev1  \
+       /tmp/zpool-vdev2  \
+       /tmp/zpool-vdev3"
+
+LOG_FILES=""
+for (( i=0; i<${LOG_DEVICES}; i++ )); do
+	LOG_FILES="${LOG_FILES} /tmp/zpool-log${i}"
+done
+
+zpool_create() {
+	for FILE in ${FILES} ${LOG_FILES}; do
+		msg "Creating ${FILE}"
+		rm -f ${FILE} || exit 1
+		dd if=/dev/zero of=${FILE} bs=1024k count=0 seek=256 \
+			&>/dev/null || die "Error $? creating ${FILE}"
+	done
+
+	msg ${ZPOOL} create ${FORCE_FLAG} ${ZPOOL_NAME} ${FILES} log ${LOG_FILES}
+	${ZPOOL} create ${FORCE_FLAG} ${ZPOOL_NAME} ${FILES} \
+		log ${LOG_FILES} || exit 1
+}
+
+zpool_destroy() {
+	msg ${ZPOOL} destroy ${ZPOOL_NAME}
+	${ZPOOL} destroy ${ZPOOL_NAME}
+
+	for FILE in ${FILES} ${LOG_FILES}; do
+		msg "Removing ${FILE}"
+		rm -f ${FILE} || exit 1
+	done
+}